@@ -1,74 +1,136 @@
+#include <getopt.h>
 #include <cstring>
 #include <iostream>
-#include <algorithm>
 #include <functional>
-#include <sstream>
+#include <utility>
+#include <boost/lexical_cast.hpp>
 #include "fileformat.hh"
+#include "parallel.hh"
+#include "stats.h"
 
-class Entry {
-  Header_type header;
-  unsigned long histogram[256][256];
+enum class Output_format { CSV, RAW, NPY };
 
-  void clear() {
-    memset(histogram, 0, sizeof(histogram));
-  }
-public:
-  Entry() {
-    clear();
-  }
-  Entry(const Header_type &h) : header(h) {
-    clear();
-  }
-  unsigned long &operator()(int x, int y) {
-    return histogram[x][y];
-  }
-  unsigned long operator()(int x, int y) const {
-    return histogram[x][y];
-  }
-  const Header_type &get_header() const { return header; }
+struct CLIParams {
+  unsigned int jobs;
+  Output_format format;
+  bool normalise; //!< write relative frequencies as float32
 };
 
-Entry reader_fun(const char *fname) {
-  std::ifstream in(fname);
-  unsigned long count;
-  char ch;
-  std::string line;
+Two_gram_histogram reader_fun(const char *fname) {
+  uint64_t bytes;
+
+  Two_gram_histogram entry(read_2gram_histogram(fname, &bytes));
+  stats_add(bytes, entry.get_cells().size());
+  stats_count("files read", 1);
+  return entry;
+}
 
-  Entry entry(read_header(in));
-  while(getline(in, line)) {
-    try {
-      std::istringstream sin(line);
-      std::vector<uint8_t> two_gram(read_ngram_line(2, sin));
-      sin >> ch >> std::hex >> count;
-      entry(two_gram.at(0), two_gram.at(1)) = count;
-      //std::cout << ch << two_gram.at(0) << ' ' << two_gram.at(1) << '\t' << count << std::endl;
+/*! \brief Format one tab separated row */
+std::string csv_row(const Two_gram_histogram &entry) {
+  std::string row(entry.get_header().at("fname"));
+  auto cell = entry.get_cells().begin();
+  char buf[32];
+
+  row.reserve(row.size() + 2 * 65536 + 16 * entry.get_cells().size());
+  for(int pos = 0; pos < 65536; ++pos) {
+    if(cell != entry.get_cells().end() && cell->first == pos) {
+      row += '\t';
+      row.append(buf, snprintf(buf, sizeof(buf), "%lu", cell->second));
+      ++cell;
+    } else {
+      row += "\t0";
     }
-    catch(std::exception &excp) {
-      std::cerr << "Error in line '" << line << "': " << excp.what() << std::endl;
-      throw;
+  }
+  row += '\n';
+  return row;
+}
+
+static void put_le(char *dst, uint64_t val, int bytes) {
+  for(int i = 0; i < bytes; ++i) dst[i] = (val >> (8 * i)) & 0xFF;
+}
+
+/*! \brief Format one row of a little endian matrix
+ *
+ * Either 65536 uint64 counts or, if normalised, 65536 float32
+ * relative frequencies.
+ */
+std::string binary_row(const Two_gram_histogram &entry, bool normalise) {
+  const int width = normalise ? 4 : 8;
+  std::string row(65536 * width, '\0');
+
+  for(auto &cell : entry.get_cells()) {
+    if(normalise) {
+      float f = static_cast<float>(static_cast<double>(cell.second) / entry.get_total());
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      put_le(&row[cell.first * width], bits, width);
+    } else {
+      put_le(&row[cell.first * width], cell.second, width);
     }
-  };
-  return entry;
+  }
+  return row;
 }
 
-std::ostream &writer_fun(std::ostream &out, const Entry &entry) {
-  std::cout << entry.get_header().at("fname");
-  for(int y = 0; y < 256; ++y) {
-    for(int x = 0; x < 256; ++x) {
-      std::cout << '\t' << entry(x, y);
+static CLIParams cli_parse(int argc, char **argv) {
+  CLIParams params = { 0, Output_format::CSV, false };
+  int opt;
+
+  while((opt = getopt(argc, argv, "j:f:N")) != -1) {
+    switch(opt) {
+    case 'j':
+      params.jobs = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'f':
+      if(strcmp(optarg, "csv") == 0) params.format = Output_format::CSV;
+      else if(strcmp(optarg, "raw") == 0) params.format = Output_format::RAW;
+      else if(strcmp(optarg, "npy") == 0) params.format = Output_format::NPY;
+      else throw std::invalid_argument(std::string("unknown format ") + optarg);
+      break;
+    case 'N':
+      params.normalise = true;
+      break;
+    default:
+      throw std::invalid_argument("bad option");
     }
   }
-  std::cout << std::endl;
-  return out;
-};
+  return params;
+}
 
 int main(int argc, char **argv) {
-  if(argc < 2) {
-    std::cerr << "2gram_histo_to_csv <files...>\n";
+  CLIParams params;
+
+  if(stats_init(&argc, argv, "2gram_histo_to_csv") != 0) return 1;
+  try {
+    params = cli_parse(argc, argv);
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Error: " << excp.what() << '\n';
+    optind = argc;
+  }
+  if(optind >= argc) {
+    std::cerr << "2gram_histo_to_csv [-j jobs] [-f csv|raw|npy] [-N] [--stats[=json]] <files...>\n";
+    return 1;
+  }
+  if(params.format == Output_format::CSV && params.normalise) {
+    std::cerr << "Normalisation (-N) needs a binary format (-f raw|npy).\n";
+    return 1;
+  }
+  try {
+    stats_phase("convert");
+    if(params.format == Output_format::NPY) {
+      std::cout << npy_header(params.normalise ? "<f4" : "<u8", argc - optind, 65536);
+    }
+    ordered_parallel_map(&argv[optind], &argv[argc], params.jobs, [&params](const char *fname) {
+	Two_gram_histogram entry(reader_fun(fname));
+	return params.format == Output_format::CSV ? csv_row(entry) : binary_row(entry, params.normalise);
+      }, [](const std::string &row) {
+	std::cout.write(row.data(), row.size());
+      });
+    std::cout.flush();
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Error! Exception: " << excp.what() << std::endl;
     return 1;
   }
-  std::vector<Entry> entries(argc - 1);
-  std::transform(&argv[1], &argv[argc], entries.begin(), &reader_fun);
-  std::for_each(entries.begin(), entries.end(), std::bind(writer_fun, std::ref(std::cout), std::placeholders::_1));
   return 0;
 }
@@ -0,0 +1,57 @@
+#include "anchors.hh"
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include "chunkset.hh"
+
+std::vector<Anchor> winnow_anchors(const uint8_t *data, size_t len, unsigned int n, unsigned int window) {
+  std::vector<Anchor> anchors;
+  std::deque<Anchor> minima; //!< candidates with increasing hashes
+  ReferenceKeys keys(n);
+
+  if(n == 0 || window == 0) return anchors;
+  keys.for_each_hashed_window(data, len, [&](uint64_t hash, const uint8_t *, size_t pos) {
+      while(!minima.empty() && minima.back().hash > hash) minima.pop_back();
+      minima.push_back(Anchor { hash, pos });
+      if(minima.front().offset + window <= pos) minima.pop_front();
+      if(pos + 1 >= window && (anchors.empty() || anchors.back().offset != minima.front().offset)) {
+	anchors.push_back(minima.front());
+      }
+    });
+  //Data shorter than one winnowing window still gets its minimum.
+  if(anchors.empty() && !minima.empty()) anchors.push_back(minima.front());
+  return anchors;
+}
+
+
+void unique_anchors(std::vector<Anchor> &anchors, const uint8_t *data, unsigned int n) {
+  std::sort(anchors.begin(), anchors.end(), [data, n](const Anchor &a, const Anchor &b) {
+      if(a.hash != b.hash) return a.hash < b.hash;
+      int cmp = std::memcmp(data + a.offset, data + b.offset, n);
+      return cmp < 0 || (cmp == 0 && a.offset < b.offset);
+    });
+  anchors.erase(std::unique(anchors.begin(), anchors.end(), [data, n](const Anchor &a, const Anchor &b) {
+	return a.hash == b.hash && std::memcmp(data + a.offset, data + b.offset, n) == 0;
+      }), anchors.end());
+}
+
+
+std::vector<int64_t> match_anchors(const std::vector<Anchor> &reference, const uint8_t *ref_data, const uint8_t *data, size_t len, unsigned int n, unsigned int window) {
+  std::vector<int64_t> offsets(reference.size(), -1);
+  std::vector<Anchor> anchors(winnow_anchors(data, len, n, window));
+  auto by_hash = [](const Anchor &a, const Anchor &b) { return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset); };
+
+  std::sort(anchors.begin(), anchors.end(), by_hash);
+  //Merge join on the hash, equal hashes are verified against the data.
+  auto it = anchors.begin();
+  for(size_t i = 0; i < reference.size() && it != anchors.end(); ++i) {
+    while(it != anchors.end() && it->hash < reference[i].hash) ++it;
+    for(auto cand = it; cand != anchors.end() && cand->hash == reference[i].hash; ++cand) {
+      if(std::memcmp(ref_data + reference[i].offset, data + cand->offset, n) == 0) {
+	offsets[i] = cand->offset;
+	break;
+      }
+    }
+  }
+  return offsets;
+}
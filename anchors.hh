@@ -0,0 +1,50 @@
+#ifndef __ANCHORS_HH_2026__
+#define __ANCHORS_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/*! \brief Fingerprint of one n-byte window */
+struct Anchor {
+  uint64_t hash;
+  uint64_t offset;
+};
+
+/*! \brief Select anchors by winnowing
+ *
+ * Every n-byte window is hashed with a rolling hash and in each run of
+ * window consecutive hashes the minimum is selected (the earlier one
+ * on ties, so runs of equal data do not select every offset). Two
+ * files sharing a substring of at least window + n - 1 bytes are
+ * guaranteed to share an anchor inside it, while only about
+ * 2 / (window + 1) of the offsets become anchors.
+ *
+ * \param data file data
+ * \param len length of the data
+ * \param n window (chunk) length in bytes
+ * \param window winnowing window in hashes
+ * \return anchors in offset order
+ */
+std::vector<Anchor> winnow_anchors(const uint8_t *data, size_t len, unsigned int n, unsigned int window);
+
+/*! \brief Sort anchors by hash and keep one anchor per distinct chunk
+ *
+ * Anchors with equal hashes are compared byte-wise, so a hash
+ * collision does not merge different chunks.
+ */
+void unique_anchors(std::vector<Anchor> &anchors, const uint8_t *data, unsigned int n);
+
+/*! \brief Find the reference anchors in another file
+ *
+ * The file is winnowed with the same parameters and every candidate
+ * with an equal hash is verified byte-wise against the reference data.
+ *
+ * \param reference anchors of the reference as returned by unique_anchors()
+ * \param ref_data data of the reference file
+ * \param data data of the other file
+ * \param len length of the other file
+ * \return for each reference anchor its first offset in the other file or -1
+ */
+std::vector<int64_t> match_anchors(const std::vector<Anchor> &reference, const uint8_t *ref_data, const uint8_t *data, size_t len, unsigned int n, unsigned int window);
+
+#endif
@@ -0,0 +1,129 @@
+#include "approxmatch.hh"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "chunkset.hh"
+
+unsigned int hamming_distance(const uint8_t *a, const uint8_t *b, size_t n, unsigned int limit) {
+  unsigned int dist = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for(; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    dist += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)));
+    if(dist > limit) return dist;
+  }
+#else
+  //Fold every differing byte of the xor into its lowest bit.
+  for(; i + 8 <= n; i += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    uint64_t t = x ^ y;
+    t |= t >> 4;
+    t |= t >> 2;
+    t |= t >> 1;
+    dist += __builtin_popcountll(t & 0x0101010101010101ULL);
+    if(dist > limit) return dist;
+  }
+#endif
+  for(; i < n; ++i) dist += a[i] != b[i];
+  return dist;
+}
+
+
+std::vector<uint32_t> mismatch_positions(const uint8_t *a, const uint8_t *b, size_t n) {
+  std::vector<uint32_t> positions;
+  for(size_t i = 0; i < n; ++i) {
+    if(a[i] != b[i]) positions.push_back(i);
+  }
+  return positions;
+}
+
+
+BlockIndex::BlockIndex(const uint8_t *data, size_t len, unsigned int n_, unsigned int k_) : ref(data), n(n_), k(k_), block_len(n_ / (k_ + 1)), mask(0) {
+  if(block_len == 0) throw std::invalid_argument("chunk size must be larger than the number of mismatches");
+  if(len < n) return;
+  //Unique chunks of the reference, a run of equal data gives one chunk.
+  ReferenceKeys keys(n);
+  std::vector<ReferenceKeys::key_type> unique;
+  unique.reserve(len - n + 1);
+  keys.for_each_window(data, len, [&unique](ReferenceKeys::key_type key, size_t) { unique.push_back(key); });
+  keys.sort_unique(unique);
+  if(unique.size() > UINT32_MAX) throw std::length_error("too many chunks for the block index");
+  chunks.reserve(unique.size());
+  for(auto key : unique) chunks.push_back(key - data);
+  unique.clear();
+  unique.shrink_to_fit();
+  std::sort(chunks.begin(), chunks.end());
+  //Hashes of all blocks of the reference, then one entry per chunk block.
+  std::vector<uint64_t> block_hashes(len - block_len + 1);
+  ReferenceKeys(block_len).for_each_hashed_window(data, len, [&block_hashes](uint64_t hash, ReferenceKeys::key_type, size_t pos) {
+      block_hashes[pos] = hash;
+    });
+  entries.reserve(chunks.size() * (k + 1));
+  for(size_t i = 0; i < chunks.size(); ++i) {
+    for(unsigned int j = 0; j <= k; ++j) {
+      entries.push_back(Entry { block_hashes[chunks[i] + j * block_len], static_cast<uint32_t>(i), j });
+    }
+  }
+  block_hashes.clear();
+  block_hashes.shrink_to_fit();
+  std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+      return a.hash < b.hash || (a.hash == b.hash && a.chunk < b.chunk);
+    });
+  size_t distinct = 0;
+  for(size_t i = 0; i < entries.size(); ++i) {
+    if(i == 0 || entries[i].hash != entries[i - 1].hash) ++distinct;
+  }
+  size_t table_size = 16;
+  while(table_size < 2 * distinct) table_size *= 2;
+  table.assign(table_size, UINT32_MAX);
+  mask = table_size - 1;
+  if(entries.size() >= UINT32_MAX) throw std::length_error("too many blocks for the block index");
+  for(size_t i = 0; i < entries.size(); ++i) {
+    if(i > 0 && entries[i].hash == entries[i - 1].hash) continue;
+    uint64_t slot = entries[i].hash & mask;
+    while(table[slot] != UINT32_MAX) slot = (slot + 1) & mask;
+    table[slot] = i;
+  }
+}
+
+
+long BlockIndex::find(uint64_t hash) const {
+  for(uint64_t slot = hash & mask; table[slot] != UINT32_MAX; slot = (slot + 1) & mask) {
+    if(entries[table[slot]].hash == hash) return table[slot];
+  }
+  return -1;
+}
+
+
+std::vector<ApproxMatch> BlockIndex::match(const uint8_t *data, size_t len) const {
+  std::vector<ApproxMatch> found(chunks.size(), ApproxMatch { -1, 0, std::vector<uint32_t>() });
+  size_t missing = chunks.size();
+
+  if(chunks.empty() || len < n) return found;
+  ReferenceKeys(block_len).for_each_hashed_window(data, len, [&](uint64_t hash, ReferenceKeys::key_type, size_t pos) {
+      if(missing == 0) return;
+      long idx = find(hash);
+      if(idx < 0) return;
+      for(auto e = entries.begin() + idx; e != entries.end() && e->hash == hash; ++e) {
+	size_t shift = static_cast<size_t>(e->block) * block_len;
+	if(pos < shift || pos - shift + n > len || found[e->chunk].offset >= 0) continue;
+	const uint8_t *candidate = data + pos - shift;
+	unsigned int dist = hamming_distance(ref + chunks[e->chunk], candidate, n, k);
+	if(dist <= k) {
+	  found[e->chunk].offset = pos - shift;
+	  found[e->chunk].distance = dist;
+	  if(dist > 0) found[e->chunk].mismatches = mismatch_positions(ref + chunks[e->chunk], candidate, n);
+	  --missing;
+	}
+      }
+    });
+  return found;
+}
@@ -0,0 +1,63 @@
+#ifndef __APPROXMATCH_HH_2026__
+#define __APPROXMATCH_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/*! \brief Number of differing bytes, stops counting above limit
+ *
+ * Uses SSE2 byte compares where available and a word-wise fallback
+ * otherwise. The result is only exact if it is at most limit.
+ */
+unsigned int hamming_distance(const uint8_t *a, const uint8_t *b, size_t n, unsigned int limit);
+
+/*! \brief Offsets of the differing bytes */
+std::vector<uint32_t> mismatch_positions(const uint8_t *a, const uint8_t *b, size_t n);
+
+/*! \brief Approximate occurrence of a chunk, offset -1 if none */
+struct ApproxMatch {
+  int64_t offset;
+  unsigned int distance;
+  std::vector<uint32_t> mismatches; //!< differing positions in the chunk
+};
+
+/*! \brief Multi-index of the chunks of a reference for Hamming search
+ *
+ * Pigeonhole principle: a chunk of n bytes with at most k mismatches
+ * has at least one of its k + 1 disjoint blocks of n / (k + 1) bytes
+ * unchanged. Each block of every unique chunk of the reference is
+ * indexed by its hash; a rolling hash over another file finds the
+ * candidates, which are verified with hamming_distance().
+ */
+class BlockIndex {
+  struct Entry {
+    uint64_t hash;
+    uint32_t chunk;
+    uint32_t block;
+  };
+  const uint8_t *ref;
+  unsigned int n;
+  unsigned int k;
+  unsigned int block_len;
+  std::vector<uint64_t> chunks; //!< offsets of the unique chunks
+  std::vector<Entry> entries; //!< sorted by hash
+  std::vector<uint32_t> table; //!< first entry of each hash, open addressing
+  uint64_t mask;
+
+  long find(uint64_t hash) const;
+public:
+  /*! \brief Index the unique chunks of the reference data
+   *
+   * The data must stay valid while the index is used. Throws
+   * std::invalid_argument if n / (k + 1) is zero.
+   */
+  BlockIndex(const uint8_t *data, size_t len, unsigned int n, unsigned int k);
+  size_t size() const { return chunks.size(); }
+  uint64_t chunk_offset(size_t i) const { return chunks[i]; }
+  const uint8_t *chunk(size_t i) const { return ref + chunks[i]; }
+  unsigned int get_block_len() const { return block_len; }
+  /*! \brief Find an occurrence with at most k mismatches for each chunk */
+  std::vector<ApproxMatch> match(const uint8_t *data, size_t len) const;
+};
+
+#endif
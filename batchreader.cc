@@ -0,0 +1,405 @@
+#include "batchreader.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include "mappedfile.hh"
+#include "stats.h"
+
+FileView FileView::failed(const std::string &fname, const std::string &error) {
+  FileView view;
+  view.fname = fname;
+  view.error = error;
+  return view;
+}
+
+const FileView &FileView::check() const {
+  if(!error.empty()) throw std::runtime_error(error);
+  return *this;
+}
+
+
+BufferPool::~BufferPool() {
+  for(auto &buffer : free_buffers) std::free(buffer.first);
+}
+
+void BufferPool::release(uint8_t *buffer, size_t capacity) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(free_buffers.size() < max_free) {
+      free_buffers.emplace_back(buffer, capacity);
+      return;
+    }
+  }
+  std::free(buffer);
+}
+
+std::shared_ptr<uint8_t> BufferPool::acquire(size_t size) {
+  uint8_t *buffer = NULL;
+  size_t capacity = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    //Prefer the smallest buffer which fits, else grow the largest one.
+    size_t best = free_buffers.size();
+    for(size_t i = 0; i < free_buffers.size(); ++i) {
+      if(best == free_buffers.size()
+	 || (free_buffers[i].second >= size && (free_buffers[best].second < size || free_buffers[i].second < free_buffers[best].second))
+	 || (free_buffers[best].second < size && free_buffers[i].second > free_buffers[best].second)) {
+	best = i;
+      }
+    }
+    if(best < free_buffers.size()) {
+      buffer = free_buffers[best].first;
+      capacity = free_buffers[best].second;
+      free_buffers[best] = free_buffers.back();
+      free_buffers.pop_back();
+    }
+  }
+  if(capacity < size) {
+    std::free(buffer);
+    for(capacity = 4096; capacity < size; capacity *= 2);
+    buffer = static_cast<uint8_t*>(std::malloc(capacity));
+    if(!buffer) throw std::bad_alloc();
+  }
+  auto self = shared_from_this();
+  return std::shared_ptr<uint8_t>(buffer, [self, capacity](uint8_t *p) { self->release(p, capacity); });
+}
+
+
+static std::string error_message(const std::string &fname, int err) {
+  return fname + ": " + std::strerror(err);
+}
+
+//! Map (or block read) a file which is not read into a pool buffer.
+static FileView map_file(const std::string &fname) {
+  try {
+    auto file = std::make_shared<MappedFile>(fname.c_str());
+    return FileView(fname, file, file->data(), file->size());
+  }
+  catch(const std::exception &excp) {
+    return FileView::failed(fname, excp.what());
+  }
+}
+
+//! Read the rest of a file after a short read, the buffer holds size bytes.
+static bool pread_all(int fd, uint8_t *buffer, size_t size, size_t &done) {
+  while(done < size) {
+    ssize_t got = pread(fd, buffer + done, size - done, done);
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      return false;
+    }
+    if(got == 0) break;
+    done += got;
+  }
+  return true;
+}
+
+FileView read_file(const std::string &fname, size_t map_threshold, const std::shared_ptr<BufferPool> &pool_) {
+  struct stat buf;
+  int fd;
+
+  if(fname == "-") return map_file(fname);
+  if((fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC)) == -1) return FileView::failed(fname, error_message(fname, errno));
+  if(fstat(fd, &buf) != 0 || !S_ISREG(buf.st_mode) || buf.st_size == 0 || static_cast<size_t>(buf.st_size) >= map_threshold) {
+    close(fd);
+    return map_file(fname);
+  }
+  std::shared_ptr<BufferPool> pool(pool_ ? pool_ : std::make_shared<BufferPool>(0));
+  std::shared_ptr<uint8_t> buffer(pool->acquire(buf.st_size));
+  size_t done = 0;
+  bool ok = pread_all(fd, buffer.get(), buf.st_size, done);
+  int err = errno;
+  close(fd);
+  if(!ok) return FileView::failed(fname, error_message(fname, err));
+  return FileView(fname, buffer, buffer.get(), done);
+}
+
+void read_file_list(const char *listname, std::vector<std::string> &filenames) {
+  std::ifstream list;
+  std::istream &in(strcmp(listname, "-") == 0 ? std::cin : (list.open(listname), list));
+  std::string line;
+
+  if(!in) throw std::runtime_error(std::string("can not open file list ") + listname);
+  while(getline(in, line)) {
+    if(!line.empty()) filenames.push_back(line);
+  }
+}
+
+
+/*! \brief Minimal io_uring set up with the raw system calls */
+struct Uring {
+  int fd;
+  unsigned int entries;
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned int tail; //!< local SQ tail, published by submit()
+  unsigned int queued; //!< SQEs filled but not submitted
+
+  Uring() : fd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), tail(0), queued(0) { }
+  ~Uring() {
+    if(sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if(sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+    if(fd >= 0) close(fd);
+  }
+
+  /*! \brief True if the kernel supports all opcodes
+   *
+   * Uses IORING_REGISTER_PROBE, so kernels before Linux 5.6 (which lack
+   * the file opcodes as well) report nothing as supported.
+   */
+  bool supports(std::initializer_list<unsigned int> opcodes) const {
+    const unsigned int count = 256;
+    std::vector<uint64_t> buffer((sizeof(struct io_uring_probe) + count * sizeof(struct io_uring_probe_op) + 7) / 8);
+    struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe*>(buffer.data());
+
+    if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, count) < 0) return false;
+    for(unsigned int opcode : opcodes) {
+      if(opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+    return true;
+  }
+
+  //! Set up a ring, NULL if the kernel does not allow it or lacks the opcodes used by BatchReader.
+  static std::unique_ptr<Uring> create(unsigned int entries) {
+    std::unique_ptr<Uring> ring(new Uring());
+    struct io_uring_params params;
+
+    std::memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0) return std::unique_ptr<Uring>();
+    if(!ring->supports({ IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE })) return std::unique_ptr<Uring>();
+    ring->entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ptr == MAP_FAILED) return std::unique_ptr<Uring>();
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+      ring->cq_ptr = ring->sq_ptr;
+    } else {
+      ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+      if(ring->cq_ptr == MAP_FAILED) return std::unique_ptr<Uring>();
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+    if(ring->sqes == MAP_FAILED) return std::unique_ptr<Uring>();
+    char *sq = static_cast<char*>(ring->sq_ptr);
+    char *cq = static_cast<char*>(ring->cq_ptr);
+    ring->sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    ring->sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    ring->sq_mask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    ring->sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    ring->cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    ring->cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    ring->cq_mask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    ring->tail = *ring->sq_tail;
+    return ring;
+  }
+
+  //! Next free SQE (cleared), the caller keeps below entries per submit.
+  struct io_uring_sqe *get_sqe() {
+    unsigned int index = tail++ & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    ++queued;
+    return sqe;
+  }
+
+  //! Submit the queued SQEs and wait for wait_nr completions.
+  void submit(unsigned int wait_nr) {
+    //Publish the filled SQEs, only this thread writes the tail.
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    while(queued > 0 || wait_nr > 0) {
+      int ret = syscall(__NR_io_uring_enter, fd, queued, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+      if(ret < 0) {
+	if(errno == EINTR) continue;
+	throw std::runtime_error(std::string("io_uring_enter: ") + std::strerror(errno));
+      }
+      queued -= ret;
+      wait_nr = 0;
+    }
+  }
+
+  //! Take one completion, false if none is available.
+  bool pop(struct io_uring_cqe &cqe) {
+    unsigned int head = *cq_head;
+    if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+    cqe = cqes[head & *cq_mask];
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  //! Wait until count completions were handed to fun(cqe).
+  template<class Fun>
+  void reap(unsigned int count, Fun fun) {
+    struct io_uring_cqe cqe;
+    while(count > 0) {
+      if(!pop(cqe)) {
+	submit(1);
+	continue;
+      }
+      fun(cqe);
+      --count;
+    }
+  }
+};
+
+
+BatchReader::BatchReader(const std::vector<std::string> &names_, size_t batch_, bool use_uring) : names(names_), position(0), batch(batch_ ? batch_ : 1), map_threshold(256 << 10) {
+  pool = std::make_shared<BufferPool>(2 * batch);
+  //Each file needs up to two SQEs per round (open and statx, read and close).
+  if(use_uring) ring = Uring::create(2 * batch);
+  if(ring && ring->entries < 2 * batch) ring.reset();
+}
+
+BatchReader::~BatchReader() {
+}
+
+bool BatchReader::next(FileView &view) {
+  if(ready.empty()) fill();
+  if(ready.empty()) return false;
+  view = std::move(ready.front());
+  ready.pop_front();
+  if(view.ok()) {
+    stats_count("files read", 1);
+    stats_count("bytes read", view.size());
+  } else {
+    stats_count("files failed", 1);
+  }
+  return true;
+}
+
+void BatchReader::fill() {
+  size_t last = std::min(names.size(), position + batch);
+  if(position >= last) return;
+  if(ring) {
+    fill_uring(position, last);
+  } else {
+    for(size_t i = position; i < last; ++i) ready.push_back(read_file(names[i], map_threshold, pool));
+  }
+  position = last;
+}
+
+void BatchReader::fill_uring(size_t first, size_t last) {
+  const size_t count = last - first;
+  struct File {
+    int fd;
+    int error;
+    struct statx stx;
+    std::shared_ptr<uint8_t> buffer;
+    size_t done;
+    bool read_now; //!< read into a pool buffer with the ring
+    bool fallback; //!< the ring could not open the file, use read_file()
+  };
+  std::vector<File> files(count);
+  unsigned int pending = 0;
+
+  //Round one: open and stat all files of the batch.
+  for(size_t i = 0; i < count; ++i) {
+    File &file(files[i]);
+    file.fd = -1;
+    file.error = 0;
+    file.done = 0;
+    file.read_now = false;
+    file.fallback = false;
+    if(names[first + i] == "-") continue;
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(names[first + i].c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = 2 * i;
+    sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(names[first + i].c_str());
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = reinterpret_cast<uintptr_t>(&file.stx);
+    sqe->user_data = 2 * i + 1;
+    pending += 2;
+  }
+  ring->reap(pending, [&files](const struct io_uring_cqe &cqe) {
+      File &file(files[cqe.user_data / 2]);
+      if(cqe.res < 0) {
+	if(!file.error) file.error = -cqe.res;
+	//Opcodes unknown to the kernel fail with EINVAL.
+	if(cqe.res == -EINVAL) file.fallback = true;
+      } else if(cqe.user_data % 2 == 0) {
+	file.fd = cqe.res;
+      }
+    });
+  //Round two: read small regular files and close everything.
+  pending = 0;
+  for(size_t i = 0; i < count; ++i) {
+    File &file(files[i]);
+    if(file.fd < 0) continue;
+    if(!file.error && S_ISREG(file.stx.stx_mode) && file.stx.stx_size > 0 && file.stx.stx_size < map_threshold) {
+      file.buffer = pool->acquire(file.stx.stx_size);
+      file.read_now = true;
+      struct io_uring_sqe *sqe = ring->get_sqe();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = file.fd;
+      sqe->addr = reinterpret_cast<uintptr_t>(file.buffer.get());
+      sqe->len = file.stx.stx_size;
+      sqe->off = 0;
+      //A short read cancels the linked close, the rest is read below.
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = 2 * i;
+      ++pending;
+    }
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = file.fd;
+    sqe->user_data = 2 * i + 1;
+    ++pending;
+  }
+  ring->reap(pending, [&files](const struct io_uring_cqe &cqe) {
+      File &file(files[cqe.user_data / 2]);
+      if(cqe.user_data % 2 == 0) {
+	if(cqe.res < 0) file.error = -cqe.res;
+	else file.done = cqe.res;
+      } else if(cqe.res != -ECANCELED) {
+	//Only a cancelled close leaves the descriptor open.
+	if(cqe.res < 0 && !file.error) file.error = -cqe.res;
+	file.fd = -1;
+      }
+    });
+  for(size_t i = 0; i < count; ++i) {
+    File &file(files[i]);
+    const std::string &fname(names[first + i]);
+    if(file.read_now && !file.error && file.done < file.stx.stx_size && file.fd >= 0) {
+      if(!pread_all(file.fd, file.buffer.get(), file.stx.stx_size, file.done)) file.error = errno;
+    }
+    if(file.fd >= 0) close(file.fd);
+    if(file.fallback) {
+      ready.push_back(read_file(fname, map_threshold, pool));
+    } else if(fname == "-" || (!file.error && !file.read_now)) {
+      ready.push_back(map_file(fname));
+    } else if(file.error) {
+      ready.push_back(FileView::failed(fname, error_message(fname, file.error)));
+    } else {
+      ready.push_back(FileView(fname, file.buffer, file.buffer.get(), file.done));
+    }
+  }
+}
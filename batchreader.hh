@@ -0,0 +1,147 @@
+#ifndef __BATCHREADER_HH_2026__
+#define __BATCHREADER_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \brief Read-only contents of one file
+ *
+ * Copies share the data, which stays valid as long as a copy or the
+ * owner() is alive. A view of a file which could not be read carries
+ * the error message instead.
+ */
+class FileView {
+  std::shared_ptr<const void> holder;
+  const uint8_t *ptr;
+  size_t length;
+  std::string fname;
+  std::string error;
+public:
+  FileView() : ptr(NULL), length(0) { }
+  FileView(const std::string &fname_, std::shared_ptr<const void> holder_, const uint8_t *data, size_t len) : holder(holder_), ptr(data), length(len), fname(fname_) { }
+  //! View of a file which could not be read
+  static FileView failed(const std::string &fname, const std::string &error);
+
+  const uint8_t *data() const { return ptr; }
+  size_t size() const { return length; }
+  const std::string &name() const { return fname; }
+  bool ok() const { return error.empty(); }
+  const std::string &get_error() const { return error; }
+  /*! \brief Throw a std::runtime_error if the file could not be read */
+  const FileView &check() const;
+  //! Keeps the data alive (see ChunkSet::keep).
+  std::shared_ptr<const void> owner() const { return holder; }
+};
+
+/*! \brief Free list of read buffers
+ *
+ * Buffers are handed out as shared pointers which return the memory
+ * to the pool when the last reference is gone, from any thread.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+  std::mutex mutex;
+  std::vector<std::pair<uint8_t*, size_t> > free_buffers;
+  size_t max_free;
+
+  void release(uint8_t *buffer, size_t capacity);
+public:
+  explicit BufferPool(size_t max_free_) : max_free(max_free_) { }
+  ~BufferPool();
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+  /*! \brief Get a buffer of at least size bytes */
+  std::shared_ptr<uint8_t> acquire(size_t size);
+};
+
+/*! \brief Read a single file into a view
+ *
+ * Small regular files are read with pread into a buffer, everything
+ * else is mapped (see MappedFile). "-" reads standard input. Errors
+ * are returned in the view.
+ */
+FileView read_file(const std::string &fname, size_t map_threshold = 256 << 10, const std::shared_ptr<BufferPool> &pool = std::shared_ptr<BufferPool>());
+
+/*! \brief Append the names in a list file (one per line, "-" for standard input)
+ *
+ * Empty lines are skipped.
+ *
+ * \throw std::runtime_error if the list can not be opened
+ */
+void read_file_list(const char *listname, std::vector<std::string> &filenames);
+
+struct Uring;
+
+/*! \brief Read many files in batches
+ *
+ * Files are opened, inspected and read a batch at a time with
+ * io_uring, which turns the per-file open/stat/read/close system calls
+ * into a few submissions per batch. If the kernel does not provide
+ * io_uring, each file is read with read_file(). Files of at least
+ * map_threshold bytes are mapped instead of copied. Views are handed
+ * out in the order of the names.
+ */
+class BatchReader {
+  std::vector<std::string> names;
+  size_t position; //!< next name to read
+  size_t batch;
+  size_t map_threshold;
+  std::deque<FileView> ready;
+  std::shared_ptr<BufferPool> pool;
+  std::unique_ptr<Uring> ring;
+
+  void fill();
+  void fill_uring(size_t first, size_t last);
+public:
+  /*! \brief Constructor
+   *
+   * \param first,last range of file names
+   * \param batch_ number of files read together
+   * \param use_uring false forces the portable pread path
+   */
+  template<class InputIt>
+  BatchReader(InputIt first, InputIt last, size_t batch_ = 64, bool use_uring = true) : BatchReader(std::vector<std::string>(first, last), batch_, use_uring) { }
+  BatchReader(const std::vector<std::string> &names_, size_t batch_ = 64, bool use_uring = true);
+  ~BatchReader();
+  BatchReader(const BatchReader &) = delete;
+  BatchReader &operator=(const BatchReader &) = delete;
+
+  //! True if io_uring is used.
+  bool uses_io_uring() const { return static_cast<bool>(ring); }
+  /*! \brief Get the next file
+   *
+   * \return false after the last file
+   */
+  bool next(FileView &view);
+
+  /*! \brief Input iterator over the views */
+  class iterator {
+    BatchReader *reader;
+    FileView view;
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef FileView value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const FileView *pointer;
+    typedef const FileView &reference;
+
+    iterator() : reader(NULL) { }
+    explicit iterator(BatchReader *reader_) : reader(reader_) { ++*this; }
+    const FileView &operator*() const { return view; }
+    const FileView *operator->() const { return &view; }
+    iterator &operator++() {
+      if(!reader->next(view)) reader = NULL;
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return reader == other.reader; }
+    bool operator!=(const iterator &other) const { return reader != other.reader; }
+  };
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+};
+
+#endif
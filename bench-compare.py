@@ -0,0 +1,57 @@
+#! /usr/bin/env python3
+"""Compare two benchmark result files written by benchmark -o.
+
+Benchmarks are matched by name and the median real time is compared.
+Changes smaller than the threshold are reported as noise. With
+--fail-on-regression the exit status is 1 if any benchmark became
+slower by more than the threshold.
+"""
+import argparse
+import json
+import sys
+
+
+def load(fname):
+    with open(fname) as f:
+        data = json.load(f)
+    return {b["name"]: b for b in data["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base", help="results of the baseline")
+    parser.add_argument("new", help="results of the contender")
+    parser.add_argument("-t", "--threshold", type=float, default=5.0, help="noise threshold in percent (default: 5)")
+    parser.add_argument("--fail-on-regression", action="store_true", help="exit with status 1 on regressions")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+    regressions = 0
+    width = max([len(name) for name in base] + [9])
+    print("%-*s %14s %14s %9s" % (width, "Benchmark", "Base [ms]", "New [ms]", "Change"))
+    for name in base:
+        if name not in new:
+            print("%-*s %14.3f %14s" % (width, name, base[name]["median_real_time"] / 1e6, "missing"))
+            continue
+        old_time = base[name]["median_real_time"]
+        new_time = new[name]["median_real_time"]
+        change = (new_time - old_time) / old_time * 100.0 if old_time > 0 else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = " slower"
+            regressions += 1
+        elif change < -args.threshold:
+            mark = " faster"
+        print("%-*s %14.3f %14.3f %+8.1f%%%s" % (width, name, old_time / 1e6, new_time / 1e6, change, mark))
+    for name in new:
+        if name not in base:
+            print("%-*s %14s %14.3f" % (width, name, "new", new[name]["median_real_time"] / 1e6))
+    if args.fail_on_regression and regressions:
+        print("%d benchmark(s) regressed by more than %.1f%%." % (regressions, args.threshold), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,12 @@
+#! /bin/sh
+# Run the benchmark suite and store the results as JSON.
+#
+# usage: bench.sh [results.json] [benchmark options]
+# The default file name contains the short git revision, so that two
+# runs can be compared with bench-compare.py.
+set -e
+cd "`dirname "$0"`"
+OUT=${1:-bench-`git rev-parse --short HEAD 2>/dev/null || echo local`.json}
+[ $# -gt 0 ] && shift
+./benchmark -o "$OUT" -L "`git describe --always --dirty 2>/dev/null`" "$@"
+echo "Results written to $OUT."
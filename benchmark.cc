@@ -0,0 +1,388 @@
+/*! \brief benchmark: throughput of the storage kernels and the tools
+ *
+ * Runs a fixed set of benchmarks on deterministic corpora (see
+ * corpus.hh): the n-gram storage kernels for several (gram_max, n)
+ * settings with warm and cold mappings, the histogram kernels and the
+ * command line pipelines. Results are printed as a table and can be
+ * written as JSON (in the layout of Google Benchmark) for
+ * bench-compare.py.
+ */
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include "corpus.hh"
+#include "histogram.h"
+#include "ngram-storage.h"
+
+using namespace std;
+
+struct Bench_params {
+  double min_time; //!< seconds per benchmark
+  size_t size; //!< corpus size for the kernels
+  size_t cli_size; //!< corpus size for the command line tools
+  string filter;
+  string json;
+  string bin_dir;
+  string tmpdir;
+  string label;
+  bool list;
+};
+
+/*! \brief One benchmark
+ *
+ * setup runs once, before runs untimed ahead of every iteration (e.g.
+ * to drop caches), body is timed. Cold benchmarks get no warm-up run.
+ */
+struct Bench_case {
+  string name;
+  uint64_t bytes; //!< processed per iteration
+  uint64_t items; //!< processed per iteration
+  bool cold;
+  function<void()> setup;
+  function<void()> before;
+  function<void()> body;
+  function<void()> teardown;
+};
+
+struct Bench_result {
+  string name;
+  vector<double> real; //!< seconds per iteration
+  double cpu; //!< seconds, all iterations, including child processes
+  uint64_t bytes;
+  uint64_t items;
+};
+
+static double cpu_seconds() {
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  return self.ru_utime.tv_sec + self.ru_stime.tv_sec + children.ru_utime.tv_sec + children.ru_stime.tv_sec
+    + (self.ru_utime.tv_usec + self.ru_stime.tv_usec + children.ru_utime.tv_usec + children.ru_stime.tv_usec) * 1e-6;
+}
+
+static Bench_result run_case(const Bench_case &bench, double min_time) {
+  const size_t min_iterations = 3;
+  const size_t max_iterations = 100000;
+  Bench_result result = { bench.name, vector<double>(), 0, bench.bytes, bench.items };
+  double total = 0;
+
+  if(bench.setup) bench.setup();
+  if(!bench.cold) {
+    if(bench.before) bench.before();
+    bench.body();
+  }
+  while(result.real.size() < max_iterations && (result.real.size() < min_iterations || total < min_time)) {
+    if(bench.before) bench.before();
+    double cpu = cpu_seconds();
+    auto start = chrono::steady_clock::now();
+    bench.body();
+    auto stop = chrono::steady_clock::now();
+    result.cpu += cpu_seconds() - cpu;
+    result.real.push_back(chrono::duration<double>(stop - start).count());
+    total += result.real.back();
+  }
+  if(bench.teardown) bench.teardown();
+  return result;
+}
+
+
+static string json_string(const string &s) {
+  string out("\"");
+  for(char c : s) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if(static_cast<unsigned char>(c) < 0x20) {
+      out += str(boost::format("\\u%04x") % static_cast<int>(c));
+    } else {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+static double median(vector<double> values) {
+  sort(values.begin(), values.end());
+  size_t mid = values.size() / 2;
+  return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+static void write_json(const string &fname, const vector<Bench_result> &results, const Bench_params &params, const char *executable) {
+  ofstream out(fname);
+  char host[256] = "";
+  char date[64] = "";
+  time_t now = time(NULL);
+
+  gethostname(host, sizeof(host) - 1);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": " << json_string(date) << ",\n"
+      << "    \"host_name\": " << json_string(host) << ",\n"
+      << "    \"executable\": " << json_string(executable) << ",\n"
+      << "    \"label\": " << json_string(params.label) << ",\n"
+      << "    \"num_cpus\": " << thread::hardware_concurrency() << ",\n"
+      << "    \"corpus_size\": " << params.size << ",\n"
+      << "    \"cli_corpus_size\": " << params.cli_size << ",\n"
+      << "    \"min_time\": " << params.min_time << "\n"
+      << "  },\n  \"benchmarks\": [";
+  for(size_t i = 0; i < results.size(); ++i) {
+    const Bench_result &r(results[i]);
+    double mean = 0, var = 0;
+    for(double t : r.real) mean += t;
+    mean /= r.real.size();
+    for(double t : r.real) var += (t - mean) * (t - mean);
+    double med = median(r.real);
+    out << (i ? ",\n" : "\n") << "    {\n"
+	<< "      \"name\": " << json_string(r.name) << ",\n"
+	<< "      \"run_name\": " << json_string(r.name) << ",\n"
+	<< "      \"iterations\": " << r.real.size() << ",\n"
+	<< boost::format("      \"real_time\": %.1f,\n") % (mean * 1e9)
+	<< boost::format("      \"cpu_time\": %.1f,\n") % (r.cpu / r.real.size() * 1e9)
+	<< "      \"time_unit\": \"ns\",\n"
+	<< boost::format("      \"median_real_time\": %.1f,\n") % (med * 1e9)
+	<< boost::format("      \"min_real_time\": %.1f,\n") % (*min_element(r.real.begin(), r.real.end()) * 1e9)
+	<< boost::format("      \"stddev_real_time\": %.1f,\n") % (sqrt(var / r.real.size()) * 1e9)
+	<< boost::format("      \"bytes_per_second\": %.1f,\n") % (r.bytes / med)
+	<< boost::format("      \"items_per_second\": %.1f\n") % (r.items / med)
+	<< "    }";
+  }
+  out << "\n  ]\n}\n";
+  if(!out) throw runtime_error(fname + ": can not write results");
+}
+
+
+/*! \brief Temporary directory which is removed with its files */
+class Scratch_dir {
+  string path;
+  vector<string> files;
+public:
+  explicit Scratch_dir(const string &parent) : path(parent + "/emmabench.XXXXXX") {
+    if(!mkdtemp(&path[0])) throw runtime_error(path + ": " + strerror(errno));
+  }
+  ~Scratch_dir() {
+    for(auto &f : files) unlink(f.c_str());
+    rmdir(path.c_str());
+  }
+  string file(const string &name) {
+    files.push_back(path + '/' + name);
+    return files.back();
+  }
+};
+
+static void write_file(const string &fname, const vector<uint8_t> &data) {
+  ofstream out(fname, ios::binary);
+  out.write(reinterpret_cast<const char*>(data.data()), data.size());
+  if(!out) throw runtime_error(fname + ": can not write corpus");
+}
+
+//! Write dirty pages and drop the file from the page cache.
+static void drop_cache(const string &fname) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0) return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static void run_command(const string &command) {
+  int status = system(command.c_str());
+  if(status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) throw runtime_error("command failed: " + command);
+}
+
+
+/*! \brief Storage kernel benchmarks for one corpus and setting */
+static void add_storage_cases(vector<Bench_case> &cases, Scratch_dir &scratch, const string &corpus_name, shared_ptr<const vector<uint8_t> > corpus, int gram_max, int n) {
+  struct State {
+    vector<uint8_t> folded;
+    string fname;
+    ngram_storage_t *storage;
+  };
+  auto state = make_shared<State>();
+  const string suffix = str(boost::format("%s/g%d_n%d") % corpus_name % gram_max % n);
+  const uint64_t windows = corpus->size() >= static_cast<size_t>(n) ? corpus->size() - n + 1 : 0;
+  state->fname = scratch.file("storage-" + to_string(gram_max) + "-" + to_string(n));
+  state->storage = NULL;
+  auto setup = [state, corpus, gram_max, n]() {
+    if(state->storage) return;
+    state->folded.resize(corpus->size());
+    for(size_t i = 0; i < corpus->size(); ++i) state->folded[i] = (*corpus)[i] % (gram_max + 1);
+    state->storage = create_ngram_storage(state->fname.c_str(), gram_max, n);
+    if(!state->storage) throw runtime_error(state->fname + ": can not create storage");
+  };
+  auto teardown = [state]() {
+    if(state->storage) close_ngram_storage(state->storage);
+    state->storage = NULL;
+    unlink(state->fname.c_str());
+  };
+  auto set_all = [state, windows]() {
+    uint8_t *data = state->folded.data();
+    for(uint64_t pos = 0; pos < windows; ++pos) set_ngram(state->storage, data + pos);
+  };
+  auto find_all = [state, windows]() {
+    uint8_t *data = state->folded.data();
+    uint64_t found = 0;
+    for(uint64_t pos = 0; pos < windows; ++pos) found += find_ngram(state->storage, data + pos) != 0;
+    if(found > windows) abort();
+  };
+  cases.push_back(Bench_case { "storage/set/" + suffix, windows, windows, false, setup, nullptr, set_all, nullptr });
+  cases.push_back(Bench_case { "storage/find/" + suffix + "/warm", windows, windows, false, [setup, set_all]() { setup(); set_all(); }, nullptr, find_all, nullptr });
+  cases.push_back(Bench_case { "storage/find/" + suffix + "/cold", windows, windows, true, [setup, set_all]() { setup(); set_all(); }, [state]() {
+	if(state->storage) close_ngram_storage(state->storage);
+	state->storage = NULL;
+	drop_cache(state->fname);
+      }, [state, find_all]() {
+	state->storage = open_ngram_storage(state->fname.c_str());
+	if(!state->storage) throw runtime_error(state->fname + ": can not open storage");
+	find_all();
+      }, teardown });
+}
+
+static vector<Bench_case> make_cases(const Bench_params &params, Scratch_dir &scratch) {
+  static const Corpus_type types[] = { Corpus_type::UNIFORM, Corpus_type::ZIPF, Corpus_type::TEXT, Corpus_type::BINARY };
+  static const int settings[][2] = { { 255, 2 }, { 255, 3 }, { 98, 4 }, { 25, 6 } };
+  const unsigned int threads = max(1U, thread::hardware_concurrency());
+  vector<Bench_case> cases;
+
+  for(auto type : types) {
+    const string name(corpus_type_name(type));
+    auto corpus = make_shared<const vector<uint8_t> >(generate_corpus(type, params.size, 1));
+    for(auto &setting : settings) add_storage_cases(cases, scratch, name, corpus, setting[0], setting[1]);
+    cases.push_back(Bench_case { "histogram/simple/" + name, corpus->size(), corpus->size(), false, nullptr, nullptr, [corpus]() {
+	  double hist[256];
+	  simple_histogram(const_cast<unsigned char*>(corpus->data()), corpus->size(), hist);
+	}, nullptr });
+    cases.push_back(Bench_case { "histogram/counts/" + name, corpus->size(), corpus->size(), false, nullptr, nullptr, [corpus]() {
+	  uint64_t counts[256];
+	  byte_histogram_counts(corpus->data(), corpus->size(), counts);
+	}, nullptr });
+    cases.push_back(Bench_case { str(boost::format("histogram/parallel/%s/threads:%u") % name % threads), corpus->size(), corpus->size(), false, nullptr, nullptr, [corpus, threads]() {
+	  double hist[256];
+	  simple_histogram_parallel(const_cast<unsigned char*>(corpus->data()), corpus->size(), hist, threads);
+	}, nullptr });
+  }
+  //End-to-end pipelines, the corpora are written to files first.
+  for(auto type : types) {
+    const string name(corpus_type_name(type));
+    const string file(scratch.file(name + ".1"));
+    const string other(scratch.file(name + ".2"));
+    const string bin(params.bin_dir + '/');
+    const uint64_t size = params.cli_size;
+    auto write_corpora = [type, file, other, size]() {
+      write_file(file, generate_corpus(type, size, 1));
+      write_file(other, generate_corpus(type, size, 2));
+    };
+    auto tool = [&](const string &case_name, const string &needs, const string &command) {
+      if(access((bin + needs).c_str(), X_OK) != 0) {
+	cerr << "Skipping " << case_name << ": " << bin << needs << " not found.\n";
+	return;
+      }
+      cases.push_back(Bench_case { case_name, size, size, false, write_corpora, nullptr, [command]() { run_command(command); }, nullptr });
+    };
+    tool("cli/ngramify/" + name, "ngramify", bin + "ngramify -n 3 " + file + " > /dev/null");
+    tool("cli/histogramify/" + name, "histogramify", bin + "ngramify -n 2 " + file + " | " + bin + "histogramify > /dev/null 2>&1");
+    tool("cli/emmapipe-histogram/" + name, "emmapipe", bin + "emmapipe -n 2 histogram " + file + " > /dev/null 2>&1");
+    tool("cli/simple-histogram/" + name, "simple-histogram", bin + "simple-histogram " + file + " > /dev/null 2>&1");
+    tool("cli/simichunks/" + name, "simichunks", bin + "simichunks -n 8 " + file + ' ' + other + " > /dev/null");
+  }
+  return cases;
+}
+
+
+static Bench_params cli_parse(int argc, char **argv) {
+  const char *tmpdir = getenv("TMPDIR");
+  Bench_params params = { 0.5, 4 << 20, 1 << 20, "", "", ".", tmpdir ? tmpdir : "/tmp", "", false };
+  int opt;
+
+  while((opt = getopt(argc, argv, "t:s:c:f:o:B:T:L:l")) != -1) {
+    switch(opt) {
+    case 't':
+      params.min_time = boost::lexical_cast<double>(optarg);
+      break;
+    case 's':
+      params.size = boost::lexical_cast<size_t>(optarg);
+      break;
+    case 'c':
+      params.cli_size = boost::lexical_cast<size_t>(optarg);
+      break;
+    case 'f':
+      params.filter = optarg;
+      break;
+    case 'o':
+      params.json = optarg;
+      break;
+    case 'B':
+      params.bin_dir = optarg;
+      break;
+    case 'T':
+      params.tmpdir = optarg;
+      break;
+    case 'L':
+      params.label = optarg;
+      break;
+    case 'l':
+      params.list = true;
+      break;
+    default: /* '?' */
+      throw invalid_argument("bad option");
+    }
+  }
+  if(optind != argc) throw invalid_argument("unexpected argument");
+  return params;
+}
+
+int main(int argc, char **argv) {
+  Bench_params params;
+
+  try {
+    params = cli_parse(argc, argv);
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error: " << excp.what() << '\n'
+	 << "usage: benchmark [-t min-seconds] [-s corpus-size] [-c cli-corpus-size] [-f regex] [-o results.json]\n"
+	 << "                 [-B bin-dir] [-T tmpdir] [-L label] [-l]\n";
+    return 1;
+  }
+  try {
+    Scratch_dir scratch(params.tmpdir);
+    vector<Bench_case> cases(make_cases(params, scratch));
+    regex filter(params.filter);
+    vector<Bench_result> results;
+    if(!params.list) cout << boost::format("%-44s %10s %14s %12s\n") % "Benchmark" % "Iterations" % "Median" % "MB/s";
+    for(auto &bench : cases) {
+      if(!params.filter.empty() && !regex_search(bench.name, filter)) continue;
+      if(params.list) {
+	cout << bench.name << '\n';
+	continue;
+      }
+      results.push_back(run_case(bench, params.min_time));
+      double med = median(results.back().real);
+      cout << boost::format("%-44s %10u %11.3f ms %12.1f\n") % bench.name % results.back().real.size() % (med * 1e3) % (bench.bytes / med / 1e6) << flush;
+    }
+    if(!params.json.empty()) write_json(params.json, results, params, argv[0]);
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error! Exception: " << excp.what() << endl;
+    return -1;
+  }
+  return 0;
+}
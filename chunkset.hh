@@ -0,0 +1,378 @@
+#ifndef __CHUNKSET_HH_2026__
+#define __CHUNKSET_HH_2026__
+#include <inttypes.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "batchreader.hh"
+#include "mappedfile.hh"
+
+/*! \brief LSD radix sort followed by removal of duplicates
+ *
+ * Only the lowest bytes of each key are considered. The byte
+ * histograms of all passes are gathered in one read over the data and
+ * passes where all keys share the same byte are skipped.
+ *
+ * \param keys keys to sort
+ * \param bytes number of significant bytes
+ */
+template<typename Word>
+void radix_sort_unique(std::vector<Word> &keys, unsigned int bytes) {
+  if(keys.size() < 64) {
+    std::sort(keys.begin(), keys.end());
+  } else {
+    std::vector<size_t> counts(bytes * 256);
+    std::vector<Word> tmp(keys.size());
+
+    for(auto key : keys) {
+      for(unsigned int b = 0; b < bytes; ++b) counts[b * 256 + static_cast<unsigned int>(key >> (8 * b)) % 256]++;
+    }
+    for(unsigned int b = 0; b < bytes; ++b) {
+      size_t *count = &counts[b * 256];
+      size_t sum = 0;
+      if(std::find(count, count + 256, keys.size()) != count + 256) continue;
+      for(int i = 0; i < 256; ++i) {
+	size_t c = count[i];
+	count[i] = sum;
+	sum += c;
+      }
+      for(auto key : keys) tmp[count[static_cast<unsigned int>(key >> (8 * b)) % 256]++] = key;
+      keys.swap(tmp);
+    }
+  }
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+
+/*! \brief Finaliser of MurmurHash3, spreads the bits of a 64 bit value */
+inline uint64_t mix_hash(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t mix_hash(unsigned __int128 h) {
+  return mix_hash(static_cast<uint64_t>(h) ^ mix_hash(static_cast<uint64_t>(h >> 64)));
+}
+
+
+/*! \brief Chunks of up to sizeof(Word) bytes packed into an integer
+ *
+ * The bytes are packed big endian, so the integer order is the same
+ * as the lexicographic (memcmp) order of the chunks.
+ */
+template<typename Word>
+class PackedKeys {
+  unsigned int n;
+  Word mask;
+public:
+  typedef Word key_type;
+  //! Keys do not point into the file data.
+  static const bool references_data = false;
+
+  explicit PackedKeys(unsigned int n_) : n(n_) {
+    if(n == 0 || n > sizeof(Word)) throw std::invalid_argument("chunk size does not fit into key");
+    mask = n == sizeof(Word) ? ~static_cast<Word>(0) : (static_cast<Word>(1) << (8 * n)) - 1;
+  }
+  unsigned int size() const { return n; }
+  key_type make(const uint8_t *p) const {
+    Word key = 0;
+    for(unsigned int i = 0; i < n; ++i) key = (key << 8) | p[i];
+    return key;
+  }
+  std::string str(key_type key) const {
+    std::string s(n, '\0');
+    for(unsigned int i = 0; i < n; ++i) s[i] = static_cast<char>(key >> (8 * (n - 1 - i)));
+    return s;
+  }
+  bool less(key_type a, key_type b) const { return a < b; }
+  bool equal(key_type a, key_type b) const { return a == b; }
+  /*! \brief Call fun(key, offset) for every window of the data */
+  template<class Fun>
+  void for_each_window(const uint8_t *data, size_t len, Fun fun) const {
+    Word key = 0;
+    if(len < n) return;
+    for(unsigned int i = 0; i + 1 < n; ++i) key = (key << 8) | data[i];
+    for(size_t pos = 0; pos + n <= len; ++pos) {
+      key = ((key << 8) | data[pos + n - 1]) & mask;
+      fun(key, pos);
+    }
+  }
+  void sort_unique(std::vector<key_type> &keys) const {
+    radix_sort_unique(keys, n);
+  }
+  uint64_t hash(key_type key) const { return mix_hash(key); }
+  //! Size of a key in the binary chunk storage (native word).
+  size_t record_size() const { return sizeof(Word); }
+  key_type load(const uint8_t *record) const {
+    Word key;
+    std::memcpy(&key, record, sizeof(key));
+    return key;
+  }
+  void store(key_type key, uint8_t *record) const { std::memcpy(record, &key, sizeof(key)); }
+  /*! \brief Call fun(hash, key, offset) for every window of the data */
+  template<class Fun>
+  void for_each_hashed_window(const uint8_t *data, size_t len, Fun fun) const {
+    for_each_window(data, len, [this, &fun](key_type key, size_t pos) { return fun(hash(key), key, pos); });
+  }
+};
+
+
+/*! \brief Chunks of any length referenced by a pointer into the data
+ *
+ * The chunk set has to keep the data alive (see ChunkSet::keep).
+ */
+class ReferenceKeys {
+  unsigned int n;
+  uint64_t base_power; //!< HASH_BASE to the power of n
+  static const uint64_t HASH_BASE = 0x100000001b3ULL;
+
+  uint64_t roll_init(const uint8_t *p) const {
+    uint64_t h = 0;
+    for(unsigned int i = 0; i < n; ++i) h = h * HASH_BASE + p[i];
+    return h;
+  }
+public:
+  typedef const uint8_t *key_type;
+  //! Keys point into the file data.
+  static const bool references_data = true;
+
+  explicit ReferenceKeys(unsigned int n_) : n(n_), base_power(1) {
+    if(n == 0) throw std::invalid_argument("chunk size must not be zero");
+    for(unsigned int i = 0; i < n; ++i) base_power *= HASH_BASE;
+  }
+  unsigned int size() const { return n; }
+  key_type make(const uint8_t *p) const { return p; }
+  std::string str(key_type key) const { return std::string(reinterpret_cast<const char*>(key), n); }
+  bool less(key_type a, key_type b) const { return std::memcmp(a, b, n) < 0; }
+  bool equal(key_type a, key_type b) const { return std::memcmp(a, b, n) == 0; }
+  template<class Fun>
+  void for_each_window(const uint8_t *data, size_t len, Fun fun) const {
+    for(size_t pos = 0; pos + n <= len; ++pos) fun(data + pos, pos);
+  }
+  void sort_unique(std::vector<key_type> &keys) const {
+    std::sort(keys.begin(), keys.end(), [this](key_type a, key_type b) { return less(a, b); });
+    keys.erase(std::unique(keys.begin(), keys.end(), [this](key_type a, key_type b) { return equal(a, b); }), keys.end());
+  }
+  uint64_t hash(key_type key) const { return mix_hash(roll_init(key)); }
+  //! Size of a key in the binary chunk storage (the chunk bytes).
+  size_t record_size() const { return n; }
+  key_type load(const uint8_t *record) const { return record; }
+  void store(key_type key, uint8_t *record) const { std::memcpy(record, key, n); }
+  /*! \brief Call fun(hash, key, offset) for every window of the data
+   *
+   * The polynomial hash is rolled, so each window costs O(1).
+   */
+  template<class Fun>
+  void for_each_hashed_window(const uint8_t *data, size_t len, Fun fun) const {
+    if(len < n) return;
+    uint64_t h = roll_init(data);
+    for(size_t pos = 0; ; ++pos) {
+      fun(mix_hash(h), data + pos, pos);
+      if(pos + n >= len) break;
+      h = h * HASH_BASE + data[pos + n] - data[pos] * base_power;
+    }
+  }
+};
+
+
+/*! \brief Sorted set of unique chunks
+ *
+ * \tparam Keys key representation, PackedKeys or ReferenceKeys
+ */
+template<class Keys>
+class ChunkSet {
+public:
+  typedef typename Keys::key_type key_type;
+  typedef typename std::vector<key_type>::const_iterator const_iterator;
+private:
+  Keys keys;
+  std::vector<key_type> chunks;
+  std::vector<std::shared_ptr<const void> > owners; //!< memory the keys may point into
+public:
+  explicit ChunkSet(const Keys &keys_) : keys(keys_) { }
+
+  const Keys &get_keys() const { return keys; }
+  size_t size() const { return chunks.size(); }
+  bool empty() const { return chunks.empty(); }
+  const_iterator begin() const { return chunks.begin(); }
+  const_iterator end() const { return chunks.end(); }
+  std::vector<key_type> &get_chunks() { return chunks; }
+  key_type get_chunk(size_t idx) const { return chunks[idx]; }
+  std::string str(key_type key) const { return keys.str(key); }
+
+  /*! \brief Keep memory alive which keys point into */
+  void keep(const std::shared_ptr<const void> &owner) {
+    if(Keys::references_data) owners.push_back(owner);
+  }
+  /*! \brief Sort the chunks and remove duplicates */
+  void normalise() { keys.sort_unique(chunks); }
+
+  /*! \brief Replace the set by its intersection with a sorted range */
+  template<class Range>
+  void intersect(const Range &other) {
+    std::vector<key_type> result;
+    std::set_intersection(chunks.begin(), chunks.end(), other.begin(), other.end(), std::back_inserter(result), [this](key_type a, key_type b) { return keys.less(a, b); });
+    chunks.swap(result);
+  }
+  /*! \brief Remove all chunks found in a sorted range */
+  template<class Range>
+  void subtract(const Range &other) {
+    std::vector<key_type> result;
+    std::set_difference(chunks.begin(), chunks.end(), other.begin(), other.end(), std::back_inserter(result), [this](key_type a, key_type b) { return keys.less(a, b); });
+    chunks.swap(result);
+  }
+  /*! \brief Keep only the chunks with a non-zero mark
+   *
+   * \param marks one mark per chunk in set order
+   */
+  void retain(const std::vector<uint8_t> &marks) {
+    size_t out = 0;
+    for(size_t i = 0; i < chunks.size(); ++i) {
+      if(marks[i]) chunks[out++] = chunks[i];
+    }
+    chunks.resize(out);
+  }
+  /*! \brief Replace the set by the chunks of another set with a non-zero mark
+   *
+   * Only the kept chunks are copied, not the whole set.
+   */
+  void assign_marked(const ChunkSet &set, const std::vector<uint8_t> &marks) {
+    chunks.clear();
+    for(size_t i = 0; i < set.chunks.size(); ++i) {
+      if(marks[i]) chunks.push_back(set.chunks[i]);
+    }
+    owners = set.owners;
+  }
+  /*! \brief Replace the set by the intersection of another set with a sorted range */
+  template<class Range>
+  void assign_intersection(const ChunkSet &set, const Range &other) {
+    chunks.clear();
+    std::set_intersection(set.chunks.begin(), set.chunks.end(), other.begin(), other.end(), std::back_inserter(chunks), [this](key_type a, key_type b) { return keys.less(a, b); });
+    owners = set.owners;
+  }
+  /*! \brief Build a normalised set from chunk strings
+   *
+   * All strings must have the chunk length.
+   */
+  static ChunkSet from_strings(const Keys &keys, const std::vector<std::string> &strings) {
+    ChunkSet set(keys);
+    auto arena = std::make_shared<std::string>();
+    arena->reserve(strings.size() * keys.size());
+    for(auto &s : strings) arena->append(s);
+    set.chunks.reserve(strings.size());
+    for(size_t i = 0; i < strings.size(); ++i) {
+      set.chunks.push_back(keys.make(reinterpret_cast<const uint8_t*>(arena->data()) + i * keys.size()));
+    }
+    set.keep(arena);
+    set.normalise();
+    return set;
+  }
+};
+
+
+/*! \brief calculate all the chunks in a file
+ *
+ * This function will return a sorted list of unique chunks.
+ *
+ * \param file contents of the file, kept alive by the set
+ * \param keys key representation with the chunk length
+ */
+template<class Keys>
+ChunkSet<Keys> calculate_chunks(const FileView &file, const Keys &keys) {
+  ChunkSet<Keys> chunks(keys);
+
+  if(file.size() >= keys.size()) chunks.get_chunks().reserve(file.size() - keys.size() + 1);
+  keys.for_each_window(file.data(), file.size(), [&chunks](typename Keys::key_type key, size_t) {
+      chunks.get_chunks().push_back(key);
+    });
+  chunks.keep(file.owner());
+  chunks.normalise();
+  chunks.get_chunks().shrink_to_fit();
+  return chunks;
+}
+
+//! Read the file fname and calculate its chunks.
+template<class Keys>
+ChunkSet<Keys> calculate_chunks(const char *fname, const Keys &keys) {
+  return calculate_chunks(read_file(fname).check(), keys);
+}
+
+
+
+/*! \brief Hash table over a chunk set for streaming membership tests
+ *
+ * Windows of a file are looked up in the table and matching chunks
+ * are marked, so intersecting with a file needs memory proportional
+ * to the chunk set only, not to the file.
+ */
+template<class Keys>
+class ChunkProbe {
+  const ChunkSet<Keys> &chunkset;
+  std::vector<uint32_t> table; //!< open addressing, chunk index + 1, 0 is empty
+  uint64_t mask;
+public:
+  explicit ChunkProbe(const ChunkSet<Keys> &chunkset_) : chunkset(chunkset_) {
+    size_t size = 16;
+    if(chunkset.size() >= UINT32_MAX) throw std::length_error("chunk set too large for probing");
+    while(size < 2 * chunkset.size()) size *= 2;
+    table.resize(size);
+    mask = size - 1;
+    const Keys &keys(chunkset.get_keys());
+    uint32_t idx = 0;
+    for(auto key : chunkset) {
+      uint64_t slot = keys.hash(key) & mask;
+      while(table[slot] != 0) slot = (slot + 1) & mask;
+      table[slot] = ++idx;
+    }
+  }
+  /*! \brief Look up a window
+   *
+   * \return index of the chunk in the set or -1
+   */
+  long find(uint64_t hash, typename Keys::key_type key) const {
+    const Keys &keys(chunkset.get_keys());
+    for(uint64_t slot = hash & mask; table[slot] != 0; slot = (slot + 1) & mask) {
+      uint32_t idx = table[slot] - 1;
+      if(keys.equal(chunkset.get_chunk(idx), key)) return idx;
+    }
+    return -1;
+  }
+  /*! \brief Mark all chunks occurring in the data
+   *
+   * Stops early once every chunk has been seen.
+   *
+   * \param data pointer to the file data
+   * \param len length of the data
+   * \param marks one mark per chunk, set to 1 when seen
+   * \return number of chunks newly marked
+   */
+  size_t mark(const uint8_t *data, size_t len, std::vector<uint8_t> &marks) const {
+    const Keys &keys(chunkset.get_keys());
+    size_t found = 0;
+    size_t missing = std::count(marks.begin(), marks.end(), 0);
+    if(missing == 0) return 0;
+    //Scan in blocks so that a complete set can end the scan early.
+    const size_t block = 1 << 20;
+    for(size_t start = 0; start < len && found < missing; start += block) {
+      size_t stop = std::min(len, start + block + keys.size() - 1);
+      keys.for_each_hashed_window(data + start, stop - start, [&](uint64_t hash, typename Keys::key_type key, size_t) {
+	  long idx = find(hash, key);
+	  if(idx >= 0 && !marks[idx]) {
+	    marks[idx] = 1;
+	    ++found;
+	  }
+	});
+    }
+    return found;
+  }
+};
+
+#endif
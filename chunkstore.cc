@@ -0,0 +1,97 @@
+#include "chunkstore.hh"
+#include <cerrno>
+#include <fstream>
+#include <boost/format.hpp>
+#include <json/json.h>
+
+static const char STORAGE_MAGIC[8] = { 'S', 'I', 'M', 'I', 'C', 'H', 'N', 'K' };
+static const uint32_t STORAGE_VERSION = 1;
+
+static_assert(sizeof(ChunkStorageHeader) == 64, "chunk storage header must have 64 bytes");
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the binary chunk storage stores native little endian keys"
+#endif
+
+
+uint64_t chunk_checksum(const uint8_t *data, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ len;
+  uint64_t word;
+  size_t i;
+
+  for(i = 0; i + 8 <= len; i += 8) {
+    std::memcpy(&word, data + i, 8);
+    h = (h ^ word) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+  for(; i < len; ++i) h = (h ^ data[i]) * 0x100000001b3ULL;
+  return mix_hash(h);
+}
+
+
+bool is_binary_chunk_storage(const std::string &fname) {
+  char magic[8];
+  std::ifstream in(fname, std::ios::binary);
+
+  return in.read(magic, sizeof(magic)) && std::memcmp(magic, STORAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+
+unsigned int chunk_storage_n(const std::string &fname) {
+  if(is_binary_chunk_storage(fname)) {
+    ChunkStorageHeader header;
+    std::ifstream in(fname, std::ios::binary);
+    if(!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+      throw std::runtime_error(fname + ": truncated chunk storage");
+    }
+    return header.n;
+  }
+  Json::Value root;
+  std::ifstream in(fname);
+  if(!in) throw std::runtime_error(fname + ": " + std::strerror(errno));
+  in >> root;
+  return root["N"].asUInt();
+}
+
+
+const ChunkStorageHeader *check_chunk_storage(const MappedFile &file, unsigned int n, size_t record_size) {
+  const ChunkStorageHeader *header = reinterpret_cast<const ChunkStorageHeader*>(file.data());
+
+  if(file.size() < sizeof(ChunkStorageHeader) || std::memcmp(header->magic, STORAGE_MAGIC, sizeof(STORAGE_MAGIC)) != 0) {
+    throw std::runtime_error(file.name() + ": not a binary chunk storage");
+  }
+  if(header->version != STORAGE_VERSION) {
+    throw std::runtime_error(str(boost::format("%s: unknown chunk storage version %u") % file.name() % header->version));
+  }
+  if(header->n != n) {
+    throw std::logic_error("storage has different chunk size");
+  }
+  if(header->record_size != record_size || (file.size() - sizeof(ChunkStorageHeader)) / record_size < header->count) {
+    throw std::runtime_error(file.name() + ": chunk storage is corrupt");
+  }
+  if(chunk_checksum(reinterpret_cast<const uint8_t*>(header + 1), header->count * record_size) != header->checksum) {
+    throw std::runtime_error(file.name() + ": chunk storage checksum mismatch");
+  }
+  return header;
+}
+
+
+void write_chunk_storage(const std::string &fname, unsigned int n, size_t record_size, const uint8_t *records, size_t count) {
+  ChunkStorageHeader header;
+  FILE *fout;
+
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, STORAGE_MAGIC, sizeof(STORAGE_MAGIC));
+  header.version = STORAGE_VERSION;
+  header.n = n;
+  header.record_size = record_size;
+  header.count = count;
+  header.checksum = chunk_checksum(records, count * record_size);
+  if(!(fout = fopen(fname.c_str(), "wb"))) {
+    throw std::runtime_error(fname + ": " + std::strerror(errno));
+  }
+  if(fwrite(&header, sizeof(header), 1, fout) != 1 || (count > 0 && fwrite(records, record_size, count, fout) != count)) {
+    fclose(fout);
+    throw std::runtime_error(fname + ": " + std::strerror(errno));
+  }
+  if(fclose(fout) != 0) throw std::runtime_error(fname + ": " + std::strerror(errno));
+}
@@ -0,0 +1,126 @@
+#ifndef __CHUNKSTORE_HH_2026__
+#define __CHUNKSTORE_HH_2026__
+#include <inttypes.h>
+#include <stdio.h>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "chunkset.hh"
+#include "mappedfile.hh"
+
+/*! \brief Header of the binary chunk storage
+ *
+ * The header is followed by count sorted, unique records of
+ * record_size bytes: native (little endian) integers for packed keys
+ * or the raw chunk bytes for longer chunks. The checksum covers the
+ * records.
+ */
+struct ChunkStorageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t n; //!< chunk length
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t checksum;
+  uint8_t padding[24];
+};
+
+/*! \brief Fast 64 bit checksum over a byte array */
+uint64_t chunk_checksum(const uint8_t *data, size_t len);
+
+/*! \brief Check whether a file starts with the binary storage magic */
+bool is_binary_chunk_storage(const std::string &fname);
+
+/*! \brief Chunk length of a binary or JSON chunk storage */
+unsigned int chunk_storage_n(const std::string &fname);
+
+/*! \brief Validate a mapped binary chunk storage
+ *
+ * Throws a std::runtime_error if the header does not match or the
+ * checksum is wrong.
+ *
+ * \return pointer to the header inside the mapping
+ */
+const ChunkStorageHeader *check_chunk_storage(const MappedFile &file, unsigned int n, size_t record_size);
+
+/*! \brief Write the header and records of a binary chunk storage
+ *
+ * \param fname name of the output file
+ * \param n chunk length
+ * \param record_size size of each record
+ * \param records the records
+ * \param count number of records
+ */
+void write_chunk_storage(const std::string &fname, unsigned int n, size_t record_size, const uint8_t *records, size_t count);
+
+
+/*! \brief Memory mapped binary chunk storage
+ *
+ * The records are used in place as a sorted range of keys, so loading
+ * needs neither parsing nor sorting.
+ */
+template<class Keys>
+class ChunkStorage {
+  Keys keys;
+  std::shared_ptr<MappedFile> file;
+  const uint8_t *records;
+  size_t count;
+public:
+  typedef typename Keys::key_type key_type;
+
+  class const_iterator {
+    const Keys *keys;
+    const uint8_t *ptr;
+  public:
+    typedef const_iterator self_type;
+    typedef key_type value_type;
+    typedef key_type reference;
+    typedef const key_type *pointer;
+    typedef long difference_type;
+    typedef std::forward_iterator_tag iterator_category;
+    const_iterator(const Keys *keys_, const uint8_t *ptr_) : keys(keys_), ptr(ptr_) { }
+    self_type &operator++() { ptr += keys->record_size(); return *this; }
+    self_type operator++(int) { self_type i = *this; ptr += keys->record_size(); return i; }
+    key_type operator*() const { return keys->load(ptr); }
+    bool operator==(const self_type &rhs) const { return ptr == rhs.ptr; }
+    bool operator!=(const self_type &rhs) const { return ptr != rhs.ptr; }
+  };
+
+  ChunkStorage(const Keys &keys_, const std::string &fname) : keys(keys_), file(std::make_shared<MappedFile>(fname.c_str())) {
+    const ChunkStorageHeader *header = check_chunk_storage(*file, keys.size(), keys.record_size());
+    records = reinterpret_cast<const uint8_t*>(header + 1);
+    count = header->count;
+  }
+  size_t size() const { return count; }
+  const_iterator begin() const { return const_iterator(&keys, records); }
+  const_iterator end() const { return const_iterator(&keys, records + count * keys.record_size()); }
+  const std::shared_ptr<MappedFile> &get_file() const { return file; }
+
+  /*! \brief Copy the keys into a chunk set (which keeps the mapping) */
+  ChunkSet<Keys> to_chunkset() const {
+    ChunkSet<Keys> set(keys);
+    set.get_chunks().assign(begin(), end());
+    set.keep(file);
+    return set;
+  }
+};
+
+
+/*! \brief Store a chunk set in the binary format */
+template<class Keys>
+void write_chunk_storage(const ChunkSet<Keys> &chunkset, const std::string &fname) {
+  const Keys &keys(chunkset.get_keys());
+  std::vector<uint8_t> records(chunkset.size() * keys.record_size());
+  uint8_t *ptr = records.data();
+
+  for(auto key : chunkset) {
+    keys.store(key, ptr);
+    ptr += keys.record_size();
+  }
+  write_chunk_storage(fname, keys.size(), keys.record_size(), records.data(), chunkset.size());
+}
+
+#endif
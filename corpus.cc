@@ -0,0 +1,151 @@
+#include "corpus.hh"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+Corpus_type corpus_type_from_string(const std::string &name) {
+  if(name == "uniform") return Corpus_type::UNIFORM;
+  if(name == "zipf") return Corpus_type::ZIPF;
+  if(name == "text") return Corpus_type::TEXT;
+  if(name == "binary") return Corpus_type::BINARY;
+  throw std::invalid_argument("unknown corpus type " + name);
+}
+
+const char *corpus_type_name(Corpus_type type) {
+  switch(type) {
+  case Corpus_type::UNIFORM: return "uniform";
+  case Corpus_type::ZIPF: return "zipf";
+  case Corpus_type::TEXT: return "text";
+  case Corpus_type::BINARY: return "binary";
+  }
+  return "?";
+}
+
+
+namespace {
+
+/*! \brief Zipf distributed ranks in [0, count) by inverting the CDF */
+class Zipf_sampler {
+  std::vector<double> cdf;
+public:
+  Zipf_sampler(size_t count, double s) : cdf(count) {
+    double sum = 0;
+    for(size_t i = 0; i < count; ++i) cdf[i] = (sum += 1.0 / std::pow(i + 1.0, s));
+    for(auto &c : cdf) c /= sum;
+  }
+  size_t operator()(Corpus_random &rnd) const {
+    return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), rnd.real()) - cdf.begin(), cdf.size() - 1);
+  }
+};
+
+void generate_text(std::vector<uint8_t> &out, size_t size, Corpus_random &rnd) {
+  //Vocabulary of pronounceable words, frequent words are short.
+  static const char consonants[] = "bcdfghklmnprstvwz";
+  static const char vowels[] = "aeiouy";
+  std::vector<std::string> words(5000);
+  for(size_t i = 0; i < words.size(); ++i) {
+    size_t syllables = 1 + std::min<size_t>(4, i / 200 + rnd.below(2));
+    for(size_t j = 0; j < syllables; ++j) {
+      words[i] += consonants[rnd.below(sizeof(consonants) - 1)];
+      words[i] += vowels[rnd.below(sizeof(vowels) - 1)];
+      if(rnd.below(3) == 0) words[i] += consonants[rnd.below(sizeof(consonants) - 1)];
+    }
+  }
+  Zipf_sampler zipf(words.size(), 1.0);
+  bool capital = true;
+  size_t line = 0;
+  while(out.size() < size) {
+    std::string word(words[zipf(rnd)]);
+    if(capital) word[0] -= 'a' - 'A';
+    capital = false;
+    out.insert(out.end(), word.begin(), word.end());
+    line += word.size();
+    uint64_t r = rnd.below(100);
+    if(r < 6) {
+      out.push_back('.');
+      capital = true;
+    } else if(r < 10) {
+      out.push_back(',');
+    }
+    if(line > 60 + rnd.below(15)) {
+      out.push_back('\n');
+      line = 0;
+      if(capital && rnd.below(4) == 0) out.push_back('\n');
+    } else {
+      out.push_back(' ');
+      ++line;
+    }
+  }
+}
+
+void generate_binary(std::vector<uint8_t> &out, size_t size, Corpus_random &rnd) {
+  //A small "instruction set" of byte patterns which recur often.
+  std::vector<std::vector<uint8_t> > patterns(64);
+  for(auto &pattern : patterns) {
+    pattern.resize(2 + rnd.below(6));
+    for(auto &b : pattern) b = rnd.below(256);
+  }
+  Zipf_sampler zipf(patterns.size(), 1.2);
+  while(out.size() < size) {
+    switch(rnd.below(10)) {
+    case 0: //padding
+      out.insert(out.end(), 4 + rnd.below(60), 0);
+      break;
+    case 1:
+    case 2: { //little endian integers, mostly small
+      size_t count = 1 + rnd.below(16);
+      for(size_t i = 0; i < count; ++i) {
+	uint32_t value = rnd.below(1U << (4 + rnd.below(20)));
+	for(int j = 0; j < 4; ++j) out.push_back(value >> (8 * j));
+      }
+      break;
+    }
+    case 3: { //random block (compressed or encrypted data)
+      size_t count = 16 + rnd.below(256);
+      for(size_t i = 0; i < count; ++i) out.push_back(rnd.below(256));
+      break;
+    }
+    default: { //code-like sequence of patterns with immediates
+      size_t count = 4 + rnd.below(32);
+      for(size_t i = 0; i < count; ++i) {
+	const std::vector<uint8_t> &pattern(patterns[zipf(rnd)]);
+	out.insert(out.end(), pattern.begin(), pattern.end());
+	if(rnd.below(3) == 0) out.push_back(rnd.below(256));
+      }
+    }
+    }
+  }
+}
+
+}
+
+
+std::vector<uint8_t> generate_corpus(Corpus_type type, size_t size, uint64_t seed, unsigned int alphabet) {
+  Corpus_random rnd(seed);
+  std::vector<uint8_t> out;
+
+  if(alphabet < 1 || alphabet > 256) throw std::invalid_argument("alphabet must be in [1..256]");
+  out.reserve(size + 512);
+  switch(type) {
+  case Corpus_type::UNIFORM:
+    while(out.size() < size) out.push_back(rnd.below(alphabet));
+    break;
+  case Corpus_type::ZIPF: {
+    //Ranks are mapped to byte values by a seeded permutation.
+    std::vector<uint8_t> symbols(alphabet);
+    for(unsigned int i = 0; i < alphabet; ++i) symbols[i] = i;
+    for(unsigned int i = alphabet - 1; i > 0; --i) std::swap(symbols[i], symbols[rnd.below(i + 1)]);
+    Zipf_sampler zipf(alphabet, 1.1);
+    while(out.size() < size) out.push_back(symbols[zipf(rnd)]);
+    break;
+  }
+  case Corpus_type::TEXT:
+    generate_text(out, size, rnd);
+    break;
+  case Corpus_type::BINARY:
+    generate_binary(out, size, rnd);
+    break;
+  }
+  out.resize(size);
+  return out;
+}
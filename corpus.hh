@@ -0,0 +1,55 @@
+#ifndef __CORPUS_HH_2026__
+#define __CORPUS_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*! \brief Kinds of synthetic test data */
+enum class Corpus_type { UNIFORM, ZIPF, TEXT, BINARY };
+
+/*! \brief Parse "uniform", "zipf", "text" or "binary"
+ *
+ * Throws std::invalid_argument for unknown names.
+ */
+Corpus_type corpus_type_from_string(const std::string &name);
+const char *corpus_type_name(Corpus_type type);
+
+/*! \brief Small, fast and portable pseudo random generator (SplitMix64)
+ *
+ * Unlike the standard distributions its output is the same on every
+ * platform, so a seed always gives the same corpus.
+ */
+class Corpus_random {
+  uint64_t state;
+public:
+  explicit Corpus_random(uint64_t seed) : state(seed) { }
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  //! Uniform value in [0, bound).
+  uint64_t below(uint64_t bound) { return static_cast<uint64_t>((static_cast<unsigned __int128>(next()) * bound) >> 64); }
+  //! Uniform value in [0, 1).
+  double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+/*! \brief Generate a deterministic corpus
+ *
+ * - uniform: independent bytes, equally likely
+ * - zipf: independent bytes with Zipf distributed frequencies (s = 1.1)
+ * - text: words from a Zipf distributed vocabulary with punctuation
+ *   and line breaks
+ * - binary: executable-like mix of zero padding, little endian
+ *   integers, repeated instruction-like patterns and random blocks
+ *
+ * \param type kind of data
+ * \param size number of bytes
+ * \param seed random seed
+ * \param alphabet number of byte values used by uniform and zipf (1..256)
+ */
+std::vector<uint8_t> generate_corpus(Corpus_type type, size_t size, uint64_t seed, unsigned int alphabet = 256);
+
+#endif
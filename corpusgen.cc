@@ -0,0 +1,69 @@
+/*! \brief corpusgen: write a deterministic synthetic corpus
+ *
+ * The same type, size, seed and alphabet always give the same bytes,
+ * so benchmark inputs can be regenerated instead of stored.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+#include "corpus.hh"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  Corpus_type type = Corpus_type::UNIFORM;
+  size_t size = 1 << 20;
+  uint64_t seed = 1;
+  unsigned int alphabet = 256;
+  const char *output = NULL;
+  bool bad = false;
+  int opt;
+
+  try {
+    while((opt = getopt(argc, argv, "t:s:S:a:o:")) != -1) {
+      switch(opt) {
+      case 't':
+	type = corpus_type_from_string(optarg);
+	break;
+      case 's':
+	size = boost::lexical_cast<size_t>(optarg);
+	break;
+      case 'S':
+	seed = boost::lexical_cast<uint64_t>(optarg);
+	break;
+      case 'a':
+	alphabet = boost::lexical_cast<unsigned int>(optarg);
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default: /* '?' */
+	bad = true;
+      }
+    }
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error: " << excp.what() << '\n';
+    bad = true;
+  }
+  if(bad || optind != argc) {
+    cerr << "usage: corpusgen [-t uniform|zipf|text|binary] [-s size] [-S seed] [-a alphabet] [-o file]\n";
+    return 1;
+  }
+  try {
+    vector<uint8_t> data(generate_corpus(type, size, seed, alphabet));
+    FILE *out = output ? fopen(output, "wb") : stdout;
+    if(!out) throw runtime_error(string(output) + ": " + strerror(errno));
+    if(fwrite(data.data(), 1, data.size(), out) != data.size() || (out != stdout && fclose(out) != 0)) {
+      throw runtime_error(string("write failed: ") + strerror(errno));
+    }
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error! Exception: " << excp.what() << endl;
+    return -1;
+  }
+  return 0;
+}
@@ -1,8 +1,17 @@
 #include "ngram-storage.h"
+#include "ngram-classify.h"
+#include "ngram-iterator.h"
+#include "ngram-ingest.h"
+#include "ngram-delta.h"
+#include "ngram-pack.h"
+#include "stats.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 enum Error_Codes {
   ERROR_CLI_PARAM = 1,
@@ -14,7 +23,23 @@ const char *fname;
 
 
 void usage(int st) {
-  fprintf(stderr, "Usage: ...\n");
+  fprintf(stderr, "Usage: emmagrammer [--stats[=json]] <command> ...\n"
+	  "  create <gram_max> <n>\n"
+	  "  store [<hex n-gram>]\n"
+	  "  recall [<hex n-gram>]\n"
+	  "  ngramify\n"
+	  "  foltran <ranges...>\n"
+	  "  classify [-f] [-w window] [-k top] [-@ storage-list] <input|-> <storages...>\n"
+	  "  dump [-b] [-j threads] [-r part/parts]\n"
+	  "  ingest [-m memory-MiB] [-T tmpdir] [-b | -r]\n"
+	  "  snapshot <file>\n"
+	  "  adopt\n"
+	  "  diff [-o delta] <older> <newer>\n"
+	  "  apply [-f] <delta|->\n"
+	  "  pack <packed>\n"
+	  "  unpack <packed> <storage>\n"
+	  "  lookup <packed> [<hex n-gram>]\n"
+	  "The storage is taken from $NGRAM_STORAGE (default %s).\n", DEFAULT_STORAGE_FILENAME);
   exit(st);
 }
 
@@ -24,8 +49,11 @@ int command_store(int argc, char **argv) {
   int i;
   char buf[1 << 11];
   uint8_t ngrambuf[1 << 12];
+  uint64_t stored = 0, newly_set = 0, lines = 0, bytes = 0;
 
+  stats_phase("open");
   storage = open_ngram_storage(fname);
+  stats_phase("store");
   printf("combinations = %30.20Le\n", storage->combinations);
   if(storage == NULL) {
     perror("open storage");
@@ -39,24 +67,33 @@ int command_store(int argc, char **argv) {
 	printf(" %02x", ngptr[i]);
       }
       putchar('\n');
-      set_ngram(storage, ngptr);
+      stats_count("bits newly set", test_and_set_ngram(storage, ngptr));
+      stats_count("n-grams stored", 1);
+      stats_phase("close");
       close_ngram_storage(storage);
     }
   } else if(argc == 2) {
     while(!feof(stdin)) {
       if(fgets(buf, sizeof(buf), stdin) > 0) {
+	++lines;
+	bytes += strlen(buf);
 	ngptr = ngram_from_string_into(storage, buf, ngrambuf);
 	if(ngptr) {
 	  for(i = 0; i < storage->n; ++i) {
 	    printf(" %02x", ngptr[i]);
 	  }
 	  putchar('\n');
-	  set_ngram(storage, ngptr);
+	  newly_set += test_and_set_ngram(storage, ngptr);
+	  ++stored;
 	} else {
 	  fprintf(stderr, "Can not interpret n-gram line: '%s'!\n", buf);
 	}
       }
     }
+    stats_add(bytes, lines);
+    stats_count("n-grams stored", stored);
+    stats_count("bits newly set", newly_set);
+    stats_phase("close");
     close_ngram_storage(storage);
   } else usage(ERROR_CLI_PARAM);
   return 0;
@@ -69,12 +106,16 @@ int command_recall(int argc, char **argv) {
   char buf[1 << 11];
   long counter = 0;
   long found = 0;
+  long lookups = 0;
+  uint64_t bytes = 0;
 
+  stats_phase("open");
   storage = open_ngram_storage(fname);
   if(storage == NULL) {
     perror("open storage");
     return ERROR_IO;
   }
+  stats_phase("recall");
   printf("combinations = %30.20Le\n", storage->combinations);
   if(argc == 3) {
     ngptr = ngram_from_string(storage, argv[2]);
@@ -83,11 +124,15 @@ int command_recall(int argc, char **argv) {
       for(i = 0; i < storage->n; ++i) {
 	printf(" %02x", ngptr[i]);
       }
-      printf("\t %d\n", find_ngram(storage, ngptr));
+      i = find_ngram(storage, ngptr);
+      printf("\t %d\n", i);
+      stats_count("lookups", 1);
+      stats_count("hits", i != 0);
     }
   } else if(argc == 2) {
     while(!feof(stdin)) {
       if(fgets(buf, sizeof(buf), stdin) > 0) {
+	bytes += strlen(buf);
 	ngptr = ngram_from_string(storage, buf);
 	//printf("%p\n", ngptr);
 	if(ngptr) {
@@ -95,6 +140,7 @@ int command_recall(int argc, char **argv) {
 	    printf(" %02x", ngptr[i]);
 	  }
 	  i = find_ngram(storage, ngptr);
+	  ++lookups;
 	  if(i != 0) found++;
 	  printf("\t %d", i);
 	  if(1) {
@@ -109,6 +155,9 @@ int command_recall(int argc, char **argv) {
       }
     }
     fprintf(stderr, "%08lx/%08lx %e\n", found, counter, (double)found / counter);
+    stats_add(bytes, counter);
+    stats_count("lookups", lookups);
+    stats_count("hits", found);
   } else usage(ERROR_CLI_PARAM);
   return 0;
 }
@@ -118,18 +167,23 @@ int command_ngramify(int argc, char **argv) {
   int buf[32];
   int i;
   unsigned int skip = 0;
+  uint64_t count = 0;
 
+  stats_phase("open");
   storage = open_ngram_storage(fname);
   if(storage == NULL) {
     perror("open storage");
     return ERROR_IO;
   }
+  stats_phase("ngramify");
   for(i = 0; i < storage->n; ++i) buf[i] = fgetc(stdin);
   while(!feof(stdin)) {
     for(i = 0; i < storage->n; ++i) printf(" %02X", buf[(i + skip) % storage->n]);
     putchar('\n');
+    ++count;
     if((buf[skip++ % storage->n] = fgetc(stdin)) == -1) break;
   }
+  stats_add(count > 0 ? count + storage->n - 1 : 0, count);
   return 0;
 }
 
@@ -141,11 +195,13 @@ int command_foltran(int argc, char **argv) {
   uint8_t fold_and_transform_table[256];
   uint8_t *ftable;
   int tpos = 0;
+  uint64_t bytes = 0;
 
   if(argc == 2) {
     usage(ERROR_CLI_PARAM);    
   } else {
     ftable = fold_and_transform_table;
+    stats_phase("open");
     storage = open_ngram_storage(fname);
     if(storage != NULL) {
       ftable = storage->last_fold_tranform_table;
@@ -177,6 +233,7 @@ int command_foltran(int argc, char **argv) {
     }
   }
  follies_end:
+  stats_phase("foltran");
   /* for(i = 0; i < 256; ++i) { */
   /*   fprintf(stderr, " %02X%c", ftable[i], ((i + 1) & 0x0f) == 0 ? '\n' : ' '); */
   /* } */
@@ -184,7 +241,701 @@ int command_foltran(int argc, char **argv) {
     i = getchar();
     if(i == EOF) break;
     putchar(ftable[i]);
+    ++bytes;
   }
+  stats_add(bytes, bytes);
+  return 0;
+}
+
+
+/* Read a whole file (or stdin for "-") into a malloc()ed buffer. */
+static uint8_t *read_input(const char *name, size_t *len) {
+  FILE *f = strcmp(name, "-") == 0 ? stdin : fopen(name, "rb");
+  size_t capacity = 1 << 16;
+  uint8_t *buf, *ptr;
+  size_t got;
+
+  if(!f) return NULL;
+  buf = malloc(capacity);
+  *len = 0;
+  while(buf && (got = fread(buf + *len, 1, capacity - *len, f)) > 0) {
+    *len += got;
+    if(*len == capacity) {
+      ptr = realloc(buf, capacity *= 2);
+      if(!ptr) free(buf);
+      buf = ptr;
+    }
+  }
+  if(buf && ferror(f)) {
+    free(buf);
+    buf = NULL;
+  }
+  if(f != stdin) fclose(f);
+  return buf;
+}
+
+typedef struct Ranked_Model {
+  uint64_t hits;
+  int model;
+} ranked_model_t;
+
+static int compare_ranked(const void *a, const void *b) {
+  const ranked_model_t *x = a, *y = b;
+  if(x->hits != y->hits) return x->hits < y->hits ? 1 : -1;
+  return x->model - y->model;
+}
+
+/* Sort the models by hits, best first. */
+static void rank_models(const uint64_t *hits, int count, ranked_model_t *ranked) {
+  int i;
+
+  for(i = 0; i < count; ++i) {
+    ranked[i].hits = hits[i];
+    ranked[i].model = i;
+  }
+  qsort(ranked, count, sizeof(ranked_model_t), compare_ranked);
+}
+
+typedef struct Classify_Context {
+  ngram_model_set_t *set;
+  ranked_model_t *ranked;
+  int top;
+} classify_context_t;
+
+static void print_window(size_t offset, uint64_t probes, const uint64_t *hits, void *ctx) {
+  classify_context_t *context = ctx;
+  int i;
+
+  rank_models(hits, context->set->count, context->ranked);
+  printf("%zu\t%" PRIu64, offset, probes);
+  for(i = 0; i < context->top && i < context->set->count; ++i) {
+    printf("\t%s:%.6f", ngram_model_set_name(context->set, context->ranked[i].model), probes ? (double)context->ranked[i].hits / probes : 0.0);
+  }
+  putchar('\n');
+}
+
+int command_classify(int argc, char **argv) {
+  ngram_model_set_t *set;
+  classify_context_t context;
+  char line[4096];
+  const char *list = NULL;
+  uint8_t *data;
+  size_t len, window = 0;
+  int fold = 0;
+  int opt, i;
+  FILE *f;
+
+  context.top = 3;
+  while((opt = getopt(argc - 1, argv + 1, "fw:k:@:")) != -1) {
+    switch(opt) {
+    case 'f':
+      fold = 1;
+      break;
+    case 'w':
+      window = strtoul(optarg, NULL, 0);
+      break;
+    case 'k':
+      context.top = atoi(optarg);
+      break;
+    case '@':
+      list = optarg;
+      break;
+    default:
+      usage(ERROR_CLI_PARAM);
+    }
+  }
+  ++optind;
+  if(optind >= argc || (optind + 1 >= argc && !list)) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  set = create_ngram_model_set();
+  for(i = optind + 1; i < argc; ++i) {
+    if(ngram_model_set_add(set, argv[i]) < 0) {
+      fprintf(stderr, "Can not open storage '%s': %s\n", argv[i], strerror(errno));
+      return ERROR_IO;
+    }
+  }
+  if(list) {
+    if(!(f = fopen(list, "r"))) {
+      perror(list);
+      return ERROR_IO;
+    }
+    while(fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if(line[0] && ngram_model_set_add(set, line) < 0) {
+	fprintf(stderr, "Can not open storage '%s': %s\n", line, strerror(errno));
+	return ERROR_IO;
+      }
+    }
+    fclose(f);
+  }
+  stats_phase("read");
+  if(!(data = read_input(argv[optind], &len))) {
+    perror(argv[optind]);
+    return ERROR_IO;
+  }
+  stats_add(len, 0);
+  stats_phase("classify");
+  context.set = set;
+  context.ranked = malloc(set->count * sizeof(ranked_model_t));
+  if(window > 0) printf("#offset\tn-grams\tbest models\n");
+  if(ngram_classify(set, data, len, fold, window, print_window, &context) != 0) {
+    perror("ngram_classify");
+    return ERROR_IO;
+  }
+  stats_add(0, set->probes);
+  stats_count("lookups", set->probes * set->count);
+  rank_models(set->hits, set->count, context.ranked);
+  printf("#input: %s\n#n-grams: %" PRIu64 "\n#rank\tratio\thits\tstorage\n", argv[optind], set->probes);
+  for(i = 0; i < set->count; ++i) {
+    stats_count("hits", context.ranked[i].hits);
+    printf("%d\t%.6f\t%" PRIu64 "\t%s\n", i + 1, ngram_model_set_ratio(set, context.ranked[i].model), context.ranked[i].hits, ngram_model_set_name(set, context.ranked[i].model));
+  }
+  free(context.ranked);
+  free(data);
+  close_ngram_model_set(set);
+  return 0;
+}
+
+
+/* Indices handled by one thread per round of a parallel dump, at most
+ * as many as fill DUMP_CHUNK_BYTES of output if all bits are set. */
+#define DUMP_CHUNK (1ULL << 24)
+#define DUMP_CHUNK_BYTES (16ULL << 20)
+
+typedef struct Dump_Job {
+  const ngram_storage_t *storage;
+  uint64_t first;
+  uint64_t last;
+  int binary;
+  char *out;
+  size_t len;
+  size_t capacity;
+  uint64_t count;
+} dump_job_t;
+
+/* Format the n-grams of [first, last) into the job's buffer. */
+static void dump_range(dump_job_t *job) {
+  static const char digits[] = "0123456789ABCDEF";
+  const int n = job->storage->n;
+  const size_t record = job->binary ? n : 3 * n + 1;
+  ngram_iterator_t it;
+  uint8_t grams[MAX_NGRAM_BUFFER];
+  uint64_t index;
+  char *ptr;
+  int i;
+
+  job->len = 0;
+  job->count = 0;
+  ngram_iterator_init(&it, job->storage, job->first, job->last);
+  while(ngram_iterator_next(&it, &index)) {
+    if(job->len + record > job->capacity) {
+      job->capacity = job->capacity ? 2 * job->capacity : 1 << 16;
+      job->out = realloc(job->out, job->capacity);
+      if(!job->out) {
+	perror("dump");
+	exit(ERROR_IO);
+      }
+    }
+    ngram_iterator_decode(&it, index, grams);
+    ptr = job->out + job->len;
+    if(job->binary) {
+      memcpy(ptr, grams, n);
+    } else {
+      for(i = 0; i < n; ++i) {
+	*ptr++ = ' ';
+	*ptr++ = digits[grams[i] >> 4];
+	*ptr++ = digits[grams[i] & 0xF];
+      }
+      *ptr = '\n';
+    }
+    job->len += record;
+    ++job->count;
+  }
+}
+
+typedef struct Dump_Worker {
+  dump_job_t *job;
+  pthread_barrier_t *start;
+  pthread_barrier_t *done;
+  const int *finished;
+} dump_worker_t;
+
+static void *dump_thread(void *arg) {
+  dump_worker_t *worker = arg;
+
+  for(;;) {
+    pthread_barrier_wait(worker->start);
+    if(*worker->finished) break;
+    dump_range(worker->job);
+    pthread_barrier_wait(worker->done);
+  }
+  return NULL;
+}
+
+/* Dump [first, last) in rounds of one chunk per thread, written in index order. */
+static int dump_storage(const ngram_storage_t *dumped, uint64_t first, uint64_t last, int binary, int threads) {
+  dump_job_t *jobs = calloc(threads, sizeof(dump_job_t));
+  dump_worker_t *workers = calloc(threads, sizeof(dump_worker_t));
+  pthread_t *tids = calloc(threads, sizeof(pthread_t));
+  pthread_barrier_t start, done;
+  const uint64_t record = binary ? dumped->n : 3 * dumped->n + 1;
+  uint64_t pos, chunk, count = 0;
+  int finished = 0;
+  int i;
+
+  if(!jobs || !workers || !tids) return ERROR_IO;
+  //Whole words per chunk, so no word is scanned twice.
+  chunk = (DUMP_CHUNK_BYTES / record) & ~63ULL;
+  if(chunk > DUMP_CHUNK) chunk = DUMP_CHUNK;
+  if(chunk < 64) chunk = 64;
+  pthread_barrier_init(&start, NULL, threads);
+  pthread_barrier_init(&done, NULL, threads);
+  for(i = 0; i < threads; ++i) {
+    jobs[i].storage = dumped;
+    jobs[i].binary = binary;
+    workers[i].job = &jobs[i];
+    workers[i].start = &start;
+    workers[i].done = &done;
+    workers[i].finished = &finished;
+    if(i > 0 && pthread_create(&tids[i], NULL, dump_thread, &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(ERROR_IO);
+    }
+  }
+  for(pos = first; pos < last; pos += threads * chunk) {
+    for(i = 0; i < threads; ++i) {
+      jobs[i].first = pos + i * chunk < last ? pos + i * chunk : last;
+      jobs[i].last = jobs[i].first + chunk < last ? jobs[i].first + chunk : last;
+    }
+    if(threads > 1) pthread_barrier_wait(&start);
+    dump_range(&jobs[0]);
+    if(threads > 1) pthread_barrier_wait(&done);
+    for(i = 0; i < threads; ++i) {
+      fwrite(jobs[i].out, 1, jobs[i].len, stdout);
+      count += jobs[i].count;
+    }
+  }
+  finished = 1;
+  if(threads > 1) pthread_barrier_wait(&start);
+  for(i = 0; i < threads; ++i) {
+    if(i > 0) pthread_join(tids[i], NULL);
+    free(jobs[i].out);
+  }
+  pthread_barrier_destroy(&start);
+  pthread_barrier_destroy(&done);
+  fflush(stdout);
+  stats_add((last - first) / 8, count);
+  free(jobs);
+  free(workers);
+  free(tids);
+  return 0;
+}
+
+int command_dump(int argc, char **argv) {
+  uint64_t count, first, last;
+  unsigned int part = 0, parts = 1;
+  int binary = 0;
+  int threads = 1;
+  int opt, ret;
+
+  while((opt = getopt(argc - 1, argv + 1, "bj:r:")) != -1) {
+    switch(opt) {
+    case 'b':
+      binary = 1;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'r':
+      if(sscanf(optarg, "%u/%u", &part, &parts) != 2 || parts == 0 || part >= parts) {
+	fprintf(stderr, "Range must be <part>/<parts> with part < parts.\n");
+	return ERROR_CLI_PARAM;
+      }
+      break;
+    default:
+      usage(ERROR_CLI_PARAM);
+    }
+  }
+  if(optind + 1 != argc || threads < 1) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  storage = open_ngram_storage_readonly(fname);
+  if(storage == NULL) {
+    perror("open storage");
+    return ERROR_IO;
+  }
+  stats_phase("dump");
+  //Ranges are split at word boundaries, so every part scans whole words.
+  count = ngram_index_count(storage);
+  first = (uint64_t)((unsigned __int128)count * part / parts) & ~63ULL;
+  last = part + 1 == parts ? count : (uint64_t)((unsigned __int128)count * (part + 1) / parts) & ~63ULL;
+  ret = dump_storage(storage, first, last, binary, threads);
+  close_ngram_storage_readonly(storage);
+  return ret;
+}
+
+
+/* True if a value of the n-gram is above gram_max of the storage. */
+static int above_gram_max(const uint8_t *grams) {
+  int i;
+
+  for(i = 0; i < storage->n; ++i) {
+    if(grams[i] > storage->gram_max) return 1;
+  }
+  return 0;
+}
+
+/* Add the n-grams of raw data read from stdin, skipping those with values above gram_max. */
+static int ingest_raw(ngram_ingest_t *ingest, uint64_t *bytes) {
+  static uint8_t buf[(1 << 20) + MAX_NGRAM_BUFFER];
+  const int n = storage->n;
+  size_t fill = 0, got, pos;
+  size_t invalid_until = 0; //!< first position whose n-gram has no value above gram_max
+  int i;
+
+  //The carried bytes have been checked before, so invalid_until stays valid across blocks.
+  while((got = fread(buf + fill, 1, (1 << 20), stdin)) > 0) {
+    *bytes += got;
+    fill += got;
+    for(pos = 0; pos + n <= fill; ++pos) {
+      if(buf[pos + n - 1] > storage->gram_max) invalid_until = pos + n;
+      if(pos >= invalid_until && ngram_ingest_add(ingest, buf + pos) != 0) return -1;
+    }
+    //Keep the last n - 1 bytes for the next block.
+    for(i = 0; (size_t)i < fill - pos; ++i) buf[i] = buf[pos + i];
+    invalid_until = invalid_until > pos ? invalid_until - pos : 0;
+    fill -= pos;
+  }
+  return ferror(stdin) ? -1 : 0;
+}
+
+int command_ingest(int argc, char **argv) {
+  ngram_ingest_t *ingest;
+  const char *tmpdir = NULL;
+  size_t memory = 256;
+  char buf[1 << 11];
+  uint8_t ngrambuf[MAX_NGRAM_BUFFER];
+  uint64_t bytes = 0, lines = 0, newly_set = 0, skipped = 0;
+  int binary = 0, raw = 0;
+  int opt, ret = 0;
+
+  while((opt = getopt(argc - 1, argv + 1, "m:T:br")) != -1) {
+    switch(opt) {
+    case 'm':
+      memory = strtoul(optarg, NULL, 0);
+      break;
+    case 'T':
+      tmpdir = optarg;
+      break;
+    case 'b':
+      binary = 1;
+      break;
+    case 'r':
+      raw = 1;
+      break;
+    default:
+      usage(ERROR_CLI_PARAM);
+    }
+  }
+  if(optind + 1 != argc || (binary && raw)) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  storage = open_ngram_storage(fname);
+  if(storage == NULL) {
+    perror("open storage");
+    return ERROR_IO;
+  }
+  ingest = ngram_ingest_begin(storage, memory << 20, tmpdir);
+  if(!ingest) {
+    perror("ngram_ingest_begin");
+    return ERROR_IO;
+  }
+  stats_phase("collect");
+  if(raw) {
+    ret = ingest_raw(ingest, &bytes);
+  } else if(binary) {
+    while(ret == 0 && fread(ngrambuf, storage->n, 1, stdin) == 1) {
+      bytes += storage->n;
+      ++lines;
+      //The index of such an n-gram may lie in the bitmap, but belongs to another n-gram.
+      if(above_gram_max(ngrambuf)) {
+	fprintf(stderr, "N-gram %" PRIu64 " has values above gram_max!\n", lines);
+	++skipped;
+	continue;
+      }
+      ret = ngram_ingest_add(ingest, ngrambuf);
+    }
+  } else {
+    while(ret == 0 && fgets(buf, sizeof(buf), stdin) != NULL) {
+      bytes += strlen(buf);
+      ++lines;
+      if(ngram_from_string_into(storage, buf, ngrambuf)) {
+	if(above_gram_max(ngrambuf)) {
+	  fprintf(stderr, "N-gram line has values above gram_max: '%s'!\n", buf);
+	  ++skipped;
+	} else {
+	  ret = ngram_ingest_add(ingest, ngrambuf);
+	}
+      } else if(strspn(buf, " \t\r\n") != strlen(buf)) {
+	fprintf(stderr, "Can not interpret n-gram line: '%s'!\n", buf);
+      }
+    }
+  }
+  if(ret != 0) perror("ingest");
+  stats_add(bytes, raw ? ingest->added : lines);
+  stats_count("n-grams added", ingest->added);
+  stats_count("indices spilled", ingest->spilled);
+  if(skipped) {
+    fprintf(stderr, "Warning! %" PRIu64 " n-grams with values above gram_max were skipped.\n", skipped);
+    stats_count("n-grams skipped", skipped);
+  }
+  stats_phase("apply");
+  if(ngram_ingest_finish(ingest, &newly_set) != 0) {
+    perror("ngram_ingest_finish");
+    ret = -1;
+  }
+  stats_count("bits newly set", newly_set);
+  stats_phase("close");
+  close_ngram_storage(storage);
+  return ret == 0 && skipped == 0 ? 0 : ERROR_IO;
+}
+
+
+int command_snapshot(int argc, char **argv) {
+  if(argc != 3) usage(ERROR_CLI_PARAM);
+  storage = open_ngram_storage(fname);
+  if(storage == NULL) {
+    perror("open storage");
+    return ERROR_IO;
+  }
+  stats_phase("snapshot");
+  storage->generation++;
+  if(copy_ngram_storage(storage, argv[2]) != 0) {
+    perror(argv[2]);
+    storage->generation--;
+    close_ngram_storage(storage);
+    return ERROR_IO;
+  }
+  stats_add(storage->SIZE, 1);
+  fprintf(stderr, "Snapshot of generation %" PRIu64 " written to '%s'.\n", storage->generation, argv[2]);
+  close_ngram_storage(storage);
+  return 0;
+}
+
+
+int command_adopt(int argc, char **argv) {
+  if(argc != 2) usage(ERROR_CLI_PARAM);
+  if(adopt_ngram_storage(fname) != 0) {
+    perror(fname);
+    return ERROR_IO;
+  }
+  return 0;
+}
+
+
+int command_diff(int argc, char **argv) {
+  ngram_storage_t *older, *newer;
+  ngram_delta_stats_t stats;
+  const char *output = NULL;
+  FILE *out = stdout;
+  int opt, ret = 0;
+
+  while((opt = getopt(argc - 1, argv + 1, "o:")) != -1) {
+    switch(opt) {
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(ERROR_CLI_PARAM);
+    }
+  }
+  ++optind;
+  if(optind + 2 != argc) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  older = open_ngram_storage_readonly(argv[optind]);
+  newer = open_ngram_storage_readonly(argv[optind + 1]);
+  if(!older || !newer) {
+    perror(older ? argv[optind + 1] : argv[optind]);
+    return ERROR_IO;
+  }
+  if(output && !(out = fopen(output, "wb"))) {
+    perror(output);
+    return ERROR_IO;
+  }
+  stats_phase("diff");
+  if(ngram_delta_write(out, older, newer, &stats) != 0) {
+    perror("diff");
+    ret = ERROR_IO;
+  } else {
+    fprintf(stderr, "Generation %" PRIu64 " -> %" PRIu64 ": %" PRIu64 " new bits in %" PRIu64 " of %" PRIu64 " words, %" PRIu64 " runs.\n",
+	    stats.from_generation, stats.to_generation, stats.bits, stats.changed_words, stats.words, stats.runs);
+    if(stats.cleared_bits) fprintf(stderr, "Warning! %" PRIu64 " bits are only set in the older storage, they are not part of the delta.\n", stats.cleared_bits);
+    if(stats.to_generation <= stats.from_generation) fprintf(stderr, "Warning! The generation does not increase.\n");
+  }
+  stats_add(stats.words * 16, stats.words);
+  stats_count("changed words", stats.changed_words);
+  stats_count("new bits", stats.bits);
+  if(output && fclose(out) != 0) {
+    perror(output);
+    ret = ERROR_IO;
+  }
+  close_ngram_storage_readonly(older);
+  close_ngram_storage_readonly(newer);
+  return ret;
+}
+
+
+int command_apply(int argc, char **argv) {
+  ngram_delta_stats_t stats;
+  FILE *in;
+  int force = 0;
+  int opt, ret = 0;
+
+  while((opt = getopt(argc - 1, argv + 1, "f")) != -1) {
+    switch(opt) {
+    case 'f':
+      force = 1;
+      break;
+    default:
+      usage(ERROR_CLI_PARAM);
+    }
+  }
+  ++optind;
+  if(optind + 1 != argc) usage(ERROR_CLI_PARAM);
+  in = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "rb");
+  if(!in) {
+    perror(argv[optind]);
+    return ERROR_IO;
+  }
+  stats_phase("open");
+  storage = open_ngram_storage(fname);
+  if(storage == NULL) {
+    perror("open storage");
+    return ERROR_IO;
+  }
+  stats_phase("apply");
+  if(ngram_delta_apply(in, storage, force, &stats) != 0) {
+    if(!force && stats.from_generation != storage->generation) {
+      fprintf(stderr, "Error! Delta is from generation %" PRIu64 " but the storage is at generation %" PRIu64 ".\n", stats.from_generation, storage->generation);
+    } else {
+      fprintf(stderr, "Error! Invalid or truncated delta '%s'.\n", argv[optind]);
+    }
+    ret = ERROR_IO;
+  } else {
+    fprintf(stderr, "Applied %" PRIu64 " new bits, storage is at generation %" PRIu64 ".\n", stats.bits, storage->generation);
+  }
+  stats_count("new bits", stats.bits);
+  stats_phase("close");
+  close_ngram_storage(storage);
+  if(in != stdin) fclose(in);
+  return ret;
+}
+
+
+int command_pack(int argc, char **argv) {
+  ngram_pack_stats_t stats;
+
+  if(argc != 3) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  storage = open_ngram_storage_readonly(fname);
+  if(storage == NULL) {
+    perror("open storage");
+    return ERROR_IO;
+  }
+  stats_phase("pack");
+  if(ngram_pack_write(storage, argv[2], &stats) != 0) {
+    perror(argv[2]);
+    close_ngram_storage_readonly(storage);
+    return ERROR_IO;
+  }
+  fprintf(stderr, "Packed %" PRIu64 " bytes into %" PRIu64 " bytes: %" PRIu64 " empty, %" PRIu64 " sparse and %" PRIu64 " raw blocks.\n",
+	  stats.bitmap_bytes, stats.packed_bytes, stats.empty_blocks, stats.sparse_blocks, stats.raw_blocks);
+  stats_add(stats.bitmap_bytes, stats.blocks);
+  stats_count("empty blocks", stats.empty_blocks);
+  stats_count("sparse blocks", stats.sparse_blocks);
+  stats_count("raw blocks", stats.raw_blocks);
+  close_ngram_storage_readonly(storage);
+  return 0;
+}
+
+
+int command_unpack(int argc, char **argv) {
+  ngram_packed_t *packed;
+  int ret = 0;
+
+  if(argc != 4) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  packed = open_ngram_packed(argv[2]);
+  if(!packed) {
+    perror(argv[2]);
+    return ERROR_IO;
+  }
+  stats_phase("unpack");
+  if(ngram_unpack(packed, argv[3]) != 0) {
+    perror(argv[3]);
+    ret = ERROR_IO;
+  }
+  stats_add(packed->size, packed->block_count);
+  stats_count("blocks decoded", packed->decoded);
+  close_ngram_packed(packed);
+  return ret;
+}
+
+
+/* Like recall, but on a packed storage. */
+int command_lookup(int argc, char **argv) {
+  ngram_packed_t *packed;
+  uint8_t ngrambuf[MAX_NGRAM_BUFFER];
+  uint8_t *ngptr;
+  ngram_storage_t *header;
+  char buf[1 << 11];
+  long counter = 0;
+  long found = 0;
+  uint64_t bytes = 0;
+  int i;
+
+  if(argc != 3 && argc != 4) usage(ERROR_CLI_PARAM);
+  stats_phase("open");
+  packed = open_ngram_packed(argv[2]);
+  if(!packed) {
+    perror(argv[2]);
+    return ERROR_IO;
+  }
+  stats_phase("lookup");
+  header = (ngram_storage_t*)packed->header;
+  printf("combinations = %30.20Le\n", header->combinations);
+  if(argc == 4) {
+    ngptr = ngram_from_string_into(header, argv[3], ngrambuf);
+    if(ngptr) {
+      for(i = 0; i < header->n; ++i) {
+	printf(" %02x", ngptr[i]);
+      }
+      i = find_ngram_packed(packed, ngptr);
+      printf("\t %d\n", i);
+      found += i != 0;
+    }
+  } else {
+    while(fgets(buf, sizeof(buf), stdin) != NULL) {
+      bytes += strlen(buf);
+      ++counter;
+      ngptr = ngram_from_string_into(header, buf, ngrambuf);
+      if(!ngptr) continue;
+      for(i = 0; i < header->n; ++i) {
+	printf(" %02x", ngptr[i]);
+      }
+      i = find_ngram_packed(packed, ngptr);
+      if(i != 0) found++;
+      printf("\t %d\t | ", i);
+      for(i = 0; i < header->n; ++i) {
+	if(ngptr[i] >= 0x20 && ngptr[i] < 0x7f) putchar(ngptr[i]); else putchar('.');
+      }
+      putchar('\n');
+    }
+    fprintf(stderr, "%08lx/%08lx %e\n", found, counter, (double)found / counter);
+  }
+  stats_add(bytes, counter);
+  stats_count("lookups", packed->lookups);
+  stats_count("hits", found);
+  stats_count("blocks decoded", packed->decoded);
+  close_ngram_packed(packed);
   return 0;
 }
 
@@ -203,6 +954,7 @@ int command_create(int argc, char **argv) {
     fprintf(stderr, "n not in [1..16] (for now)\n");
     return ERROR_CLI_PARAM;
   }
+  stats_phase("create");
   storage = create_ngram_storage(fname, i, j);
   if(!storage) {
     perror("create_ngram_storage");
@@ -213,6 +965,7 @@ int command_create(int argc, char **argv) {
 
 
 int main(int argc, char **argv) {
+  if(stats_init(&argc, argv, "emmagrammer") != 0) usage(ERROR_CLI_PARAM);
   if(argc == 1) {
     usage(ERROR_CLI_PARAM);
   }
@@ -228,6 +981,26 @@ int main(int argc, char **argv) {
     return command_ngramify(argc, argv);
   } else if(strcmp(argv[1], "foltran") == 0) {
     return command_foltran(argc, argv);
+  } else if(strcmp(argv[1], "classify") == 0) {
+    return command_classify(argc, argv);
+  } else if(strcmp(argv[1], "dump") == 0) {
+    return command_dump(argc, argv);
+  } else if(strcmp(argv[1], "ingest") == 0) {
+    return command_ingest(argc, argv);
+  } else if(strcmp(argv[1], "snapshot") == 0) {
+    return command_snapshot(argc, argv);
+  } else if(strcmp(argv[1], "adopt") == 0) {
+    return command_adopt(argc, argv);
+  } else if(strcmp(argv[1], "diff") == 0) {
+    return command_diff(argc, argv);
+  } else if(strcmp(argv[1], "apply") == 0) {
+    return command_apply(argc, argv);
+  } else if(strcmp(argv[1], "pack") == 0) {
+    return command_pack(argc, argv);
+  } else if(strcmp(argv[1], "unpack") == 0) {
+    return command_unpack(argc, argv);
+  } else if(strcmp(argv[1], "lookup") == 0) {
+    return command_lookup(argc, argv);
   } else {
     fprintf(stderr, "Unknown command '%s'.\n", argv[1]);
     return 1;
@@ -1,6 +1,8 @@
 %module emmagrammer
 %{
 #include "ngram-storage.h"
+#include "ngram-classify.h"
+#include "ngram-pack.h"
 %}
 
 #include "ngram-storage.h"
@@ -9,7 +11,24 @@ ngram_storage_t *open_ngram_storage(const char *fname);
 ngram_storage_t *create_ngram_storage(const char *fname, int gram_max, int n);
 
 void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
+int test_and_set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
 int find_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
 void close_ngram_storage(ngram_storage_t *ngramstorage);
 uint8_t *ngram_from_string(ngram_storage_t *ngramstorage, const char *hextex);
 double population_count(ngram_storage_t *ngramstorage);
+ngram_storage_t *open_ngram_storage_readonly(const char *fname);
+void close_ngram_storage_readonly(ngram_storage_t *ngramstorage);
+
+%apply (char *STRING, size_t LENGTH) { (const char *data, size_t len) };
+ngram_model_set_t *create_ngram_model_set(void);
+int ngram_model_set_add(ngram_model_set_t *set, const char *fname);
+int ngram_model_set_classify(ngram_model_set_t *set, const char *data, size_t len, int fold);
+double ngram_model_set_ratio(const ngram_model_set_t *set, int model);
+const char *ngram_model_set_name(const ngram_model_set_t *set, int model);
+int ngram_model_set_size(const ngram_model_set_t *set);
+void close_ngram_model_set(ngram_model_set_t *set);
+
+ngram_packed_t *open_ngram_packed(const char *fname);
+int find_ngram_packed(ngram_packed_t *packed, const uint8_t *grams);
+int ngram_unpack(ngram_packed_t *packed, const char *fname);
+void close_ngram_packed(ngram_packed_t *packed);
@@ -0,0 +1,183 @@
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pipeline.hh"
+#include "stats.h"
+
+using namespace std;
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n n-gram] [-f range]... [-t] [-B block-KiB] [-q depth] [-b] [--stats[=json]] <sink> [<file>...]\n"
+	  "Runs reader, fold, window and sink in one process (instead of e.g. foltran | ngramify | histogramify).\n"
+	  "Sinks:\n"
+	  "  store      set the n-grams in the storage\n"
+	  "  recall     count the n-grams found in the storage per file\n"
+	  "  histogram  n-gram histogram like histogramify (-b for the binary format)\n"
+	  "  ngrams     n-grams in the text format of ngramify\n"
+	  "  -f range   fold range as for emmagrammer foltran (x-y or x~y), repeatable\n"
+	  "  -t         fold with the table saved in the storage\n"
+	  "The storage is taken from $NGRAM_STORAGE (default %s), n defaults to its n.\n", name, DEFAULT_STORAGE_FILENAME);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+  Pipeline_config config = { 0, 1 << 20, 8, NULL, NULL };
+  uint8_t fold_table[256] = { 0 };
+  int fold_next = 0;
+  bool storage_table = false;
+  bool binary = false;
+  int n = -1;
+  int opt;
+  const char *fname;
+  ngram_storage_t *storage = NULL;
+  unique_ptr<Pipeline_sink> sink;
+  vector<string> inputs;
+  Pipeline_stats pstats;
+
+  if(stats_init(&argc, argv, "emmapipe") != 0) exit(EXIT_FAILURE);
+  while((opt = getopt(argc, argv, "n:f:tB:q:b")) != -1) {
+    switch(opt) {
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'f':
+      if(!parse_fold_range(optarg, fold_table, fold_next)) {
+	fprintf(stderr, "Error at: %s\n", optarg);
+	exit(EXIT_FAILURE);
+      }
+      config.fold_table = fold_table;
+      break;
+    case 't':
+      storage_table = true;
+      break;
+    case 'B':
+      config.block_size = static_cast<size_t>(atol(optarg)) << 10;
+      break;
+    case 'q':
+      config.queue_depth = atoi(optarg);
+      break;
+    case 'b':
+      binary = true;
+      break;
+    default: /* '?' */
+      usage(argv[0]);
+    }
+  }
+  if(optind >= argc || config.block_size == 0 || config.queue_depth < 1) usage(argv[0]);
+  string kind(argv[optind++]);
+  for(; optind < argc; ++optind) inputs.push_back(argv[optind]);
+  if(inputs.empty()) inputs.push_back("-");
+  fname = getenv("NGRAM_STORAGE");
+  if(fname == NULL) fname = DEFAULT_STORAGE_FILENAME;
+
+  stats_phase("open");
+  if(kind == "store" || kind == "recall" || storage_table) {
+    storage = kind == "store" ? open_ngram_storage(fname) : open_ngram_storage_readonly(fname);
+    if(storage == NULL) {
+      perror(fname);
+      exit(EXIT_FAILURE);
+    }
+    if(storage_table) {
+      memcpy(fold_table, storage->last_fold_tranform_table, sizeof(fold_table));
+      config.fold_table = fold_table;
+    }
+  }
+  if(kind == "store" || kind == "recall") {
+    if(n > 0 && n != storage->n) {
+      fprintf(stderr, "The storage has n = %d.\n", storage->n);
+      exit(EXIT_FAILURE);
+    }
+    n = storage->n;
+    config.storage = storage;
+  }
+  if(n < 1 || n > MAX_NGRAM_BUFFER) {
+    fprintf(stderr, "You need to provide a value for n.\n");
+    exit(EXIT_FAILURE);
+  }
+  config.n = n;
+  Header_type header;
+  header["n"] = to_string(n);
+  if(inputs.size() == 1 && inputs[0] != "-") header["fname"] = inputs[0];
+  if(kind == "store") {
+    sink.reset(new Store_sink(storage));
+  } else if(kind == "recall") {
+    sink.reset(new Recall_sink(storage));
+  } else if(kind == "histogram") {
+    sink.reset(new Histogram_sink(n));
+  } else if(kind == "ngrams") {
+    //Same header as ngramify.
+    printf("#type: n-grams\n#n: %d\n", n);
+    if(header.count("fname")) printf("#fname: %s\n", header["fname"].c_str());
+    putchar('\n');
+    sink.reset(new Ngram_text_sink(n, stdout));
+  } else {
+    fprintf(stderr, "Unknown sink '%s'.\n", kind.c_str());
+    usage(argv[0]);
+  }
+
+  stats_phase("pipeline");
+  try {
+    pstats = run_pipeline(inputs, config, *sink);
+  }
+  catch(std::exception &excp) {
+    fprintf(stderr, "Error! %s\n", excp.what());
+    exit(EXIT_FAILURE);
+  }
+  stats_add(pstats.bytes, pstats.windows);
+  stats_count("blocks", pstats.blocks);
+  stats_count("queue full waits", pstats.full_waits);
+  stats_count("queue empty waits", pstats.empty_waits);
+
+  if(kind == "store") {
+    Store_sink *store = static_cast<Store_sink*>(sink.get());
+    fprintf(stderr, "Stored %" PRIu64 " n-grams, %" PRIu64 " bits newly set.\n", store->stored, store->newly_set);
+    if(store->invalid) fprintf(stderr, "Warning! %" PRIu64 " n-grams with values above gram_max were skipped.\n", store->invalid);
+    stats_count("bits newly set", store->newly_set);
+    stats_phase("close");
+    close_ngram_storage(storage);
+  } else if(kind == "recall") {
+    Recall_sink *recall = static_cast<Recall_sink*>(sink.get());
+    uint64_t lookups = 0, hits = 0;
+    recall->lookups.resize(inputs.size());
+    recall->hits.resize(inputs.size());
+    for(size_t i = 0; i < inputs.size(); ++i) {
+      printf("%s\t%" PRIu64 "\t%" PRIu64 "\t%e\n", inputs[i].c_str(), recall->hits[i], recall->lookups[i],
+	     recall->lookups[i] ? (double)recall->hits[i] / recall->lookups[i] : 0.0);
+      lookups += recall->lookups[i];
+      hits += recall->hits[i];
+    }
+    fprintf(stderr, "%08" PRIx64 "/%08" PRIx64 " %e\n", hits, lookups, lookups ? (double)hits / lookups : 0.0);
+    stats_count("lookups", lookups);
+    stats_count("hits", hits);
+    close_ngram_storage_readonly(storage);
+  } else {
+    if(kind == "histogram") {
+      Histogram_sink *histogram = static_cast<Histogram_sink*>(sink.get());
+      unique_ptr<Binary_histogram_writer> writer;
+
+      stats_phase("write");
+      header["type"] = "n-grams histogram";
+      if(binary) {
+	writer.reset(new Binary_histogram_writer(stdout, n, header));
+      } else {
+	write_histogram_header(cout, header);
+      }
+      histogram->for_each([&writer](const Ngram_type &ngram, uint64_t count) {
+	  if(writer) writer->write(ngram, count); else write_histogram_entry(cout, ngram, count);
+	});
+      if(writer) writer->flush();
+      cout.flush();
+      stats_add(0, histogram->size());
+      cerr << "Histogram entries " << dec << histogram->size() << endl;
+    }
+    if(storage) close_ngram_storage_readonly(storage);
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*! \brief entropy-profile: sliding window byte entropy
+ *
+ * Prints the Shannon entropy (bits per byte) of a window sliding over
+ * a file, which shows compressed or encrypted regions at a glance.
+ */
+#include "histogram.h"
+#include "mappedfile.hh"
+#include "stats.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+struct Profile_params {
+  bool print_histogram;
+};
+
+static void print_window(size_t offset, const sliding_histogram_t *sh, void *ctx) {
+  const Profile_params *params = static_cast<const Profile_params*>(ctx);
+  int i;
+
+  printf("%zu\t%.6f", offset, sliding_histogram_entropy(sh));
+  if(params->print_histogram) {
+    for(i = 0; i < 256; ++i) printf("\t%u", sh->counts[i]);
+  }
+  putchar('\n');
+}
+
+int main(int argc, char **argv) {
+  size_t window = 4096;
+  size_t stride = 0;
+  Profile_params params = { false };
+  int opt;
+
+  if(stats_init(&argc, argv, "entropy-profile") != 0) return 1;
+  while((opt = getopt(argc, argv, "w:s:H")) != -1) {
+    try {
+      switch(opt) {
+      case 'w':
+	window = boost::lexical_cast<size_t>(optarg);
+	break;
+      case 's':
+	stride = boost::lexical_cast<size_t>(optarg);
+	break;
+      case 'H':
+	params.print_histogram = true;
+	break;
+      default: /* '?' */
+	optind = argc;
+      }
+    }
+    catch(const boost::bad_lexical_cast &) {
+      cerr << "Error: bad value for -" << static_cast<char>(opt) << ": " << optarg << '\n';
+      optind = argc;
+      break;
+    }
+  }
+  if(argc - optind != 1 || window < 1) {
+    cerr << "usage: entropy-profile [-w window] [-s stride] [-H] [--stats[=json]] <file>\n";
+    return 1;
+  }
+  if(stride == 0) stride = window;
+  try {
+    stats_phase("map");
+    MappedFile data(argv[optind]);
+    stats_phase("profile");
+    long windows = entropy_profile(data.data(), data.size(), window, stride, print_window, &params);
+    if(windows < 0) {
+      cerr << "Error! Can not calculate profile.\n";
+      return 1;
+    }
+    fflush(stdout);
+    stats_add(data.size(), windows);
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error! Exception: " << excp.what() << endl;
+    return -1;
+  }
+  return 0;
+}
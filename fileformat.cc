@@ -1,4 +1,8 @@
 #include "fileformat.hh"
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
 
 using namespace std;
 
@@ -31,3 +35,60 @@ std::vector<uint8_t> read_ngram_line(unsigned int n, std::istream &in) {
   return ngrams;
 }
 
+
+void Two_gram_histogram::finish() {
+  stable_sort(cells.begin(), cells.end(), [](const Cell &a, const Cell &b) { return a.first < b.first; });
+  auto last = unique(cells.rbegin(), cells.rend(), [](const Cell &a, const Cell &b) { return a.first == b.first; });
+  cells.erase(cells.begin(), last.base());
+  total = 0;
+  for(auto &cell : cells) total += cell.second;
+}
+
+/* Parse " xx yy\t $count ..." without a stream per line. */
+static bool parse_2gram_line(const string &line, int &x, int &y, unsigned long &count) {
+  const char *pos = line.c_str();
+  char *end;
+
+  x = strtol(pos, &end, 16);
+  if(end == pos) return false;
+  y = strtol(pos = end, &end, 16);
+  if(end == pos || x < 0 || x > 255 || y < 0 || y > 255) return false;
+  for(pos = end; *pos == ' ' || *pos == '\t'; ++pos);
+  if(*pos++ != '$') return false;
+  count = strtoul(pos, &end, 16);
+  return end != pos;
+}
+
+Two_gram_histogram read_2gram_histogram(const char *fname, uint64_t *bytes) {
+  ifstream in(fname);
+  unsigned long count;
+  int x, y;
+  string line;
+  uint64_t read = 0;
+
+  if(!in) throw runtime_error(string("can not open '") + fname + "'");
+  Two_gram_histogram histogram(read_header(in));
+  while(getline(in, line)) {
+    read += line.size() + 1;
+    if(line.empty()) continue;
+    if(!parse_2gram_line(line, x, y, count)) {
+      cerr << "Error in line '" << line << "': read n-gram failed" << endl;
+      throw runtime_error("read n-gram failed");
+    }
+    histogram.set(x, y, count);
+  }
+  histogram.finish();
+  if(bytes) *bytes = read;
+  return histogram;
+}
+
+string npy_header(const char *descr, size_t rows, size_t columns) {
+  string dict(string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + to_string(rows) + ", " + to_string(columns) + "), }");
+  //Magic, version and length field take 10 bytes, total must be a multiple of 64.
+  dict.append(63 - (10 + dict.size()) % 64, ' ');
+  dict += '\n';
+  string header("\x93NUMPY\x01\x00", 8);
+  header += static_cast<char>(dict.size() & 0xFF);
+  header += static_cast<char>(dict.size() >> 8);
+  return header + dict;
+}
@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <map>
 #include <fstream>
+#include <stddef.h>
 #include <string>
 #include <vector>
 
@@ -19,4 +20,46 @@ Header_type read_header(std::istream &in);
 
 std::vector<uint8_t> read_ngram_line(unsigned int n, std::istream &in);
 
+/*! \brief Sparse 2-gram histogram of one file
+ *
+ * Only non-zero cells are kept, ordered by their position in a
+ * 65536 wide row (y major, x minor).
+ */
+class Two_gram_histogram {
+public:
+  typedef std::pair<uint16_t,unsigned long> Cell;
+private:
+  Header_type header;
+  std::vector<Cell> cells;
+  unsigned long total;
+public:
+  Two_gram_histogram() : total(0) { }
+  Two_gram_histogram(const Header_type &h) : header(h), total(0) { }
+  void set(int x, int y, unsigned long count) {
+    cells.emplace_back(y * 256 + x, count);
+  }
+  /*! \brief sort cells into row order, later duplicates win */
+  void finish();
+  const std::vector<Cell> &get_cells() const { return cells; }
+  unsigned long get_total() const { return total; }
+  const Header_type &get_header() const { return header; }
+};
+
+/*! \brief read a textual 2-gram histogram as written by histogramify
+ *
+ * \param fname file name
+ * \param bytes receives the number of bytes read (may be NULL)
+ * \return the histogram
+ * \throw std::runtime_error if the file can not be read or parsed
+ */
+Two_gram_histogram read_2gram_histogram(const char *fname, uint64_t *bytes = NULL);
+
+/*! \brief Header of a NumPy .npy version 1.0 file of a C order matrix
+ *
+ * \param descr element type, e.g. "<f4" or "<u8"
+ * \param rows number of rows
+ * \param columns number of columns
+ */
+std::string npy_header(const char *descr, size_t rows, size_t columns);
+
 #endif
@@ -0,0 +1,243 @@
+#include "histogram-runs.hh"
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+static const char BINARY_MAGIC[8] = { 'E', 'M', 'M', 'A', 'H', 'I', 'S', 'T' };
+static const uint32_t BINARY_VERSION = 1;
+
+static void put_le(uint8_t *dst, uint64_t val, int bytes) {
+  for(int i = 0; i < bytes; ++i) dst[i] = (val >> (8 * i)) & 0xFF;
+}
+
+static uint64_t get_le(const uint8_t *src, int bytes) {
+  uint64_t val = 0;
+  for(int i = bytes - 1; i >= 0; --i) val = (val << 8) | src[i];
+  return val;
+}
+
+
+void write_histogram_entry(ostream &out, const Ngram_type &ngram, uint64_t count) {
+  out << hex;
+  for(auto j : ngram) out << ' ' << setw(2) << static_cast<unsigned int>(j);
+  out << boost::format("\t $%06lX %8ld\n") % count % count;
+}
+
+void write_histogram_header(ostream &out, const Header_type &header) {
+  for(auto i : header) {
+    out << '#' << i.first << ": " << i.second << '\n';
+  }
+  out << endl;
+}
+
+
+Text_histogram_source::Text_histogram_source(const char *fname_) : in(fname_), fname(fname_) {
+  if(!in) throw runtime_error(str(boost::format("can not open '%s'") % fname));
+  header = read_header(in);
+  if(header["type"] != "n-grams histogram") {
+    throw runtime_error(str(boost::format("'%s' is not an n-grams histogram") % fname));
+  }
+  n = boost::lexical_cast<unsigned int>(header.at("n"));
+}
+
+bool Text_histogram_source::next(Ngram_type &ngram, uint64_t &count) {
+  string line;
+  char ch;
+
+  while(getline(in, line)) {
+    if(line.empty()) continue;
+    istringstream sin(line);
+    ngram = read_ngram_line(n, sin);
+    sin >> ch >> hex >> count;
+    if(!sin || ch != '$') {
+      throw runtime_error(str(boost::format("bad histogram line in '%s': '%s'") % fname % line));
+    }
+    return true;
+  }
+  return false;
+}
+
+
+Binary_histogram_source::Binary_histogram_source(FILE *fin_, const string &name) : fin(fin_) {
+  uint8_t buf[16];
+  uint32_t hlen;
+
+  if(fread(buf, 1, 16, fin) != 16 || memcmp(buf, BINARY_MAGIC, 8) != 0) {
+    fclose(fin);
+    throw runtime_error(str(boost::format("'%s' is not a binary histogram") % name));
+  }
+  if(get_le(buf + 8, 4) != BINARY_VERSION) {
+    fclose(fin);
+    throw runtime_error(str(boost::format("'%s' has unknown version") % name));
+  }
+  n = get_le(buf + 12, 4);
+  if(fread(buf, 1, 4, fin) != 4) {
+    fclose(fin);
+    throw runtime_error(str(boost::format("'%s' is truncated") % name));
+  }
+  hlen = get_le(buf, 4);
+  string text(hlen, '\0');
+  if(hlen > 0 && fread(&text[0], 1, hlen, fin) != hlen) {
+    fclose(fin);
+    throw runtime_error(str(boost::format("'%s' is truncated") % name));
+  }
+  istringstream sin(text + "\n");
+  header = read_header(sin);
+  record.resize(n + 8);
+  //Runs are read sequentially, so a larger buffer pays off when merging.
+  setvbuf(fin, NULL, _IOFBF, 1 << 20);
+}
+
+Binary_histogram_source::~Binary_histogram_source() {
+  fclose(fin);
+}
+
+bool Binary_histogram_source::next(Ngram_type &ngram, uint64_t &count) {
+  if(fread(&record[0], 1, record.size(), fin) != record.size()) return false;
+  ngram.assign(record.begin(), record.begin() + n);
+  count = get_le(&record[n], 8);
+  return true;
+}
+
+
+Binary_histogram_writer::Binary_histogram_writer(FILE *fout_, unsigned int n_, const Header_type &header) : fout(fout_), n(n_), record(n_ + 8) {
+  uint8_t buf[20];
+  ostringstream text;
+
+  for(auto i : header) text << '#' << i.first << ": " << i.second << '\n';
+  memcpy(buf, BINARY_MAGIC, 8);
+  put_le(buf + 8, BINARY_VERSION, 4);
+  put_le(buf + 12, n, 4);
+  put_le(buf + 16, text.str().size(), 4);
+  if(fwrite(buf, 1, 20, fout) != 20 || fwrite(text.str().data(), 1, text.str().size(), fout) != text.str().size()) {
+    throw runtime_error(string("writing histogram header: ") + strerror(errno));
+  }
+}
+
+void Binary_histogram_writer::write(const Ngram_type &ngram, uint64_t count) {
+  copy(ngram.begin(), ngram.end(), record.begin());
+  put_le(&record[n], count, 8);
+  if(fwrite(&record[0], 1, record.size(), fout) != record.size()) {
+    throw runtime_error(string("writing histogram: ") + strerror(errno));
+  }
+}
+
+void Binary_histogram_writer::flush() {
+  if(fflush(fout) != 0) throw runtime_error(string("writing histogram: ") + strerror(errno));
+}
+
+
+unique_ptr<Histogram_source> open_histogram(const char *fname) {
+  char magic[8];
+  FILE *fin = fopen(fname, "rb");
+
+  if(!fin) throw runtime_error(str(boost::format("can not open '%s': %s") % fname % strerror(errno)));
+  if(fread(magic, 1, 8, fin) == 8 && memcmp(magic, BINARY_MAGIC, 8) == 0) {
+    rewind(fin);
+    return unique_ptr<Histogram_source>(new Binary_histogram_source(fin, fname));
+  }
+  fclose(fin);
+  return unique_ptr<Histogram_source>(new Text_histogram_source(fname));
+}
+
+
+FILE *create_run_file(const string &tmpdir) {
+  string dir(tmpdir);
+  int fd;
+  FILE *f;
+
+  if(dir.empty()) {
+    const char *env = getenv("TMPDIR");
+    dir = env != NULL ? env : "/tmp";
+  }
+  string name(dir + "/histogram-run-XXXXXX");
+  fd = mkstemp(&name[0]);
+  if(fd == -1) throw runtime_error(str(boost::format("can not create run file in '%s': %s") % dir % strerror(errno)));
+  unlink(name.c_str());
+  f = fdopen(fd, "w+b");
+  if(!f) {
+    close(fd);
+    throw runtime_error(string("fdopen: ") + strerror(errno));
+  }
+  return f;
+}
+
+
+static uint64_t merge_pass(vector<unique_ptr<Histogram_source> > &sources, const function<void(const Ngram_type &, uint64_t)> &sink) {
+  struct Head {
+    Ngram_type ngram;
+    uint64_t count;
+    size_t source;
+  };
+  auto greater = [](const Head *a, const Head *b) { return a->ngram > b->ngram; };
+  priority_queue<Head*, vector<Head*>, decltype(greater)> heap(greater);
+  vector<Head> heads(sources.size());
+  Ngram_type current;
+  uint64_t sum = 0;
+  uint64_t entries = 0;
+
+  for(size_t i = 0; i < sources.size(); ++i) {
+    if(sources[i]->get_n() != sources[0]->get_n()) {
+      throw runtime_error("histograms have different n");
+    }
+    heads[i].source = i;
+    if(sources[i]->next(heads[i].ngram, heads[i].count)) heap.push(&heads[i]);
+  }
+  while(!heap.empty()) {
+    Head *top = heap.top();
+    heap.pop();
+    if(entries > 0 && top->ngram == current) {
+      sum += top->count;
+    } else {
+      if(entries > 0) sink(current, sum);
+      current = top->ngram;
+      sum = top->count;
+      ++entries;
+    }
+    if(sources[top->source]->next(top->ngram, top->count)) heap.push(top);
+  }
+  if(entries > 0) sink(current, sum);
+  return entries;
+}
+
+unique_ptr<Histogram_source> merge_to_run(vector<unique_ptr<Histogram_source> > &sources, const string &tmpdir) {
+  FILE *run = create_run_file(tmpdir);
+
+  try {
+    Binary_histogram_writer writer(run, sources.at(0)->get_n(), Header_type());
+    merge_pass(sources, [&writer](const Ngram_type &ngram, uint64_t count) { writer.write(ngram, count); });
+    writer.flush();
+  }
+  catch(...) {
+    fclose(run);
+    throw;
+  }
+  sources.clear();
+  rewind(run);
+  return unique_ptr<Histogram_source>(new Binary_histogram_source(run, "run"));
+}
+
+uint64_t merge_histograms(vector<unique_ptr<Histogram_source> > &sources, const function<void(const Ngram_type &, uint64_t)> &sink, const string &tmpdir) {
+  //Every open source holds a read buffer, so merge wide inputs in passes.
+  while(sources.size() > HISTOGRAM_MERGE_FAN_IN) {
+    vector<unique_ptr<Histogram_source> > runs;
+    for(size_t i = 0; i < sources.size(); i += HISTOGRAM_MERGE_FAN_IN) {
+      auto first = sources.begin() + i;
+      auto last = sources.begin() + min(i + HISTOGRAM_MERGE_FAN_IN, sources.size());
+      vector<unique_ptr<Histogram_source> > group(make_move_iterator(first), make_move_iterator(last));
+      runs.push_back(group.size() == 1 ? move(group[0]) : merge_to_run(group, tmpdir));
+    }
+    sources.swap(runs);
+  }
+  return merge_pass(sources, sink);
+}
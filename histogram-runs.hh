@@ -0,0 +1,125 @@
+#ifndef __HISTOGRAM_RUNS_HH_2026__
+#define __HISTOGRAM_RUNS_HH_2026__
+#include <inttypes.h>
+#include <stdio.h>
+#include <functional>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fileformat.hh"
+
+typedef std::vector<uint8_t> Ngram_type;
+typedef std::map<Ngram_type,unsigned long int> Histogram_type;
+
+/*! \brief Sorted stream of n-gram histogram entries
+ *
+ * Every source delivers its entries in ascending n-gram order, which
+ * is the order histogramify writes them in.
+ */
+class Histogram_source {
+public:
+  virtual ~Histogram_source() { }
+  /*! \brief fetch the next entry
+   *
+   * \param ngram receives the n-gram
+   * \param count receives the count
+   * \return false if the source is exhausted
+   */
+  virtual bool next(Ngram_type &ngram, uint64_t &count) = 0;
+  virtual unsigned int get_n() const = 0;
+  virtual const Header_type &get_header() const = 0;
+};
+
+/*! \brief Reader for the textual histogram format of histogramify */
+class Text_histogram_source : public Histogram_source {
+  std::ifstream in;
+  Header_type header;
+  unsigned int n;
+  std::string fname;
+public:
+  Text_histogram_source(const char *fname);
+  bool next(Ngram_type &ngram, uint64_t &count);
+  unsigned int get_n() const { return n; }
+  const Header_type &get_header() const { return header; }
+};
+
+/*! \brief Reader for binary histogram files and spilled runs
+ *
+ * The binary format starts with the magic "EMMAHIST", a version and
+ * n (both 32 bit little endian), the length prefixed text header and
+ * then fixed size records of n bytes plus a 64 bit little endian
+ * count.
+ */
+class Binary_histogram_source : public Histogram_source {
+  FILE *fin;
+  Header_type header;
+  unsigned int n;
+  std::vector<uint8_t> record;
+public:
+  /*! \brief Open a binary histogram
+   *
+   * \param fin open file positioned at the magic, ownership is taken
+   * \param name name for error messages
+   */
+  Binary_histogram_source(FILE *fin, const std::string &name);
+  ~Binary_histogram_source();
+  bool next(Ngram_type &ngram, uint64_t &count);
+  unsigned int get_n() const { return n; }
+  const Header_type &get_header() const { return header; }
+};
+
+/*! \brief Writer for the binary histogram format */
+class Binary_histogram_writer {
+  FILE *fout;
+  unsigned int n;
+  std::vector<uint8_t> record;
+public:
+  Binary_histogram_writer(FILE *fout, unsigned int n, const Header_type &header);
+  void write(const Ngram_type &ngram, uint64_t count);
+  void flush();
+};
+
+/*! \brief Write one entry in the textual histogram format */
+void write_histogram_entry(std::ostream &out, const Ngram_type &ngram, uint64_t count);
+
+/*! \brief Write the textual header including the terminating empty line */
+void write_histogram_header(std::ostream &out, const Header_type &header);
+
+/*! \brief Open a histogram file, detecting the text or binary format */
+std::unique_ptr<Histogram_source> open_histogram(const char *fname);
+
+/*! \brief Create an anonymous temporary file for a spilled run
+ *
+ * The file is unlinked right away, so it vanishes once closed.
+ *
+ * \param tmpdir directory, if empty $TMPDIR or /tmp is used
+ */
+FILE *create_run_file(const std::string &tmpdir);
+
+/*! \brief maximal number of sources merged in one pass */
+const size_t HISTOGRAM_MERGE_FAN_IN = 256;
+
+/*! \brief Merge sorted histogram sources into a temporary run
+ *
+ * \param sources sources to merge, they are drained
+ * \param tmpdir directory for the run, see create_run_file
+ * \return reader positioned at the first entry of the run
+ */
+std::unique_ptr<Histogram_source> merge_to_run(std::vector<std::unique_ptr<Histogram_source> > &sources, const std::string &tmpdir);
+
+/*! \brief k-way merge of sorted histogram sources
+ *
+ * Counts of equal n-grams are summed up. All sources must have the
+ * same n. More than HISTOGRAM_MERGE_FAN_IN sources are first merged
+ * group wise into temporary runs.
+ *
+ * \param sources sources to merge, they are drained
+ * \param sink called once per distinct n-gram in ascending order
+ * \param tmpdir directory for intermediate runs, see create_run_file
+ * \return number of distinct n-grams
+ */
+uint64_t merge_histograms(std::vector<std::unique_ptr<Histogram_source> > &sources, const std::function<void(const Ngram_type &, uint64_t)> &sink, const std::string &tmpdir = "");
+
+#endif
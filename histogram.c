@@ -1,29 +1,224 @@
 #include "histogram.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <math.h>
 
-static double simple_histogram_internal(unsigned char *buf, size_t len, double *hist) {
-  double max;
+/* Each 32 bit sub-histogram may see at most a quarter of a block. */
+#define COUNT_BLOCK_SIZE (1UL << 30)
+/* Do not bother starting threads for less than this per thread. */
+#define MIN_SLICE_SIZE (1UL << 20)
+
+static void count_block(const unsigned char *buf, size_t len, uint64_t *counts) {
+  uint32_t sub[4][256];
+  uint64_t word;
   size_t i;
+  int j;
+
+  memset(sub, 0, sizeof(sub));
+  for(i = 0; i + 8 <= len; i += 8) {
+    memcpy(&word, buf + i, sizeof(word));
+    sub[0][word & 0xFF]++;
+    sub[1][(word >> 8) & 0xFF]++;
+    sub[2][(word >> 16) & 0xFF]++;
+    sub[3][(word >> 24) & 0xFF]++;
+    sub[0][(word >> 32) & 0xFF]++;
+    sub[1][(word >> 40) & 0xFF]++;
+    sub[2][(word >> 48) & 0xFF]++;
+    sub[3][word >> 56]++;
+  }
+  for(; i < len; ++i) sub[0][buf[i]]++;
+  for(j = 0; j < 256; ++j) counts[j] += (uint64_t)sub[0][j] + sub[1][j] + sub[2][j] + sub[3][j];
+}
+
+
+void byte_histogram_counts(const unsigned char *buf, size_t len, uint64_t *counts) {
+  size_t chunk;
+
+  memset(counts, 0, sizeof(uint64_t) * 256);
+  for(; len > 0; buf += chunk, len -= chunk) {
+    chunk = len < COUNT_BLOCK_SIZE ? len : COUNT_BLOCK_SIZE;
+    count_block(buf, chunk, counts);
+  }
+}
+
+
+struct Count_slice {
+  const unsigned char *buf;
+  size_t len;
+  uint64_t counts[256];
+};
+
+static void *count_slice_thread(void *arg) {
+  struct Count_slice *slice = arg;
+
+  byte_histogram_counts(slice->buf, slice->len, slice->counts);
+  return NULL;
+}
+
+
+int byte_histogram_counts_parallel(const unsigned char *buf, size_t len, uint64_t *counts, unsigned int threads) {
+  struct Count_slice *slices;
+  pthread_t *tids;
+  size_t slice_len;
+  unsigned int i, started;
+  int j;
+
+  if(threads > len / MIN_SLICE_SIZE) threads = len / MIN_SLICE_SIZE;
+  if(threads <= 1) {
+    byte_histogram_counts(buf, len, counts);
+    return 0;
+  }
+  slices = malloc(sizeof(struct Count_slice) * threads);
+  tids = malloc(sizeof(pthread_t) * threads);
+  if(!slices || !tids) {
+    free(slices);
+    free(tids);
+    byte_histogram_counts(buf, len, counts);
+    return 0;
+  }
+  slice_len = len / threads;
+  for(i = 0; i < threads; ++i) {
+    slices[i].buf = buf + i * slice_len;
+    slices[i].len = i + 1 < threads ? slice_len : len - i * slice_len;
+  }
+  /* Slice 0 is counted by the calling thread. */
+  for(started = 1; started < threads; ++started) {
+    if(pthread_create(&tids[started], NULL, count_slice_thread, &slices[started]) != 0) break;
+  }
+  count_slice_thread(&slices[0]);
+  memcpy(counts, slices[0].counts, sizeof(slices[0].counts));
+  for(i = 1; i < threads; ++i) {
+    if(i < started) {
+      pthread_join(tids[i], NULL);
+    } else {
+      count_slice_thread(&slices[i]);
+    }
+    for(j = 0; j < 256; ++j) counts[j] += slices[i].counts[j];
+  }
+  free(slices);
+  free(tids);
+  return started > 1 ? 0 : -1;
+}
+
+
+double normalise_histogram(const uint64_t *counts, double *hist) {
+  uint64_t max = 0;
+  int i;
 
   assert(hist != NULL);
-  for(i = 0; i < 256; ++i) hist[i] = 0;
-  for(i = 0; i < len; ++i) hist[buf[i]]++;
-  max = 0;
   for(i = 0; i < 256; ++i) {
-    if(hist[i] > max) max = hist[i];
+    if(counts[i] > max) max = counts[i];
   }
-  if(max > 0) {
-    for(i = 0; i < 256; ++i) hist[i] /= max;
+  for(i = 0; i < 256; ++i) {
+    hist[i] = max > 0 ? (double)counts[i] / max : 0;
   }
   return max;
 }
 
 
 double simple_histogram(unsigned char *buf, size_t len, double *hist) {
+  uint64_t counts[256];
+
+  if(hist == NULL) {
+    hist = malloc(sizeof(double) * 256);
+    if(!hist) return -1;
+  }
+  byte_histogram_counts(buf, len, counts);
+  return normalise_histogram(counts, hist);
+}
+
+
+double simple_histogram_parallel(unsigned char *buf, size_t len, double *hist, unsigned int threads) {
+  uint64_t counts[256];
+
   if(hist == NULL) {
     hist = malloc(sizeof(double) * 256);
     if(!hist) return -1;
   }
-  return simple_histogram_internal(buf, len, hist);
+  byte_histogram_counts_parallel(buf, len, counts, threads);
+  return normalise_histogram(counts, hist);
+}
+
+
+/* Recompute the entropy sum now and then to stop rounding drift. */
+#define SLIDING_RESYNC_INTERVAL (1UL << 24)
+
+int sliding_histogram_init(sliding_histogram_t *sh, size_t window) {
+  size_t c;
+
+  if(window < 1 || window > UINT32_MAX) return -1;
+  memset(sh, 0, sizeof(*sh));
+  sh->window = window;
+  sh->clogc = malloc(sizeof(double) * (window + 1));
+  if(!sh->clogc) return -1;
+  sh->clogc[0] = 0;
+  for(c = 1; c <= window; ++c) sh->clogc[c] = c * log2((double)c);
+  return 0;
+}
+
+
+void sliding_histogram_free(sliding_histogram_t *sh) {
+  free(sh->clogc);
+  sh->clogc = NULL;
+}
+
+
+static void sliding_histogram_resync(sliding_histogram_t *sh) {
+  int i;
+
+  sh->sum_clogc = 0;
+  for(i = 0; i < 256; ++i) sh->sum_clogc += sh->clogc[sh->counts[i]];
+  sh->updates = 0;
+}
+
+
+void sliding_histogram_add(sliding_histogram_t *sh, unsigned char in) {
+  uint32_t c = sh->counts[in]++;
+
+  assert(sh->fill < sh->window);
+  sh->sum_clogc += sh->clogc[c + 1] - sh->clogc[c];
+  sh->fill++;
+}
+
+
+void sliding_histogram_slide(sliding_histogram_t *sh, unsigned char out, unsigned char in) {
+  uint32_t c;
+
+  if(out == in) return;
+  c = sh->counts[out]--;
+  sh->sum_clogc += sh->clogc[c - 1] - sh->clogc[c];
+  c = sh->counts[in]++;
+  sh->sum_clogc += sh->clogc[c + 1] - sh->clogc[c];
+  if(++sh->updates >= SLIDING_RESYNC_INTERVAL) sliding_histogram_resync(sh);
+}
+
+
+double sliding_histogram_entropy(const sliding_histogram_t *sh) {
+  double h;
+
+  if(sh->fill == 0) return 0;
+  h = log2((double)sh->fill) - sh->sum_clogc / sh->fill;
+  return h > 0 ? h : 0;
+}
+
+
+long entropy_profile(const unsigned char *buf, size_t len, size_t window, size_t stride, entropy_profile_callback callback, void *ctx) {
+  sliding_histogram_t sh;
+  size_t pos, first;
+  long reported = 1;
+
+  if(stride < 1 || sliding_histogram_init(&sh, window) != 0) return -1;
+  first = len < window ? len : window;
+  for(pos = 0; pos < first; ++pos) sliding_histogram_add(&sh, buf[pos]);
+  callback(0, &sh, ctx);
+  for(pos = window; pos < len; ++pos) {
+    sliding_histogram_slide(&sh, buf[pos - window], buf[pos]);
+    if((pos - window + 1) % stride == 0) {
+      callback(pos - window + 1, &sh, ctx);
+      ++reported;
+    }
+  }
+  sliding_histogram_free(&sh);
+  return reported;
 }
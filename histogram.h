@@ -25,6 +25,108 @@ extern "C" {
    */
   double simple_histogram(unsigned char *buf, size_t len, double *hist);
 
+  /*! \brief Like simple_histogram() but counting on several threads.
+   *
+   * The buffer is split into one slice per thread. Small buffers are
+   * counted on fewer threads.
+   *
+   * \param buf pointer to array of bytes
+   * \param len length of the array
+   * \param hist pointer to an array of 256 doubles or NULL
+   * \param threads maximum number of threads to use
+   * \return maximum value in the histogram or -1 on error
+   */
+  double simple_histogram_parallel(unsigned char *buf, size_t len, double *hist, unsigned int threads);
+
+  /*! \brief Count the byte values.
+   *
+   * Counting is done into several interleaved 32 bit sub-histograms
+   * so that runs of equal bytes do not serialise on a single
+   * counter. The sub-histograms are summed up at the end.
+   *
+   * \param buf pointer to array of bytes
+   * \param len length of the array
+   * \param counts pointer to an array of 256 counters, overwritten
+   */
+  void byte_histogram_counts(const unsigned char *buf, size_t len, uint64_t *counts);
+
+  /*! \brief Count the byte values on several threads.
+   *
+   * \param buf pointer to array of bytes
+   * \param len length of the array
+   * \param counts pointer to an array of 256 counters, overwritten
+   * \param threads maximum number of threads to use
+   * \return 0 on success, -1 if no thread could be started
+   */
+  int byte_histogram_counts_parallel(const unsigned char *buf, size_t len, uint64_t *counts, unsigned int threads);
+
+  /*! \brief Normalise counts to the maximum.
+   *
+   * \param counts pointer to an array of 256 counters
+   * \param hist pointer to an array of 256 doubles
+   * \return maximum value in the histogram
+   */
+  double normalise_histogram(const uint64_t *counts, double *hist);
+
+  /*! \brief Running histogram over a sliding window of bytes.
+   *
+   * Besides the counts, the sum of c * log2(c) over all bins is kept
+   * up to date so that the Shannon entropy of the window is available
+   * in O(1) after every slide.
+   */
+  typedef struct Sliding_Histogram {
+    size_t window; //!< window size in bytes
+    size_t fill; //!< number of bytes currently in the window
+    uint32_t counts[256];
+    double sum_clogc; //!< sum of c * log2(c) over all bins
+    double *clogc; //!< table of c * log2(c) for c in [0..window]
+    unsigned long updates; //!< slides since the sum was last recomputed
+  } sliding_histogram_t;
+
+  /*! \brief Initialise an empty sliding histogram.
+   *
+   * \param sh pointer to the structure to initialise
+   * \param window window size in bytes, at least 1
+   * \return 0 on success, -1 on error
+   */
+  int sliding_histogram_init(sliding_histogram_t *sh, size_t window);
+
+  /*! \brief Release the memory held by a sliding histogram. */
+  void sliding_histogram_free(sliding_histogram_t *sh);
+
+  /*! \brief Add a byte while the window is not yet full. */
+  void sliding_histogram_add(sliding_histogram_t *sh, unsigned char in);
+
+  /*! \brief Move the full window by one byte.
+   *
+   * \param sh sliding histogram
+   * \param out byte leaving the window
+   * \param in byte entering the window
+   */
+  void sliding_histogram_slide(sliding_histogram_t *sh, unsigned char out, unsigned char in);
+
+  /*! \brief Shannon entropy of the current window in bits per byte. */
+  double sliding_histogram_entropy(const sliding_histogram_t *sh);
+
+  typedef void (*entropy_profile_callback)(size_t offset, const sliding_histogram_t *sh, void *ctx);
+
+  /*! \brief Calculate the entropy profile of a buffer in one pass.
+   *
+   * The callback is invoked for the windows starting at offsets 0,
+   * stride, 2 * stride and so on that fit completely into the
+   * buffer. A buffer shorter than the window yields a single call for
+   * the whole buffer.
+   *
+   * \param buf pointer to array of bytes
+   * \param len length of the array
+   * \param window window size in bytes
+   * \param stride distance between reported windows
+   * \param callback called with the offset and the window histogram
+   * \param ctx passed through to the callback
+   * \return number of windows reported or -1 on error
+   */
+  long entropy_profile(const unsigned char *buf, size_t len, size_t window, size_t stride, entropy_profile_callback callback, void *ctx);
+
 #ifdef __cplusplus
 };
 #endif
@@ -1,4 +1,6 @@
 #include <inttypes.h>
+#include <getopt.h>
+#include <stdlib.h>
 #include <iostream>
 #include <string>
 #include <map>
@@ -9,17 +11,47 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include "fileformat.hh"
+#include "histogram-runs.hh"
+#include "stats.h"
 
 using namespace std;
 
-typedef map<vector<uint8_t>,unsigned long int> Histogram_type;
+/*! \brief Rough heap usage of one histogram entry
+ *
+ * Map node with key vector and the separately allocated n-gram
+ * bytes. Only used to decide when to spill.
+ */
+static size_t entry_cost(unsigned int n) {
+  return sizeof(Histogram_type::value_type) + 4 * sizeof(void*) + ((n + 15) & ~15U);
+}
+
+struct Spill_params {
+  size_t memory_limit; //!< in bytes, 0 means no limit
+  string tmpdir;
+};
+
+/*! \brief Write the histogram as a sorted binary run and clear it */
+static FILE *spill_run(Histogram_type &histogram, unsigned int n, const Spill_params &params) {
+  FILE *run = create_run_file(params.tmpdir);
+  Binary_histogram_writer writer(run, n, Header_type());
 
-Histogram_type create_histogram(unsigned int n, istream &inp) {
+  for(auto &i : histogram) writer.write(i.first, i.second);
+  writer.flush();
+  rewind(run);
+  histogram.clear();
+  return run;
+}
+
+Histogram_type create_histogram(unsigned int n, istream &inp, const Spill_params &params, vector<FILE*> &runs) {
   string line;
-  map<vector<uint8_t>,unsigned long int> histogram;
-  
+  Histogram_type histogram;
+  size_t max_entries = max(params.memory_limit / entry_cost(n), static_cast<size_t>(1));
+  uint64_t bytes = 0, lines = 0;
+
   auto read_line = bind(read_ngram_line, n, std::placeholders::_1);
-  while(getline(cin, line)) {
+  while(getline(inp, line)) {
+    bytes += line.size() + 1;
+    ++lines;
     try {
       istringstream sin(line);
       vector<uint8_t> ngrams(read_line(sin));
@@ -29,25 +61,72 @@ Histogram_type create_histogram(unsigned int n, istream &inp) {
       cerr << "Error in line '" << line << "': " << excp.what() << endl;
       throw;
     }
+    if(params.memory_limit > 0 && histogram.size() >= max_entries) {
+      runs.push_back(spill_run(histogram, n, params));
+    }
+  }
+  if(!runs.empty() && !histogram.empty()) {
+    runs.push_back(spill_run(histogram, n, params));
   }
+  stats_add(bytes, lines);
+  stats_count("spilled runs", runs.size());
   return histogram;
 }
 
 int main(int argc, char **argv) {
+  Spill_params params = { 0 };
+  bool binary = false;
+  int opt;
+
+  if(stats_init(&argc, argv, "histogramify") != 0) exit(EXIT_FAILURE);
+  while((opt = getopt(argc, argv, "m:T:b")) != -1) {
+    switch(opt) {
+    case 'm':
+      params.memory_limit = boost::lexical_cast<size_t>(optarg) << 20;
+      break;
+    case 'T':
+      params.tmpdir = optarg;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    default: /* '?' */
+      fprintf(stderr, "Usage: %s [-m memory-limit-MiB] [-T tmpdir] [-b] [--stats[=json]]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  stats_phase("count");
   auto header(read_header(cin));
   if(header.at("type") == "n-grams") {
     header["type"] = "n-grams histogram";
-    Histogram_type histogram(create_histogram(boost::lexical_cast<unsigned int>(header.at("n")), cin));
-    for(auto i : header) {
-      cout << '#' << i.first << ": " << i.second << '\n';
+    unsigned int n = boost::lexical_cast<unsigned int>(header.at("n"));
+    vector<FILE*> runs;
+    Histogram_type histogram(create_histogram(n, cin, params, runs));
+    unique_ptr<Binary_histogram_writer> writer;
+    uint64_t entries;
+
+    stats_phase("write");
+    if(binary) {
+      writer.reset(new Binary_histogram_writer(stdout, n, header));
+    } else {
+      write_histogram_header(cout, header);
     }
-    cout << endl;
-    for(auto i : histogram) {
-      cout << hex;
-      for(auto j : i.first) cout << ' ' << setw(2) << static_cast<unsigned int>(j);
-      cout << boost::format("\t $%06lX %8ld\n") % i.second % i.second;
+    auto sink = [&writer](const Ngram_type &ngram, uint64_t count) {
+      if(writer) writer->write(ngram, count); else write_histogram_entry(cout, ngram, count);
+    };
+    if(runs.empty()) {
+      for(auto i : histogram) sink(i.first, i.second);
+      entries = histogram.size();
+    } else {
+      cerr << "Merging " << runs.size() << " spilled runs" << endl;
+      vector<unique_ptr<Histogram_source> > sources;
+      for(auto run : runs) sources.emplace_back(new Binary_histogram_source(run, "run"));
+      entries = merge_histograms(sources, sink, params.tmpdir);
     }
-    cerr << "Histogram entries " << histogram.size() << endl;
+    if(writer) writer->flush();
+    cout.flush();
+    stats_add(0, entries);
+    cerr << "Histogram entries " << dec << entries << endl;
   } else {
     cerr << "Unknown input type!\n";
     return 1;
@@ -0,0 +1,92 @@
+/*! \brief histomerge: merge n-gram histograms
+ *
+ * Merges histogram files (text or binary) produced by histogramify
+ * in a streaming k-way merge, summing the counts of equal n-grams.
+ * More than HISTOGRAM_MERGE_FAN_IN inputs are opened and merged group
+ * wise into temporary runs first.
+ */
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "histogram-runs.hh"
+#include "stats.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  bool binary = false;
+  string tmpdir;
+  int opt;
+
+  if(stats_init(&argc, argv, "histomerge") != 0) exit(EXIT_FAILURE);
+  while((opt = getopt(argc, argv, "bT:")) != -1) {
+    switch(opt) {
+    case 'b':
+      binary = true;
+      break;
+    case 'T':
+      tmpdir = optarg;
+      break;
+    default: /* '?' */
+      fprintf(stderr, "Usage: %s [-b] [-T tmpdir] [--stats[=json]] <histogram files...>\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "Usage: %s [-b] [-T tmpdir] [--stats[=json]] <histogram files...>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  try {
+    vector<unique_ptr<Histogram_source> > sources;
+    Header_type header;
+    unsigned int n = 0;
+    bool same_fname = true;
+    int files = argc - optind;
+    stats_phase("merge");
+    for(int i = optind; i < argc; i += HISTOGRAM_MERGE_FAN_IN) {
+      vector<unique_ptr<Histogram_source> > group;
+      for(int j = i; j < argc && static_cast<size_t>(j - i) < HISTOGRAM_MERGE_FAN_IN; ++j) {
+	group.push_back(open_histogram(argv[j]));
+	const Header_type &source_header(group.back()->get_header());
+	if(j == optind) {
+	  header = source_header;
+	  n = group.back()->get_n();
+	} else if(group.back()->get_n() != n) {
+	  throw runtime_error("histograms have different n");
+	}
+	auto fname = source_header.find("fname");
+	if(fname == source_header.end() || fname->second != header["fname"]) same_fname = false;
+      }
+      if(static_cast<size_t>(files) <= HISTOGRAM_MERGE_FAN_IN) sources.swap(group);
+      else sources.push_back(merge_to_run(group, tmpdir));
+    }
+    header["type"] = "n-grams histogram";
+    header["n"] = boost::lexical_cast<string>(n);
+    if(!same_fname) header.erase("fname");
+    header["files"] = boost::lexical_cast<string>(files);
+    unique_ptr<Binary_histogram_writer> writer;
+    if(binary) {
+      writer.reset(new Binary_histogram_writer(stdout, n, header));
+    } else {
+      write_histogram_header(cout, header);
+    }
+    uint64_t entries = merge_histograms(sources, [&writer](const Ngram_type &ngram, uint64_t count) {
+	if(writer) writer->write(ngram, count); else write_histogram_entry(cout, ngram, count);
+      }, tmpdir);
+    if(writer) writer->flush();
+    cout.flush();
+    stats_add(0, entries);
+    cerr << "Histogram entries " << dec << entries << endl;
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error! Exception: " << excp.what() << endl;
+    return 1;
+  }
+  return 0;
+}
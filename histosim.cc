@@ -0,0 +1,498 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "fileformat.hh"
+#include "parallel.hh"
+#include "stats.h"
+
+enum class Metric { COSINE, CHI2, JS };
+enum class Output_format { CSV, RAW, NPY };
+
+struct CLIParams {
+  unsigned int jobs;
+  Metric metric;
+  Output_format format;
+  unsigned int top_k; //!< 0 writes the whole matrix
+  bool sparse;
+};
+
+static const size_t DIMENSIONS = 65536;
+//! Rows per tile and floats per chunk, the chunks of two tiles (128 KiB) stay in L2.
+static const size_t TILE = 8;
+static const size_t CHUNK = 2048;
+
+//! SSE2 width, which every x86-64 has, wider vectors change the ABI without -mavx.
+typedef float v2sf __attribute__((vector_size(8)));
+typedef double v2df __attribute__((vector_size(16)));
+typedef long long v2di __attribute__((vector_size(16)));
+
+/*! \brief Normalised 2-gram histograms of all files
+ *
+ * Every row holds the relative frequencies as float32, either dense
+ * (65536 floats per row, 64 byte aligned) or sparse (sorted cells).
+ * All three metrics are a sum of a term per cell:
+ *
+ *   cosine  1/2 sum((p/|p| - q/|q|)^2)  (= 1 - sum(p q) / (|p| |q|))
+ *   chi2    1/2 sum((p - q)^2 / (p + q))
+ *   js      1/2 sum(p log2(2p / (p + q)) + q log2(2q / (p + q)))
+ *
+ * They are summed directly instead of as 1 - sum(...), which would
+ * cancel for the near-duplicates. A cell of only one row adds
+ * (p/|p|)^2 to the cosine and p to the others.
+ */
+class Matrix {
+  struct Free { void operator()(float *ptr) const { free(ptr); } };
+  std::unique_ptr<float, Free> dense;
+  std::vector<uint32_t> offsets;
+  std::vector<uint16_t> columns;
+  std::vector<float> values;
+public:
+  typedef std::vector<std::pair<uint16_t, float> > Row;
+
+  size_t rows;
+  bool sparse;
+  std::vector<std::string> names;
+  std::vector<double> norms; //!< L2 norm per row
+
+  Matrix(size_t rows_, bool sparse_) : rows(0), sparse(sparse_) {
+    if(!sparse) {
+      dense.reset(static_cast<float*>(aligned_alloc(64, rows_ * DIMENSIONS * sizeof(float))));
+      if(!dense) throw std::bad_alloc();
+    }
+    offsets.push_back(0);
+  }
+  void append(const std::string &name, const Row &row) {
+    double norm = 0;
+
+    if(sparse) {
+      for(auto &cell : row) {
+	columns.push_back(cell.first);
+	values.push_back(cell.second);
+      }
+      offsets.push_back(columns.size());
+    } else {
+      float *dst = dense.get() + rows * DIMENSIONS;
+      memset(dst, 0, DIMENSIONS * sizeof(float));
+      for(auto &cell : row) dst[cell.first] = cell.second;
+    }
+    for(auto &cell : row) norm += static_cast<double>(cell.second) * cell.second;
+    norms.push_back(sqrt(norm));
+    names.push_back(name);
+    ++rows;
+  }
+  const float *row(size_t i) const { return dense.get() + i * DIMENSIONS; }
+  size_t cells(size_t i) const { return offsets[i + 1] - offsets[i]; }
+  const uint16_t *row_columns(size_t i) const { return columns.data() + offsets[i]; }
+  const float *row_values(size_t i) const { return values.data() + offsets[i]; }
+};
+
+
+/* The js term of a cell is (p + q)/2 B(d) / ln 2 with d = (p - q)/(p + q) and
+ *
+ *   B(d) = (1 + d) ln(1 + d) + (1 - d) ln(1 - d) = sum d^2k / (k (2k - 1))
+ *
+ * The series is used for d^2 < 1/16, where the logarithms would cancel
+ * to d^2, and converges to double precision in 13 terms.
+ */
+static const double JS_SERIES_LIMIT = 1.0 / 16;
+
+template<class T>
+static inline T js_series(T x) {
+  T sum = x * 0 + 1.0 / (13 * 25);
+
+  for(int k = 12; k >= 1; --k) sum = sum * x + 1.0 / (k * (2 * k - 1));
+  return sum * x;
+}
+
+static inline double js_term(double p, double q) {
+  double m = p + q, d, a, b;
+
+  if(m <= 0) return 0;
+  d = (p - q) / m;
+  if(d * d < JS_SERIES_LIMIT) return 0.5 * m * js_series(d * d) / M_LN2;
+  a = 2 * p / m;
+  b = 2 * q / m;
+  return 0.5 * m * ((a > 0 ? a * log(a) : 0) + (b > 0 ? b * log(b) : 0)) / M_LN2;
+}
+
+static inline double chi2_term(double p, double q) {
+  double m = p + q;
+
+  return m > 0 ? (p - q) * (p - q) / m : 0;
+}
+
+/*! \brief Natural logarithm of positive normal doubles
+ *
+ * x = 2^e f with f in [sqrt(1/2), sqrt(2)), ln f = 2 atanh(t) with
+ * t = (f - 1)/(f + 1), |t| < 0.172, from its series up to t^21.
+ */
+static inline v2df log_v2df(v2df x) {
+  v2di bits = (v2di)x;
+  v2di e = ((bits >> 52) & 0x7ff) - 1023;
+  v2df f = (v2df)((bits & 0xfffffffffffffLL) | 0x3ff0000000000000LL);
+  v2di big = f > M_SQRT2;
+  v2df t, t2, sum;
+
+  f = big ? f * 0.5 : f;
+  e = big ? e + 1 : e;
+  t = (f - 1) / (f + 1);
+  t2 = t * t;
+  sum = t2 * 0 + 1.0 / 21;
+  for(int k = 9; k >= 0; --k) sum = sum * t2 + 1.0 / (2 * k + 1);
+  return __builtin_convertvector(e, v2df) * M_LN2 + 2 * t * sum;
+}
+
+static inline v2df load_v2df(const float *ptr) {
+  return __builtin_convertvector(*reinterpret_cast<const v2sf*>(ptr), v2df);
+}
+
+static inline double sum_lanes(v2df v) {
+  return v[0] + v[1];
+}
+
+/*! \brief Sum of the metric term over len dense cells (multiple of 8)
+ *
+ * The floats are widened to doubles, 2 cells at a time.
+ *
+ * \param sp,sq 1/|p| and 1/|q| for the cosine
+ */
+static double dense_sum(Metric metric, const float *p, const float *q, size_t len, double sp, double sq) {
+  v2df acc = { 0 };
+  size_t k;
+
+  switch(metric) {
+  case Metric::COSINE:
+    for(k = 0; k < len; k += 2) {
+      v2df d = load_v2df(p + k) * sp - load_v2df(q + k) * sq;
+      acc += d * d;
+    }
+    return sum_lanes(acc);
+  case Metric::CHI2:
+    for(k = 0; k < len; k += 2) {
+      v2df a = load_v2df(p + k), b = load_v2df(q + k), m = a + b;
+      //Cells empty in both rows divide 0 by 1.
+      acc += (a - b) * (a - b) / (m > 0 ? m : 1);
+    }
+    return sum_lanes(acc);
+  case Metric::JS:
+    for(k = 0; k < len; k += 2) {
+      v2df a = load_v2df(p + k), b = load_v2df(q + k), m = a + b;
+      //Most cells of 2-gram histograms are empty in both rows.
+      if(m[0] == 0 && m[1] == 0) continue;
+      v2df safe = m > 0 ? m : 1;
+      v2df d = (a - b) / safe, x = d * d;
+      v2df u = 2 * a / safe, w = 2 * b / safe;
+      v2df terms = js_series(x);
+      //The logarithms are only needed for dissimilar cells, empty ones take log(1).
+      if(x[0] >= JS_SERIES_LIMIT || x[1] >= JS_SERIES_LIMIT) {
+	v2df direct = u * log_v2df(u > 0 ? u : 1) + w * log_v2df(w > 0 ? w : 1);
+	terms = x < JS_SERIES_LIMIT ? terms : direct;
+      }
+      acc += 0.5 * safe * terms;
+    }
+    return sum_lanes(acc) / M_LN2;
+  }
+  return 0;
+}
+
+static inline double sparse_term(Metric metric, double p, double q, double sp, double sq) {
+  switch(metric) {
+  case Metric::COSINE: return (p * sp - q * sq) * (p * sp - q * sq);
+  case Metric::CHI2: return chi2_term(p, q);
+  case Metric::JS: return js_term(p, q);
+  }
+  return 0;
+}
+
+//! Term of a cell found in only one row, s is 1/|p| of that row.
+static inline double single_term(Metric metric, double p, double s) {
+  return metric == Metric::COSINE ? p * s * p * s : p;
+}
+
+/*! \brief Sum of the metric term over the cells of two sparse rows (a merge join) */
+static double sparse_sum(Metric metric, const Matrix &m, size_t i, size_t j, double si, double sj) {
+  const uint16_t *ci = m.row_columns(i), *cj = m.row_columns(j);
+  const float *vi = m.row_values(i), *vj = m.row_values(j);
+  const uint16_t *ei = ci + m.cells(i), *ej = cj + m.cells(j);
+  double sum = 0;
+
+  while(ci < ei && cj < ej) {
+    if(*ci < *cj) {
+      sum += single_term(metric, *vi, si);
+      ++ci;
+      ++vi;
+    } else if(*cj < *ci) {
+      sum += single_term(metric, *vj, sj);
+      ++cj;
+      ++vj;
+    } else {
+      sum += sparse_term(metric, *vi, *vj, si, sj);
+      ++ci, ++vi, ++cj, ++vj;
+    }
+  }
+  for(; ci < ei; ++ci, ++vi) sum += single_term(metric, *vi, si);
+  for(; cj < ej; ++cj, ++vj) sum += single_term(metric, *vj, sj);
+  return sum;
+}
+
+static float distance(Metric metric, const Matrix &m, size_t i, size_t j, double sum) {
+  double d = 1;
+
+  if(i == j) return 0;
+  switch(metric) {
+  case Metric::COSINE:
+    //Empty rows have no direction.
+    if(m.norms[i] > 0 && m.norms[j] > 0) d = 0.5 * sum;
+    break;
+  case Metric::CHI2:
+  case Metric::JS:
+    d = 0.5 * sum;
+    break;
+  }
+  return std::min(std::max(d, 0.0), 1.0);
+}
+
+//! 1/|p| of a row, 0 for empty rows.
+static inline double scale(const Matrix &m, size_t i) {
+  return m.norms[i] > 0 ? 1 / m.norms[i] : 0;
+}
+
+/*! \brief Distances between the rows of two tiles
+ *
+ * Dense rows are processed a chunk at a time, so the chunks of both
+ * tiles are reused from the cache for all TILE * TILE pairs.
+ *
+ * \param out TILE * TILE distances, row major
+ */
+static void tile_distances(Metric metric, const Matrix &m, size_t ti, size_t tj, float *out) {
+  const size_t i0 = ti * TILE, i1 = std::min(i0 + TILE, m.rows);
+  const size_t j0 = tj * TILE, j1 = std::min(j0 + TILE, m.rows);
+  double sums[TILE * TILE] = { 0 };
+
+  if(m.sparse) {
+    for(size_t i = i0; i < i1; ++i) {
+      for(size_t j = j0; j < j1; ++j) sums[(i - i0) * TILE + j - j0] = sparse_sum(metric, m, i, j, scale(m, i), scale(m, j));
+    }
+  } else {
+    for(size_t c = 0; c < DIMENSIONS; c += CHUNK) {
+      for(size_t i = i0; i < i1; ++i) {
+	const float *p = m.row(i) + c;
+	for(size_t j = j0; j < j1; ++j) sums[(i - i0) * TILE + j - j0] += dense_sum(metric, p, m.row(j) + c, CHUNK, scale(m, i), scale(m, j));
+      }
+    }
+  }
+  for(size_t i = i0; i < i1; ++i) {
+    for(size_t j = j0; j < j1; ++j) out[(i - i0) * TILE + j - j0] = distance(metric, m, i, j, sums[(i - i0) * TILE + j - j0]);
+  }
+}
+
+/*! \brief Run fun(task) for tasks [0, count) on jobs threads */
+template<class Fun>
+static void parallel_tasks(size_t count, unsigned int jobs, Fun fun) {
+  ThreadPool pool(jobs);
+  std::atomic<size_t> next(0);
+  std::vector<std::future<void> > workers;
+
+  for(size_t w = 0; w < pool.size(); ++w) {
+    workers.push_back(pool.submit([&] {
+	  for(size_t task; (task = next++) < count; ) fun(task);
+	}));
+  }
+  for(auto &worker : workers) worker.get();
+}
+
+/*! \brief All-pairs distances, only the tiles on and above the diagonal are computed */
+static std::vector<float> distance_matrix(Metric metric, const Matrix &m, unsigned int jobs) {
+  const size_t tiles = (m.rows + TILE - 1) / TILE;
+  std::vector<float> result(m.rows * m.rows);
+  std::vector<std::pair<uint32_t, uint32_t> > pairs;
+
+  for(size_t ti = 0; ti < tiles; ++ti) {
+    for(size_t tj = ti; tj < tiles; ++tj) pairs.emplace_back(ti, tj);
+  }
+  parallel_tasks(pairs.size(), jobs, [&](size_t task) {
+      float out[TILE * TILE];
+      const size_t i0 = pairs[task].first * TILE, j0 = pairs[task].second * TILE;
+
+      tile_distances(metric, m, pairs[task].first, pairs[task].second, out);
+      for(size_t i = i0; i < std::min(i0 + TILE, m.rows); ++i) {
+	for(size_t j = j0; j < std::min(j0 + TILE, m.rows); ++j) {
+	  result[i * m.rows + j] = result[j * m.rows + i] = out[(i - i0) * TILE + j - j0];
+	}
+      }
+    });
+  stats_add(0, m.rows * (m.rows - 1) / 2);
+  return result;
+}
+
+typedef std::vector<std::pair<float, uint32_t> > Neighbours;
+
+/*! \brief The k nearest rows of every row
+ *
+ * Every task owns a tile of rows and compares it against all tiles,
+ * so the bounded heaps need no locking. This costs twice the kernel
+ * work of the matrix but only O(rows * k) memory.
+ */
+static std::vector<Neighbours> nearest_neighbours(Metric metric, const Matrix &m, unsigned int jobs, unsigned int k) {
+  const size_t tiles = (m.rows + TILE - 1) / TILE;
+  std::vector<Neighbours> result(m.rows);
+
+  parallel_tasks(tiles, jobs, [&](size_t ti) {
+      float out[TILE * TILE];
+      const size_t i0 = ti * TILE;
+
+      for(size_t tj = 0; tj < tiles; ++tj) {
+	tile_distances(metric, m, ti, tj, out);
+	for(size_t i = i0; i < std::min(i0 + TILE, m.rows); ++i) {
+	  Neighbours &heap = result[i];
+	  for(size_t j = tj * TILE; j < std::min(tj * TILE + TILE, m.rows); ++j) {
+	    if(i == j) continue;
+	    std::pair<float, uint32_t> entry(out[(i - i0) * TILE + j - tj * TILE], j);
+	    if(heap.size() < k) {
+	      heap.push_back(entry);
+	      std::push_heap(heap.begin(), heap.end());
+	    } else if(entry < heap.front()) {
+	      std::pop_heap(heap.begin(), heap.end());
+	      heap.back() = entry;
+	      std::push_heap(heap.begin(), heap.end());
+	    }
+	  }
+	}
+      }
+      for(size_t i = i0; i < std::min(i0 + TILE, m.rows); ++i) std::sort_heap(result[i].begin(), result[i].end());
+    });
+  stats_add(0, m.rows * (m.rows - 1));
+  return result;
+}
+
+
+static void put_le(char *dst, uint64_t val, int bytes) {
+  for(int i = 0; i < bytes; ++i) dst[i] = (val >> (8 * i)) & 0xFF;
+}
+
+static void write_matrix(const Matrix &m, const std::vector<float> &result, Output_format format) {
+  std::string row;
+  char buf[32];
+  uint32_t bits;
+
+  if(format == Output_format::NPY) std::cout << npy_header("<f4", m.rows, m.rows);
+  for(size_t i = 0; i < m.rows; ++i) {
+    if(format == Output_format::CSV) {
+      row = m.names[i];
+      for(size_t j = 0; j < m.rows; ++j) {
+	row += '\t';
+	row.append(buf, snprintf(buf, sizeof(buf), "%g", result[i * m.rows + j]));
+      }
+      row += '\n';
+    } else {
+      row.assign(4 * m.rows, '\0');
+      for(size_t j = 0; j < m.rows; ++j) {
+	memcpy(&bits, &result[i * m.rows + j], sizeof(bits));
+	put_le(&row[4 * j], bits, 4);
+      }
+    }
+    std::cout.write(row.data(), row.size());
+  }
+}
+
+static CLIParams cli_parse(int argc, char **argv) {
+  CLIParams params = { 0, Metric::COSINE, Output_format::CSV, 0, false };
+  int opt;
+
+  while((opt = getopt(argc, argv, "j:m:f:k:s")) != -1) {
+    switch(opt) {
+    case 'j':
+      params.jobs = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'm':
+      if(strcmp(optarg, "cosine") == 0) params.metric = Metric::COSINE;
+      else if(strcmp(optarg, "chi2") == 0) params.metric = Metric::CHI2;
+      else if(strcmp(optarg, "js") == 0) params.metric = Metric::JS;
+      else throw std::invalid_argument(std::string("unknown metric ") + optarg);
+      break;
+    case 'f':
+      if(strcmp(optarg, "csv") == 0) params.format = Output_format::CSV;
+      else if(strcmp(optarg, "raw") == 0) params.format = Output_format::RAW;
+      else if(strcmp(optarg, "npy") == 0) params.format = Output_format::NPY;
+      else throw std::invalid_argument(std::string("unknown format ") + optarg);
+      break;
+    case 'k':
+      params.top_k = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 's':
+      params.sparse = true;
+      break;
+    default:
+      throw std::invalid_argument("bad option");
+    }
+  }
+  return params;
+}
+
+int main(int argc, char **argv) {
+  CLIParams params = { 0, Metric::COSINE, Output_format::CSV, 0, false };
+
+  if(stats_init(&argc, argv, "histosim") != 0) return 1;
+  try {
+    params = cli_parse(argc, argv);
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Error: " << excp.what() << '\n';
+    optind = argc;
+  }
+  if(optind >= argc) {
+    std::cerr << "histosim [-j jobs] [-m cosine|chi2|js] [-s] [-k top | -f csv|raw|npy] [--stats[=json]] <2-gram histograms...>\n"
+	      << "Distances in [0, 1] between the normalised 2-gram histograms (histogramify output, n=2).\n"
+	      << "  -s  keep the histograms sparse (less memory for files with few distinct 2-grams)\n"
+	      << "  -k  write the top nearest files per file instead of the matrix\n";
+    return 1;
+  }
+  try {
+    stats_phase("load");
+    Matrix matrix(argc - optind, params.sparse);
+    ordered_parallel_map(&argv[optind], &argv[argc], params.jobs, [](const char *fname) {
+	uint64_t bytes;
+	Two_gram_histogram histogram(read_2gram_histogram(fname, &bytes));
+	auto fit = histogram.get_header().find("fname");
+	std::pair<std::string, Matrix::Row> row(fit != histogram.get_header().end() ? fit->second : fname, Matrix::Row());
+
+	row.second.reserve(histogram.get_cells().size());
+	for(auto &cell : histogram.get_cells()) {
+	  row.second.emplace_back(cell.first, static_cast<float>(static_cast<double>(cell.second) / histogram.get_total()));
+	}
+	stats_add(bytes, histogram.get_cells().size());
+	stats_count("files read", 1);
+	return row;
+      }, [&matrix](const std::pair<std::string, Matrix::Row> &row) {
+	matrix.append(row.first, row.second);
+      });
+    stats_phase("distances");
+    if(params.top_k > 0) {
+      std::vector<Neighbours> neighbours(nearest_neighbours(params.metric, matrix, params.jobs, params.top_k));
+      stats_phase("write");
+      for(size_t i = 0; i < matrix.rows; ++i) {
+	for(size_t r = 0; r < neighbours[i].size(); ++r) {
+	  std::cout << matrix.names[i] << '\t' << r + 1 << '\t' << matrix.names[neighbours[i][r].second] << '\t' << neighbours[i][r].first << '\n';
+	}
+      }
+    } else {
+      std::vector<float> result(distance_matrix(params.metric, matrix, params.jobs));
+      stats_phase("write");
+      write_matrix(matrix, result, params.format);
+    }
+    std::cout.flush();
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Error! Exception: " << excp.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
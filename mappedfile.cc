@@ -0,0 +1,57 @@
+#include "mappedfile.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+MappedFile::MappedFile(const char *fname_) : ptr(NULL), length(0), mapped(false), fname(fname_) {
+  struct stat buf;
+  int fd;
+
+  if(fname == "-") {
+    fd = STDIN_FILENO;
+  } else if((fd = open(fname_, O_RDONLY)) == -1) {
+    throw std::runtime_error(fname + ": " + std::strerror(errno));
+  }
+  if(fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode) && buf.st_size > 0) {
+    void *map = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED) {
+      madvise(map, buf.st_size, MADV_SEQUENTIAL);
+      ptr = static_cast<const uint8_t*>(map);
+      length = buf.st_size;
+      mapped = true;
+    }
+  }
+  try {
+    if(!mapped) read_blocks(fd);
+  }
+  catch(...) {
+    if(fd != STDIN_FILENO) close(fd);
+    throw;
+  }
+  if(fd != STDIN_FILENO) close(fd);
+}
+
+void MappedFile::read_blocks(int fd) {
+  const size_t block = 1 << 20;
+  ssize_t got;
+
+  do {
+    buffer.resize(length + block);
+    got = read(fd, &buffer[length], block);
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      throw std::runtime_error(fname + ": " + std::strerror(errno));
+    }
+    length += got;
+  } while(got != 0);
+  buffer.resize(length);
+  ptr = reinterpret_cast<const uint8_t*>(buffer.data());
+}
+
+MappedFile::~MappedFile() {
+  if(mapped) munmap(const_cast<uint8_t*>(ptr), length);
+}
@@ -0,0 +1,39 @@
+#ifndef __MAPPEDFILE_HH_2026__
+#define __MAPPEDFILE_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+
+/*! \brief Read-only view of a whole file
+ *
+ * Regular files are memory mapped. Everything else (pipes, devices,
+ * or files that can not be mapped) is read in large blocks into an
+ * internal buffer. Either way the data is available as one
+ * contiguous array for the lifetime of the object.
+ */
+class MappedFile {
+  const uint8_t *ptr;
+  size_t length;
+  bool mapped;
+  std::string buffer;
+  std::string fname;
+
+  void read_blocks(int fd);
+public:
+  /*! \brief Map a file
+   *
+   * Throws a std::runtime_error if the file can not be opened.
+   *
+   * \param fname name of the file, "-" for standard input
+   */
+  explicit MappedFile(const char *fname);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return ptr; }
+  size_t size() const { return length; }
+  const std::string &name() const { return fname; }
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "minhash.hh"
+#include <stdio.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "chunkset.hh"
+
+static const char SIGNATURE_MAGIC[8] = { 'S', 'I', 'M', 'I', 'M', 'I', 'N', 'H' };
+static const uint32_t SIGNATURE_VERSION = 1;
+static const uint32_t EMPTY_BIN = 0xFFFFFFFFU;
+static const uint64_t ROLL_BASE = 0x100000001b3ULL;
+
+std::vector<uint32_t> minhash_signature(const uint8_t *data, size_t len, unsigned int n, unsigned int k) {
+  std::vector<uint32_t> bins(k, EMPTY_BIN);
+  uint64_t base_power = 1;
+  uint64_t h = 0;
+  unsigned int i;
+
+  if(len < n || n == 0 || k == 0) return bins;
+  for(i = 0; i < n; ++i) {
+    base_power *= ROLL_BASE;
+    h = h * ROLL_BASE + data[i];
+  }
+  for(size_t pos = 0; ; ++pos) {
+    uint64_t mixed = mix_hash(h);
+    uint32_t bin = ((mixed >> 32) * k) >> 32;
+    uint32_t value = static_cast<uint32_t>(mixed);
+    if(value < bins[bin]) bins[bin] = value;
+    if(pos + n >= len) break;
+    h = h * ROLL_BASE + data[pos + n] - data[pos] * base_power;
+  }
+  //Rotation densification: borrow from the next non-empty bin, offset
+  //by the distance so borrowed values rarely collide with real ones.
+  std::vector<uint32_t> dense(bins);
+  for(i = 0; i < k; ++i) {
+    if(bins[i] != EMPTY_BIN) continue;
+    for(unsigned int d = 1; d < k; ++d) {
+      uint32_t other = bins[(i + d) % k];
+      if(other != EMPTY_BIN) {
+	dense[i] = static_cast<uint32_t>(mix_hash(static_cast<uint64_t>(other + d * 0x9e3779b97f4a7c15ULL))) & ~1U;
+	break;
+      }
+    }
+  }
+  return dense;
+}
+
+
+double minhash_similarity(const uint32_t *a, const uint32_t *b, unsigned int k) {
+  unsigned int equal = 0;
+
+  for(unsigned int i = 0; i < k; ++i) equal += a[i] == b[i];
+  return static_cast<double>(equal) / k;
+}
+
+
+static void put_le(uint8_t *dst, uint64_t val, int bytes) {
+  for(int i = 0; i < bytes; ++i) dst[i] = (val >> (8 * i)) & 0xFF;
+}
+
+static uint64_t get_le(const uint8_t *src, int bytes) {
+  uint64_t val = 0;
+  for(int i = bytes - 1; i >= 0; --i) val = (val << 8) | src[i];
+  return val;
+}
+
+
+void SignatureStore::add(const std::string &name, const std::vector<uint32_t> &signature) {
+  if(signature.size() != k) throw std::invalid_argument("signature has wrong size");
+  names.push_back(name);
+  values.insert(values.end(), signature.begin(), signature.end());
+}
+
+
+SignatureStore SignatureStore::load(const std::string &fname) {
+  uint8_t buf[32];
+  FILE *fin = fopen(fname.c_str(), "rb");
+
+  if(!fin) throw std::runtime_error(fname + ": " + std::strerror(errno));
+  try {
+    if(fread(buf, 1, 32, fin) != 32 || std::memcmp(buf, SIGNATURE_MAGIC, 8) != 0) {
+      throw std::runtime_error(fname + ": not a signature file");
+    }
+    if(get_le(buf + 8, 4) != SIGNATURE_VERSION) throw std::runtime_error(fname + ": unknown signature file version");
+    SignatureStore store(get_le(buf + 12, 4), get_le(buf + 16, 4));
+    uint64_t count = get_le(buf + 24, 8);
+    std::vector<uint8_t> record(store.k * 4);
+    std::vector<uint32_t> signature(store.k);
+    for(uint64_t i = 0; i < count; ++i) {
+      if(fread(buf, 1, 4, fin) != 4) throw std::runtime_error(fname + ": truncated signature file");
+      std::string name(get_le(buf, 4), '\0');
+      if(fread(&name[0], 1, name.size(), fin) != name.size() || fread(record.data(), 1, record.size(), fin) != record.size()) {
+	throw std::runtime_error(fname + ": truncated signature file");
+      }
+      for(unsigned int j = 0; j < store.k; ++j) signature[j] = get_le(&record[j * 4], 4);
+      store.add(name, signature);
+    }
+    fclose(fin);
+    return store;
+  }
+  catch(...) {
+    fclose(fin);
+    throw;
+  }
+}
+
+
+void SignatureStore::save(const std::string &fname) const {
+  std::vector<uint8_t> buf(32);
+  FILE *fout = fopen(fname.c_str(), "wb");
+
+  if(!fout) throw std::runtime_error(fname + ": " + std::strerror(errno));
+  std::memcpy(buf.data(), SIGNATURE_MAGIC, 8);
+  put_le(&buf[8], SIGNATURE_VERSION, 4);
+  put_le(&buf[12], n, 4);
+  put_le(&buf[16], k, 4);
+  put_le(&buf[24], names.size(), 8);
+  bool ok = fwrite(buf.data(), 1, buf.size(), fout) == buf.size();
+  for(size_t i = 0; ok && i < names.size(); ++i) {
+    buf.resize(4 + names[i].size() + 4 * k);
+    put_le(&buf[0], names[i].size(), 4);
+    std::memcpy(&buf[4], names[i].data(), names[i].size());
+    for(unsigned int j = 0; j < k; ++j) put_le(&buf[4 + names[i].size() + 4 * j], values[i * k + j], 4);
+    ok = fwrite(buf.data(), 1, buf.size(), fout) == buf.size();
+  }
+  if(fclose(fout) != 0 || !ok) throw std::runtime_error(fname + ": " + std::strerror(errno));
+}
+
+
+size_t find_similar_pairs(const SignatureStore &store, size_t first_new, unsigned int bands, double threshold, const std::function<void(size_t, size_t, double)> &sink) {
+  const unsigned int k = store.get_k();
+  std::vector<uint64_t> pairs;
+
+  if(bands == 0 || k % bands != 0) throw std::invalid_argument("number of bands must divide the signature size");
+  const unsigned int rows = k / bands;
+  //Signatures of files shorter than n carry no information.
+  std::vector<bool> empty(store.size());
+  for(size_t i = 0; i < store.size(); ++i) {
+    empty[i] = std::all_of(store.signature(i), store.signature(i) + k, [](uint32_t v) { return v == EMPTY_BIN; });
+  }
+  for(unsigned int band = 0; band < bands; ++band) {
+    std::unordered_map<uint64_t,std::vector<uint32_t> > buckets;
+    for(size_t i = 0; i < store.size(); ++i) {
+      const uint32_t *sig = store.signature(i) + band * rows;
+      if(empty[i]) continue;
+      uint64_t h = band;
+      for(unsigned int r = 0; r < rows; ++r) h = mix_hash(h ^ sig[r]) + r;
+      buckets[h].push_back(i);
+    }
+    for(auto &bucket : buckets) {
+      auto &members(bucket.second);
+      for(size_t a = 0; a < members.size(); ++a) {
+	for(size_t b = a + 1; b < members.size(); ++b) {
+	  if(members[b] < first_new) continue;
+	  pairs.push_back(static_cast<uint64_t>(members[a]) << 32 | members[b]);
+	}
+      }
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+  for(auto pair : pairs) {
+    size_t i = pair >> 32, j = pair & 0xFFFFFFFFU;
+    double similarity = minhash_similarity(store.signature(i), store.signature(j), k);
+    if(similarity >= threshold) sink(i, j, similarity);
+  }
+  return pairs.size();
+}
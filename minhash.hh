@@ -0,0 +1,69 @@
+#ifndef __MINHASH_HH_2026__
+#define __MINHASH_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*! \brief MinHash signature of the n-gram set of a file
+ *
+ * One permutation hashing: every n-gram is hashed once with a rolling
+ * hash, the hash selects one of k bins and the minimum per bin is
+ * kept. Empty bins are filled from the next non-empty bin (rotation
+ * densification), so signatures of small files stay comparable.
+ *
+ * \param data file data
+ * \param len length of the data
+ * \param n n-gram length
+ * \param k number of bins (signature length)
+ * \return k values, all 0xFFFFFFFF if the data is shorter than n
+ */
+std::vector<uint32_t> minhash_signature(const uint8_t *data, size_t len, unsigned int n, unsigned int k);
+
+/*! \brief Estimate the Jaccard similarity from two signatures */
+double minhash_similarity(const uint32_t *a, const uint32_t *b, unsigned int k);
+
+/*! \brief Collection of named signatures which can be persisted
+ *
+ * File format: magic "SIMIMINH", version, n, k, reserved (32 bit),
+ * count (64 bit), then per entry a 32 bit name length, the name and k
+ * 32 bit values, all little endian.
+ */
+class SignatureStore {
+  unsigned int n;
+  unsigned int k;
+  std::vector<std::string> names;
+  std::vector<uint32_t> values;
+public:
+  SignatureStore(unsigned int n_, unsigned int k_) : n(n_), k(k_) { }
+  /*! \brief Load a store, throws std::runtime_error on errors */
+  static SignatureStore load(const std::string &fname);
+  void save(const std::string &fname) const;
+
+  unsigned int get_n() const { return n; }
+  unsigned int get_k() const { return k; }
+  size_t size() const { return names.size(); }
+  const std::string &name(size_t idx) const { return names[idx]; }
+  const uint32_t *signature(size_t idx) const { return &values[idx * k]; }
+  void add(const std::string &name, const std::vector<uint32_t> &signature);
+};
+
+/*! \brief Find similar pairs with LSH banding
+ *
+ * The signatures are cut into bands; entries whose band values agree
+ * in at least one band become candidates, which are then checked
+ * against the threshold using the full signature. Only pairs with at
+ * least one member at index first_new or later are considered, which
+ * allows comparing new files against an existing corpus.
+ *
+ * \param store signatures
+ * \param first_new index of the first new signature
+ * \param bands number of bands, must divide k
+ * \param threshold minimum estimated Jaccard similarity
+ * \param sink called with (i, j, similarity), i < j, in ascending order
+ * \return number of candidate pairs checked
+ */
+size_t find_similar_pairs(const SignatureStore &store, size_t first_new, unsigned int bands, double threshold, const std::function<void(size_t, size_t, double)> &sink);
+
+#endif
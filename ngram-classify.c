@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ngram-classify.h"
+
+/* Number of n-gram positions whose indices are computed before probing the models. */
+#define CLASSIFY_BLOCK 1024
+/* How many indices ahead the bits are prefetched. */
+#define PREFETCH_DISTANCE 16
+
+ngram_model_set_t *create_ngram_model_set(void) {
+  return calloc(1, sizeof(ngram_model_set_t));
+}
+
+
+int ngram_model_set_add(ngram_model_set_t *set, const char *fname) {
+  ngram_storage_t *storage;
+  int capacity;
+  void *ptr;
+
+  storage = open_ngram_storage_readonly(fname);
+  if(!storage) return -1;
+  if(set->count > 0 && (storage->gram_max != set->gram_max || storage->n != set->n)) {
+    close_ngram_storage_readonly(storage);
+    errno = EINVAL;
+    return -1;
+  }
+  if(set->count == set->capacity) {
+    capacity = set->capacity ? 2 * set->capacity : 16;
+    ptr = realloc(set->models, capacity * sizeof(ngram_storage_t*));
+    if(ptr) set->models = ptr;
+    ptr = ptr ? realloc(set->names, capacity * sizeof(char*)) : NULL;
+    if(ptr) set->names = ptr;
+    ptr = ptr ? realloc(set->hits, capacity * sizeof(uint64_t)) : NULL;
+    if(!ptr) {
+      close_ngram_storage_readonly(storage);
+      errno = ENOMEM;
+      return -1;
+    }
+    set->hits = ptr;
+    set->capacity = capacity;
+  }
+  set->gram_max = storage->gram_max;
+  set->n = storage->n;
+  set->models[set->count] = storage;
+  set->names[set->count] = strdup(fname);
+  set->hits[set->count] = 0;
+  return set->count++;
+}
+
+
+int ngram_classify(ngram_model_set_t *set, const uint8_t *data, size_t len, int fold, size_t window, ngram_window_callback callback, void *ctx) {
+  const uint8_t *table = NULL;
+  uint64_t index[CLASSIFY_BLOCK];
+  uint64_t *window_hits;
+  uint64_t window_probes = 0;
+  uint64_t radix, lead, idx, hits;
+  size_t positions, pos, end, p, cnt, j, invalid_until = 0;
+  unsigned int b;
+  int i, m, n;
+
+  if(set->count == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if(fold) {
+    table = set->models[0]->last_fold_tranform_table;
+    for(m = 1; m < set->count; ++m) {
+      if(memcmp(table, set->models[m]->last_fold_tranform_table, 256) != 0) {
+	errno = EINVAL;
+	return -1;
+      }
+    }
+  }
+  memset(set->hits, 0, set->count * sizeof(uint64_t));
+  set->probes = 0;
+  n = set->n;
+  if(len < (size_t)n) return 0;
+  window_hits = calloc(set->count, sizeof(uint64_t));
+  if(!window_hits) return -1;
+  radix = set->gram_max + 1;
+  for(lead = 1, i = 1; i < n; ++i) lead *= radix;
+#define SYMBOL(q) (table ? table[data[q]] : data[q])
+  //idx holds the first n - 1 symbols of the n-gram at pos.
+  for(idx = 0, p = 0; p + 1 < (size_t)n; ++p) {
+    b = SYMBOL(p);
+    if(b > set->gram_max) invalid_until = p + 1;
+    idx = idx * radix + b;
+  }
+  positions = len - n + 1;
+  for(pos = 0; pos < positions; pos = end) {
+    end = pos + CLASSIFY_BLOCK < positions ? pos + CLASSIFY_BLOCK : positions;
+    if(window > 0 && end > (pos / window + 1) * window) end = (pos / window + 1) * window;
+    //Compute the indices of the block once...
+    for(cnt = 0, p = pos; p < end; ++p) {
+      if(p > 0) idx -= SYMBOL(p - 1) * lead;
+      b = SYMBOL(p + n - 1);
+      if(b > set->gram_max) invalid_until = p + n;
+      idx = idx * radix + b;
+      if(p >= invalid_until) index[cnt++] = idx;
+    }
+    //...and probe every model with them.
+    for(m = 0; m < set->count; ++m) {
+      const uint8_t *bits = set->models[m]->bits;
+      for(hits = 0, j = 0; j < cnt; ++j) {
+	if(j + PREFETCH_DISTANCE < cnt) __builtin_prefetch(bits + (index[j + PREFETCH_DISTANCE] >> 3));
+	hits += (bits[index[j] >> 3] >> (index[j] & 7)) & 1;
+      }
+      window_hits[m] += hits;
+      set->hits[m] += hits;
+    }
+    set->probes += cnt;
+    window_probes += cnt;
+    if(window > 0 && (end % window == 0 || end == positions)) {
+      if(callback) callback((end - 1) / window * window, window_probes, window_hits, ctx);
+      memset(window_hits, 0, set->count * sizeof(uint64_t));
+      window_probes = 0;
+    }
+  }
+#undef SYMBOL
+  free(window_hits);
+  return 0;
+}
+
+
+int ngram_model_set_classify(ngram_model_set_t *set, const char *data, size_t len, int fold) {
+  return ngram_classify(set, (const uint8_t*)data, len, fold, 0, NULL, NULL);
+}
+
+
+double ngram_model_set_ratio(const ngram_model_set_t *set, int model) {
+  if(model < 0 || model >= set->count || set->probes == 0) return 0;
+  return (double)set->hits[model] / set->probes;
+}
+
+
+const char *ngram_model_set_name(const ngram_model_set_t *set, int model) {
+  if(model < 0 || model >= set->count) return NULL;
+  return set->names[model];
+}
+
+
+int ngram_model_set_size(const ngram_model_set_t *set) {
+  return set->count;
+}
+
+
+void close_ngram_model_set(ngram_model_set_t *set) {
+  int i;
+
+  for(i = 0; i < set->count; ++i) {
+    close_ngram_storage_readonly(set->models[i]);
+    free(set->names[i]);
+  }
+  free(set->models);
+  free(set->names);
+  free(set->hits);
+  free(set);
+}
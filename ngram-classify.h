@@ -0,0 +1,80 @@
+#ifndef __NGRAMCLASSIFY_2026_H__
+#define __NGRAMCLASSIFY_2026_H__
+#include <stddef.h>
+#include "ngram-storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief A set of storages (models) scored together
+ *
+ * All models must have the same gram_max and n, so the index of an
+ * n-gram is computed once and probed in every model.
+ */
+typedef struct Ngram_Model_Set {
+  int count;
+  int capacity;
+  ngram_storage_t **models; //!< mapped read-only
+  char **names;
+  int gram_max;
+  int n;
+  uint64_t *hits; //!< per model, result of the last classification
+  uint64_t probes; //!< n-grams looked up by the last classification
+} ngram_model_set_t;
+
+/*! \brief Called for every window of n-grams during a classification
+ *
+ * \param offset input offset of the first n-gram in the window
+ * \param probes number of n-grams looked up in the window
+ * \param hits per model hits in the window
+ * \param ctx user pointer
+ */
+typedef void (*ngram_window_callback)(size_t offset, uint64_t probes, const uint64_t *hits, void *ctx);
+
+ngram_model_set_t *create_ngram_model_set(void);
+
+/*! \brief Open a storage read-only and add it to the set
+ *
+ * \param set model set
+ * \param fname file name of the storage
+ * \return index of the model or -1 on error (errno is EINVAL if the
+ * storage does not match the models added before)
+ */
+int ngram_model_set_add(ngram_model_set_t *set, const char *fname);
+
+/*! \brief Score the n-grams of a buffer against all models
+ *
+ * The buffer is rolled over once. If fold is non-zero the bytes are
+ * mapped by the fold table of the first model, which all models must
+ * share. Without folding, n-grams containing bytes above gram_max are
+ * skipped. The totals are left in set->hits and set->probes.
+ *
+ * \param set model set
+ * \param data input bytes
+ * \param len length of the input
+ * \param fold use the fold table of the models
+ * \param window n-grams per window for the callback, 0 for none
+ * \param callback called per window (may be NULL)
+ * \param ctx passed through to the callback
+ * \return 0 on success, -1 on error
+ */
+int ngram_classify(ngram_model_set_t *set, const uint8_t *data, size_t len, int fold, size_t window, ngram_window_callback callback, void *ctx);
+
+/*! \brief Classify a buffer without per window results (for bindings) */
+int ngram_model_set_classify(ngram_model_set_t *set, const char *data, size_t len, int fold);
+
+/*! \brief Fraction of looked up n-grams found in a model by the last classification */
+double ngram_model_set_ratio(const ngram_model_set_t *set, int model);
+
+const char *ngram_model_set_name(const ngram_model_set_t *set, int model);
+int ngram_model_set_size(const ngram_model_set_t *set);
+
+/*! \brief Close all storages and free the set */
+void close_ngram_model_set(ngram_model_set_t *set);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ngram-delta.h"
+
+/* Longest run of words buffered before it is written. */
+#define DELTA_MAX_RUN 4096
+
+static uint64_t bitmap_bytes(const ngram_storage_t *ngramstorage) {
+  return ngramstorage->SIZE - sizeof(ngram_storage_t);
+}
+
+/* Little endian word w of the bitmap, the last word may be partial. */
+static uint64_t load_word(const uint8_t *bits, uint64_t w, uint64_t bytes) {
+  uint64_t word = 0;
+  int i;
+
+  if(8 * w + 8 <= bytes) {
+    for(i = 7; i >= 0; --i) word = (word << 8) | bits[8 * w + i];
+  } else {
+    for(i = bytes - 8 * w - 1; i >= 0; --i) word = (word << 8) | bits[8 * w + i];
+  }
+  return word;
+}
+
+static void or_word(uint8_t *bits, uint64_t w, uint64_t bytes, uint64_t word) {
+  uint64_t i;
+
+  for(i = 0; i < 8 && 8 * w + i < bytes; ++i) bits[8 * w + i] |= word >> (8 * i);
+}
+
+static int put_le(FILE *out, uint64_t value, int bytes) {
+  uint8_t buf[8];
+  int i;
+
+  for(i = 0; i < bytes; ++i) buf[i] = value >> (8 * i);
+  return fwrite(buf, bytes, 1, out) == 1 ? 0 : -1;
+}
+
+static int get_le(FILE *in, uint64_t *value, int bytes) {
+  uint8_t buf[8];
+  int i;
+
+  if(fread(buf, bytes, 1, in) != 1) return -1;
+  for(*value = 0, i = bytes - 1; i >= 0; --i) *value = (*value << 8) | buf[i];
+  return 0;
+}
+
+static int put_varint(FILE *out, uint64_t value) {
+  uint8_t buf[10];
+  int len = 0;
+
+  do {
+    buf[len++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+    value >>= 7;
+  } while(value);
+  return fwrite(buf, len, 1, out) == 1 ? 0 : -1;
+}
+
+static int get_varint(FILE *in, uint64_t *value) {
+  int ch, shift = 0;
+
+  *value = 0;
+  do {
+    if((ch = getc(in)) == EOF || shift > 63) return -1;
+    *value |= (uint64_t)(ch & 0x7F) << shift;
+    shift += 7;
+  } while(ch & 0x80);
+  return 0;
+}
+
+/* True if the 8 words at w are equal in both bitmaps. */
+static int block_unchanged(const uint8_t *older, const uint8_t *newer, uint64_t w) {
+#ifdef __SSE2__
+  __m128i diff = _mm_setzero_si128();
+  int i;
+
+  for(i = 0; i < 4; ++i) {
+    diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(older + 8 * w + 16 * i)),
+					    _mm_loadu_si128((const __m128i*)(newer + 8 * w + 16 * i))));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+#else
+  uint64_t a, b, diff = 0;
+  int i;
+
+  for(i = 0; i < 8; ++i) {
+    memcpy(&a, older + 8 * (w + i), sizeof(a));
+    memcpy(&b, newer + 8 * (w + i), sizeof(b));
+    diff |= a ^ b;
+  }
+  return diff == 0;
+#endif
+}
+
+static int write_run(FILE *out, uint64_t gap, const uint64_t *run, uint64_t len) {
+  uint64_t i;
+
+  if(put_varint(out, gap) != 0 || put_varint(out, len) != 0) return -1;
+  for(i = 0; i < len; ++i) {
+    if(put_le(out, run[i], 8) != 0) return -1;
+  }
+  return 0;
+}
+
+int ngram_delta_write(FILE *out, const ngram_storage_t *older, const ngram_storage_t *newer, ngram_delta_stats_t *stats) {
+  const uint64_t bytes = bitmap_bytes(newer);
+  const uint64_t words = (bytes + 7) / 8;
+  const uint64_t full = bytes / 8;
+  uint64_t run[DELTA_MAX_RUN];
+  uint64_t run_start = 0, run_len = 0, written_end = 0;
+  uint64_t w, a, b, added;
+  ngram_delta_stats_t local;
+
+  if(!stats) stats = &local;
+  memset(stats, 0, sizeof(*stats));
+  if(older->gram_max != newer->gram_max || older->n != newer->n || bitmap_bytes(older) != bytes) {
+    errno = EINVAL;
+    return -1;
+  }
+  stats->words = words;
+  stats->from_generation = older->generation;
+  stats->to_generation = newer->generation;
+  if(fwrite(NGRAM_DELTA_MAGIC, 16, 1, out) != 1
+     || put_le(out, newer->gram_max, 4) != 0 || put_le(out, newer->n, 4) != 0
+     || put_le(out, older->generation, 8) != 0 || put_le(out, newer->generation, 8) != 0
+     || put_le(out, words, 8) != 0) return -1;
+  for(w = 0; w < words; ++w) {
+    if(w % 8 == 0 && w + 8 <= full && block_unchanged(older->bits, newer->bits, w)) {
+      w += 7;
+      continue;
+    }
+    a = load_word(older->bits, w, bytes);
+    b = load_word(newer->bits, w, bytes);
+    stats->cleared_bits += __builtin_popcountll(a & ~b);
+    added = b & ~a;
+    if(!added) continue;
+    stats->bits += __builtin_popcountll(added);
+    ++stats->changed_words;
+    if(run_len > 0 && w == run_start + run_len && run_len < DELTA_MAX_RUN) {
+      run[run_len++] = added;
+      continue;
+    }
+    if(run_len > 0) {
+      if(write_run(out, run_start - written_end, run, run_len) != 0) return -1;
+      written_end = run_start + run_len;
+      ++stats->runs;
+    }
+    run_start = w;
+    run[0] = added;
+    run_len = 1;
+  }
+  if(run_len > 0) {
+    if(write_run(out, run_start - written_end, run, run_len) != 0) return -1;
+    ++stats->runs;
+  }
+  if(put_varint(out, 0) != 0 || put_varint(out, 0) != 0) return -1;
+  return fflush(out) == 0 ? 0 : -1;
+}
+
+
+int ngram_delta_apply(FILE *in, ngram_storage_t *ngramstorage, int force, ngram_delta_stats_t *stats) {
+  const uint64_t bytes = bitmap_bytes(ngramstorage);
+  char magic[16];
+  uint64_t gram_max, n, words, pos = 0, gap, len, word, old, i;
+  ngram_delta_stats_t local;
+
+  if(!stats) stats = &local;
+  memset(stats, 0, sizeof(*stats));
+  if(fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, NGRAM_DELTA_MAGIC, sizeof(magic)) != 0
+     || get_le(in, &gram_max, 4) != 0 || get_le(in, &n, 4) != 0
+     || get_le(in, &stats->from_generation, 8) != 0 || get_le(in, &stats->to_generation, 8) != 0
+     || get_le(in, &words, 8) != 0) goto invalid;
+  if(gram_max != (uint64_t)ngramstorage->gram_max || n != (uint64_t)ngramstorage->n || words != (bytes + 7) / 8) goto invalid;
+  if(!force && ngramstorage->generation != stats->from_generation) goto invalid;
+  stats->words = words;
+  for(;;) {
+    if(get_varint(in, &gap) != 0 || get_varint(in, &len) != 0) goto invalid;
+    if(len == 0) break;
+    pos += gap;
+    if(pos > words || len > words - pos) goto invalid;
+    ++stats->runs;
+    for(i = 0; i < len; ++i, ++pos) {
+      if(get_le(in, &word, 8) != 0) goto invalid;
+      old = load_word(ngramstorage->bits, pos, bytes);
+      stats->bits += __builtin_popcountll(word & ~old);
+      stats->changed_words += (word & ~old) != 0;
+      or_word(ngramstorage->bits, pos, bytes, word);
+    }
+  }
+  ngramstorage->generation = stats->to_generation;
+  return 0;
+ invalid:
+  errno = EINVAL;
+  return -1;
+}
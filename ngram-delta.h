@@ -0,0 +1,56 @@
+#ifndef __NGRAMDELTA_2026_H__
+#define __NGRAMDELTA_2026_H__
+#include <stdio.h>
+#include "ngram-storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NGRAM_DELTA_MAGIC "emmagram-delta\x01"
+
+/*! \brief Counts of a delta written or applied */
+typedef struct Ngram_Delta_Stats {
+  uint64_t words; //!< 64 bit words of the bitmap
+  uint64_t changed_words; //!< words with newly set bits
+  uint64_t runs; //!< runs of consecutive changed words
+  uint64_t bits; //!< newly set bits
+  uint64_t cleared_bits; //!< bits set in the old but not in the new storage (diff only, not transferred)
+  uint64_t from_generation;
+  uint64_t to_generation;
+} ngram_delta_stats_t;
+
+/*! \brief Write the bits set in newer but not in older as a delta
+ *
+ * Layout: the magic (16 bytes), gram_max and n (uint32), the old and
+ * new generation and the number of bitmap words (uint64, all little
+ * endian), then records of varint gap in words since the end of the
+ * previous run, varint run length and the run's words of new bits.
+ * A record with a run length of zero ends the delta.
+ *
+ * \param out output stream
+ * \param older older storage (e.g. the previous snapshot)
+ * \param newer newer storage with the same gram_max and n
+ * \param stats receives the counts (may be NULL)
+ * \return 0 on success, -1 on error (errno is EINVAL for incompatible storages)
+ */
+int ngram_delta_write(FILE *out, const ngram_storage_t *older, const ngram_storage_t *newer, ngram_delta_stats_t *stats);
+
+/*! \brief OR a delta into a storage and advance its generation
+ *
+ * The storage generation must equal the old generation of the delta
+ * unless force is set.
+ *
+ * \param in delta stream
+ * \param ngramstorage storage opened for writing
+ * \param force apply even if the generations do not match
+ * \param stats receives the counts (may be NULL)
+ * \return 0 on success, -1 on error (errno is EINVAL for a bad or mismatching delta)
+ */
+int ngram_delta_apply(FILE *in, ngram_storage_t *ngramstorage, int force, ngram_delta_stats_t *stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
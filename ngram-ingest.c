@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ngram-ingest.h"
+
+/* Each region covers 2^25 indices (4 MiB of the bitmap) or more. */
+#define INGEST_MIN_SHIFT 25
+#define INGEST_MAX_REGIONS 65536
+#define INGEST_MIN_CAPACITY 1024
+
+ngram_ingest_t *ngram_ingest_begin(ngram_storage_t *ngramstorage, size_t memory, const char *tmpdir) {
+  ngram_ingest_t *ingest;
+  uint64_t count = 1, max_regions;
+  int i;
+
+  ingest = calloc(1, sizeof(ngram_ingest_t));
+  if(!ingest) return NULL;
+  for(i = 0; i < ngramstorage->n; ++i) count *= ngramstorage->gram_max + 1;
+  ingest->storage = ngramstorage;
+  ingest->count = count;
+  //Fewer, larger regions if the memory does not give every region INGEST_MIN_CAPACITY indices.
+  max_regions = memory / (sizeof(uint64_t) * INGEST_MIN_CAPACITY);
+  if(max_regions > INGEST_MAX_REGIONS) max_regions = INGEST_MAX_REGIONS;
+  if(max_regions < 1) max_regions = 1;
+  ingest->shift = INGEST_MIN_SHIFT;
+  while(((count - 1) >> ingest->shift) >= max_regions) ++ingest->shift;
+  ingest->regions = ((count - 1) >> ingest->shift) + 1;
+  ingest->capacity = memory / sizeof(uint64_t) / ingest->regions;
+  if(ingest->capacity < INGEST_MIN_CAPACITY) ingest->capacity = INGEST_MIN_CAPACITY;
+  ingest->buckets = calloc(ingest->regions, sizeof(ngram_ingest_bucket_t));
+  ingest->spill_fd = -1;
+  if(!tmpdir) tmpdir = getenv("TMPDIR");
+  ingest->tmpdir = strdup(tmpdir ? tmpdir : "/tmp");
+  if(!ingest->buckets || !ingest->tmpdir) {
+    free(ingest->buckets);
+    free(ingest->tmpdir);
+    free(ingest);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return ingest;
+}
+
+
+/* Append the buffer of a bucket to the spill file. */
+static int spill_bucket(ngram_ingest_t *ingest, ngram_ingest_bucket_t *bucket) {
+  size_t bytes = bucket->fill * sizeof(uint64_t);
+  size_t done = 0;
+  ssize_t written;
+  char *name;
+  void *ptr;
+
+  if(ingest->spill_fd < 0) {
+    name = malloc(strlen(ingest->tmpdir) + 32);
+    if(!name) return -1;
+    sprintf(name, "%s/ngram-ingest-XXXXXX", ingest->tmpdir);
+    ingest->spill_fd = mkstemp(name);
+    if(ingest->spill_fd >= 0) unlink(name);
+    free(name);
+    if(ingest->spill_fd < 0) return -1;
+  }
+  if(bucket->segment_count == bucket->segment_capacity) {
+    bucket->segment_capacity = bucket->segment_capacity ? 2 * bucket->segment_capacity : 4;
+    ptr = realloc(bucket->segments, bucket->segment_capacity * sizeof(ngram_ingest_segment_t));
+    if(!ptr) return -1;
+    bucket->segments = ptr;
+  }
+  while(done < bytes) {
+    written = pwrite(ingest->spill_fd, (char*)bucket->entries + done, bytes - done, ingest->spill_end + done);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    done += written;
+  }
+  bucket->segments[bucket->segment_count].offset = ingest->spill_end;
+  bucket->segments[bucket->segment_count++].count = bucket->fill;
+  ingest->spill_end += bytes;
+  ingest->spilled += bucket->fill;
+  bucket->fill = 0;
+  return 0;
+}
+
+
+int ngram_ingest_add_index(ngram_ingest_t *ingest, uint64_t index) {
+  ngram_ingest_bucket_t *bucket;
+
+  if(index >= ingest->count) {
+    errno = EINVAL;
+    return -1;
+  }
+  bucket = &ingest->buckets[index >> ingest->shift];
+  if(!bucket->entries) {
+    bucket->entries = malloc(ingest->capacity * sizeof(uint64_t));
+    if(!bucket->entries) return -1;
+  }
+  bucket->entries[bucket->fill++] = index;
+  ++ingest->added;
+  if(bucket->fill == ingest->capacity) return spill_bucket(ingest, bucket);
+  return 0;
+}
+
+
+int ngram_ingest_add(ngram_ingest_t *ingest, uint8_t *grams) {
+  return ngram_ingest_add_index(ingest, ngram_index(ingest->storage, grams));
+}
+
+
+static uint64_t set_bits(uint8_t *bits, const uint64_t *entries, size_t count) {
+  uint64_t newly_set = 0;
+  size_t i;
+  uint8_t mask;
+
+  for(i = 0; i < count; ++i) {
+    mask = 1 << (entries[i] & 7);
+    newly_set += (bits[entries[i] >> 3] & mask) == 0;
+    bits[entries[i] >> 3] |= mask;
+  }
+  return newly_set;
+}
+
+/* Ask the kernel to read the bitmap bytes of a region ahead. */
+static void prefetch_region(ngram_ingest_t *ingest, unsigned int region) {
+  long page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (uintptr_t)(ingest->storage->bits + ((uint64_t)region << ingest->shift >> 3));
+  uintptr_t end = begin + ((uint64_t)1 << ingest->shift >> 3);
+  uintptr_t limit = (uintptr_t)ingest->storage + ingest->storage->SIZE;
+
+  if(end > limit) end = limit;
+  begin &= ~(uintptr_t)(page - 1);
+  madvise((void*)begin, end - begin, MADV_WILLNEED);
+}
+
+int ngram_ingest_finish(ngram_ingest_t *ingest, uint64_t *newly_set) {
+  ngram_ingest_bucket_t *bucket;
+  uint64_t *buffer = NULL;
+  size_t bytes, done, i;
+  unsigned int region;
+  ssize_t got;
+  int ret = 0;
+
+  ingest->newly_set = 0;
+  if(ingest->spilled > 0) {
+    buffer = malloc(ingest->capacity * sizeof(uint64_t));
+    if(!buffer) ret = -1;
+  }
+  for(region = 0; region < ingest->regions && ret == 0; ++region) {
+    bucket = &ingest->buckets[region];
+    if(bucket->fill == 0 && bucket->segment_count == 0) continue;
+    prefetch_region(ingest, region);
+    for(i = 0; i < bucket->segment_count && ret == 0; ++i) {
+      bytes = bucket->segments[i].count * sizeof(uint64_t);
+      for(done = 0; done < bytes; done += got) {
+	got = pread(ingest->spill_fd, (char*)buffer + done, bytes - done, bucket->segments[i].offset + done);
+	if(got < 0 && errno == EINTR) {
+	  got = 0;
+	} else if(got <= 0) {
+	  ret = -1;
+	  break;
+	}
+      }
+      if(ret == 0) ingest->newly_set += set_bits(ingest->storage->bits, buffer, bucket->segments[i].count);
+    }
+    ingest->newly_set += set_bits(ingest->storage->bits, bucket->entries, bucket->fill);
+  }
+  if(newly_set) *newly_set = ingest->newly_set;
+  for(region = 0; region < ingest->regions; ++region) {
+    free(ingest->buckets[region].entries);
+    free(ingest->buckets[region].segments);
+  }
+  if(ingest->spill_fd >= 0) close(ingest->spill_fd);
+  free(buffer);
+  free(ingest->buckets);
+  free(ingest->tmpdir);
+  free(ingest);
+  return ret;
+}
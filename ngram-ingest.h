@@ -0,0 +1,77 @@
+#ifndef __NGRAMINGEST_2026_H__
+#define __NGRAMINGEST_2026_H__
+#include <stddef.h>
+#include <sys/types.h>
+#include "ngram-storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Ngram_Ingest_Segment {
+  off_t offset; //!< in the spill file
+  size_t count; //!< number of indices
+} ngram_ingest_segment_t;
+
+typedef struct Ngram_Ingest_Bucket {
+  uint64_t *entries; //!< buffered indices, allocated on first use
+  size_t fill;
+  ngram_ingest_segment_t *segments; //!< spilled parts
+  size_t segment_count;
+  size_t segment_capacity;
+} ngram_ingest_bucket_t;
+
+/*! \brief Buffered bulk insertion into a storage
+ *
+ * Indices are collected in buckets by the region of the bitmap they
+ * fall into (the high bits of the index). Full buckets are appended
+ * to a single unlinked spill file. ngram_ingest_finish() then sets
+ * the bits region by region, so every part of the bitmap is paged in
+ * and written once instead of at random for every n-gram.
+ */
+typedef struct Ngram_Ingest {
+  ngram_storage_t *storage;
+  uint64_t count; //!< number of indices, see ngram_index_count()
+  unsigned int regions;
+  int shift; //!< index >> shift is the region
+  size_t capacity; //!< indices per bucket buffer
+  ngram_ingest_bucket_t *buckets;
+  int spill_fd; //!< -1 until the first spill
+  off_t spill_end;
+  char *tmpdir;
+  uint64_t added; //!< indices added
+  uint64_t spilled; //!< indices written to the spill file
+  uint64_t newly_set; //!< bits that were not set before, valid after finishing
+} ngram_ingest_t;
+
+/*! \brief Start a bulk insertion
+ *
+ * \param ngramstorage storage opened for writing
+ * \param memory bytes to use for the buckets
+ * \param tmpdir directory of the spill file, NULL for $TMPDIR or /tmp
+ * \return ingest state or NULL on error
+ */
+ngram_ingest_t *ngram_ingest_begin(ngram_storage_t *ngramstorage, size_t memory, const char *tmpdir);
+
+/*! \brief Add an index (see ngram_index()), returns 0 or -1 on error
+ *
+ * Indices outside of the storage fail with errno set to EINVAL.
+ */
+int ngram_ingest_add_index(ngram_ingest_t *ingest, uint64_t index);
+
+/*! \brief Add an n-gram, returns 0 or -1 on error */
+int ngram_ingest_add(ngram_ingest_t *ingest, uint8_t *grams);
+
+/*! \brief Set all collected bits in region order and free the state
+ *
+ * \param ingest ingest state, freed
+ * \param newly_set receives the number of bits not set before (may be NULL)
+ * \return 0 on success, -1 on error
+ */
+int ngram_ingest_finish(ngram_ingest_t *ingest, uint64_t *newly_set);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include <string.h>
+#include "ngram-iterator.h"
+
+void ngram_divisor_init(ngram_divisor_t *d, uint64_t divisor) {
+  int l = 0;
+
+  //l = ceil(log2(divisor))
+  while(l < 64 && ((unsigned __int128)1 << l) < divisor) ++l;
+  d->divisor = divisor;
+  d->power_of_two = (divisor & (divisor - 1)) == 0;
+  if(d->power_of_two) {
+    d->multiplier = 0;
+    d->shift = l;
+  } else {
+    d->multiplier = (uint64_t)(((((unsigned __int128)1 << l) - divisor) << 64) / divisor + 1);
+    d->shift = l - 1;
+  }
+}
+
+
+uint64_t ngram_index_count(const ngram_storage_t *ngramstorage) {
+  uint64_t count = 1;
+  int i;
+
+  for(i = 0; i < ngramstorage->n; ++i) count *= ngramstorage->gram_max + 1;
+  return count;
+}
+
+
+/* Load the 64 bit word w, clearing bits outside of [first, last). */
+static uint64_t load_word(const ngram_iterator_t *it, uint64_t w) {
+  uint64_t word = 0;
+  uint64_t low = w * 64;
+  uint64_t bytes = (it->last + 7) / 8;
+
+  memcpy(&word, it->storage->bits + 8 * w, 8 * w + 8 <= bytes ? 8 : bytes - 8 * w);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  if(low < it->first) word &= ~0ULL << (it->first - low);
+  if(low + 64 > it->last) word &= (1ULL << (it->last - low)) - 1;
+  return word;
+}
+
+
+/* Move position out of a hole, returns 0 if only holes follow. */
+static int skip_hole(ngram_iterator_t *it) {
+  uint64_t begin, end;
+
+  if(!ngram_storage_next_data(it->storage, 8 * it->position, &begin, &end)) return 0;
+  if(begin / 8 > it->position) it->position = begin / 8;
+  it->data_end = (end + 7) / 8;
+  return 1;
+}
+
+
+void ngram_iterator_init(ngram_iterator_t *it, const ngram_storage_t *ngramstorage, uint64_t first, uint64_t last) {
+  uint64_t count = ngram_index_count(ngramstorage);
+
+  it->storage = ngramstorage;
+  it->last = last < count ? last : count;
+  it->first = first < it->last ? first : it->last;
+  it->position = it->first / 64;
+  it->last_word = (it->last + 63) / 64;
+  it->data_end = 0;
+  it->word = 0;
+  if(it->first < it->last && skip_hole(it) && it->position < it->last_word) {
+    it->word = load_word(it, it->position);
+  }
+  ngram_divisor_init(&it->radix, ngramstorage->gram_max + 1);
+}
+
+
+int ngram_iterator_next(ngram_iterator_t *it, uint64_t *index) {
+  uint64_t block[4];
+
+  while(it->word == 0) {
+    if(++it->position >= it->data_end && !skip_hole(it)) it->position = it->last_word;
+    if(it->position >= it->last_word) {
+      it->position = it->last_word;
+      return 0;
+    }
+    //Skip aligned blocks of four zero words, the last word may be partial.
+    while(it->position % 4 == 0 && it->position + 4 < it->last_word && it->position + 4 <= it->data_end) {
+      memcpy(block, it->storage->bits + 8 * it->position, sizeof(block));
+      if((block[0] | block[1] | block[2] | block[3]) != 0) break;
+      it->position += 4;
+    }
+    it->word = load_word(it, it->position);
+  }
+  *index = it->position * 64 + __builtin_ctzll(it->word);
+  it->word &= it->word - 1;
+  return 1;
+}
+
+
+void ngram_iterator_decode(const ngram_iterator_t *it, uint64_t index, uint8_t *grams) {
+  uint64_t q;
+  int i;
+
+  for(i = it->storage->n - 1; i > 0; --i) {
+    q = ngram_divide(&it->radix, index);
+    grams[i] = index - q * it->radix.divisor;
+    index = q;
+  }
+  grams[0] = index;
+}
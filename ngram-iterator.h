@@ -0,0 +1,79 @@
+#ifndef __NGRAMITERATOR_2026_H__
+#define __NGRAMITERATOR_2026_H__
+#include <stddef.h>
+#include "ngram-storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Division by an invariant divisor using a precomputed reciprocal
+ *
+ * Granlund and Montgomery, "Division by Invariant Integers using
+ * Multiplication": q = (t + ((x - t) >> 1)) >> shift with t the high
+ * half of multiplier * x. Powers of two use a plain shift.
+ */
+typedef struct Ngram_Divisor {
+  uint64_t divisor;
+  uint64_t multiplier;
+  int shift;
+  int power_of_two;
+} ngram_divisor_t;
+
+void ngram_divisor_init(ngram_divisor_t *d, uint64_t divisor);
+
+static inline uint64_t ngram_divide(const ngram_divisor_t *d, uint64_t x) {
+  uint64_t t;
+
+  if(d->power_of_two) return x >> d->shift;
+  t = (uint64_t)(((unsigned __int128)d->multiplier * x) >> 64);
+  return (t + ((x - t) >> 1)) >> d->shift;
+}
+
+/*! \brief Iterator over the set n-grams of a storage in index order
+ *
+ * Holes of the storage file are skipped without touching them, zero
+ * 64 bit words (and aligned blocks of four of them) are skipped, set
+ * bits are extracted with count trailing zeros.
+ */
+typedef struct Ngram_Iterator {
+  const ngram_storage_t *storage;
+  uint64_t first; //!< first index of the range
+  uint64_t last; //!< end of the range (exclusive)
+  uint64_t position; //!< word index of the current word
+  uint64_t last_word; //!< word index past the range
+  uint64_t word; //!< remaining set bits of the current word
+  uint64_t data_end; //!< word index where the current allocated range ends
+  ngram_divisor_t radix; //!< gram_max + 1
+} ngram_iterator_t;
+
+/*! \brief Number of n-gram indices of a storage ((gram_max + 1)^n) */
+uint64_t ngram_index_count(const ngram_storage_t *ngramstorage);
+
+/*! \brief Start iterating over the indices [first, last)
+ *
+ * last is clamped to ngram_index_count().
+ */
+void ngram_iterator_init(ngram_iterator_t *it, const ngram_storage_t *ngramstorage, uint64_t first, uint64_t last);
+
+/*! \brief Advance to the next set n-gram
+ *
+ * \param it iterator
+ * \param index receives the index of the n-gram
+ * \return 1 if an n-gram was found, 0 at the end
+ */
+int ngram_iterator_next(ngram_iterator_t *it, uint64_t *index);
+
+/*! \brief Decode an index into n values (inverse of set_ngram())
+ *
+ * \param it iterator (for n and the reciprocal of the radix)
+ * \param index n-gram index
+ * \param grams buffer for n values
+ */
+void ngram_iterator_decode(const ngram_iterator_t *it, uint64_t index, uint8_t *grams);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
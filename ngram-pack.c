@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ngram-pack.h"
+
+/* Magic, bitmap bytes, block size, padding, block count, index offset. */
+#define PACK_HEADER_SIZE 48
+#define PACK_ENTRY_SIZE 16
+
+static void put_le(uint8_t *buf, uint64_t value, int bytes) {
+  int i;
+
+  for(i = 0; i < bytes; ++i) buf[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *buf, int bytes) {
+  uint64_t value = 0;
+  int i;
+
+  for(i = bytes - 1; i >= 0; --i) value = (value << 8) | buf[i];
+  return value;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+  ssize_t written;
+
+  while(len > 0) {
+    written = pwrite(fd, buf, len, offset);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    buf = (const char*)buf + written;
+    len -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+/* Encode the set bits of a block as varint gaps, returns the length
+ * or 0 if the encoding would not be smaller than the block. */
+static size_t encode_sparse(const uint8_t *block, size_t len, uint8_t *out) {
+  uint64_t prev = 0, pos, gap, word;
+  size_t used = 0, i;
+  int first = 1;
+
+  for(i = 0; i < len; i += 8) {
+    word = 0;
+    memcpy(&word, block + i, len - i < 8 ? len - i : 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    for(; word; word &= word - 1) {
+      pos = 8 * i + __builtin_ctzll(word);
+      gap = first ? pos : pos - prev - 1;
+      first = 0;
+      prev = pos;
+      do {
+	if(used + 1 >= len) return 0;
+	out[used++] = (gap & 0x7F) | (gap > 0x7F ? 0x80 : 0);
+	gap >>= 7;
+      } while(gap);
+    }
+  }
+  return used;
+}
+
+static int decode_sparse(const uint8_t *in, size_t len, uint8_t *block, size_t block_len) {
+  uint64_t pos = 0, gap;
+  size_t i = 0;
+  int shift, first = 1;
+
+  memset(block, 0, block_len);
+  while(i < len) {
+    gap = 0;
+    shift = 0;
+    do {
+      if(i >= len || shift > 63) return -1;
+      gap |= (uint64_t)(in[i] & 0x7F) << shift;
+      shift += 7;
+    } while(in[i++] & 0x80);
+    pos = first ? gap : pos + gap + 1;
+    first = 0;
+    if(pos >= 8 * block_len) return -1;
+    block[pos >> 3] |= 1 << (pos & 7);
+  }
+  return 0;
+}
+
+static int all_zero(const uint8_t *block, size_t len) {
+  static const uint8_t zeros[NGRAM_PACK_BLOCK_SIZE];
+
+  return memcmp(block, zeros, len) == 0;
+}
+
+
+int ngram_pack_write(const ngram_storage_t *ngramstorage, const char *fname, ngram_pack_stats_t *stats) {
+  const uint64_t bytes = ngramstorage->SIZE - sizeof(ngram_storage_t);
+  const uint64_t blocks = (bytes + NGRAM_PACK_BLOCK_SIZE - 1) / NGRAM_PACK_BLOCK_SIZE;
+  uint8_t header[PACK_HEADER_SIZE], sparse[NGRAM_PACK_BLOCK_SIZE];
+  uint8_t *index = NULL;
+  uint64_t b, begin = 0, end = 0, start, len, offset;
+  uint32_t method, length;
+  const uint8_t *data;
+  ngram_pack_stats_t local;
+  int fd, err, more;
+
+  if(!stats) stats = &local;
+  memset(stats, 0, sizeof(*stats));
+  stats->blocks = blocks;
+  stats->bitmap_bytes = bytes;
+  index = calloc(blocks ? blocks : 1, PACK_ENTRY_SIZE);
+  if(!index) return -1;
+  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0) {
+    free(index);
+    return -1;
+  }
+  offset = sizeof(ngram_storage_t) + PACK_HEADER_SIZE;
+  more = ngram_storage_next_data(ngramstorage, 0, &begin, &end);
+  for(b = 0; b < blocks; ++b) {
+    start = b * NGRAM_PACK_BLOCK_SIZE;
+    len = bytes - start < NGRAM_PACK_BLOCK_SIZE ? bytes - start : NGRAM_PACK_BLOCK_SIZE;
+    while(more && end <= start) more = ngram_storage_next_data(ngramstorage, end, &begin, &end);
+    data = ngramstorage->bits + start;
+    method = NGRAM_PACK_EMPTY;
+    length = 0;
+    //Blocks in holes are empty without reading them.
+    if(more && begin < start + len && !all_zero(data, len)) {
+      length = encode_sparse(data, len, sparse);
+      if(length > 0) {
+	method = NGRAM_PACK_SPARSE;
+	data = sparse;
+      } else {
+	method = NGRAM_PACK_RAW;
+	length = len;
+      }
+      if(pwrite_all(fd, data, length, offset) != 0) goto error;
+    }
+    stats->empty_blocks += method == NGRAM_PACK_EMPTY;
+    stats->raw_blocks += method == NGRAM_PACK_RAW;
+    stats->sparse_blocks += method == NGRAM_PACK_SPARSE;
+    put_le(index + b * PACK_ENTRY_SIZE, length ? offset : 0, 8);
+    put_le(index + b * PACK_ENTRY_SIZE + 8, length, 4);
+    put_le(index + b * PACK_ENTRY_SIZE + 12, method, 4);
+    offset += length;
+  }
+  if(pwrite_all(fd, index, blocks * PACK_ENTRY_SIZE, offset) != 0) goto error;
+  memcpy(header, NGRAM_PACK_MAGIC, 16);
+  put_le(header + 16, bytes, 8);
+  put_le(header + 24, NGRAM_PACK_BLOCK_SIZE, 4);
+  put_le(header + 28, 0, 4);
+  put_le(header + 32, blocks, 8);
+  put_le(header + 40, offset, 8);
+  if(pwrite_all(fd, header, PACK_HEADER_SIZE, sizeof(ngram_storage_t)) != 0) goto error;
+  //The storage header last, so an incomplete archive has no magic.
+  if(pwrite_all(fd, ngramstorage, sizeof(ngram_storage_t), 0) != 0) goto error;
+  stats->packed_bytes = offset + blocks * PACK_ENTRY_SIZE;
+  free(index);
+  return close(fd);
+ error:
+  err = errno;
+  free(index);
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+
+ngram_packed_t *open_ngram_packed(const char *fname) {
+  ngram_packed_t *packed;
+  const uint8_t *header;
+  struct stat filestat;
+  uint64_t index_offset, b, offset, length, method, len;
+  void *ptr;
+  int fd, err;
+
+  fd = open(fname, O_RDONLY);
+  if(fd < 0) return NULL;
+  if(fstat(fd, &filestat) != 0) goto error;
+  if((uint64_t)filestat.st_size < sizeof(ngram_storage_t) + PACK_HEADER_SIZE) {
+    errno = EINVAL;
+    goto error;
+  }
+  ptr = mmap(NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(ptr == MAP_FAILED) goto error;
+  close(fd);
+  packed = calloc(1, sizeof(ngram_packed_t));
+  if(!packed) {
+    munmap(ptr, filestat.st_size);
+    errno = ENOMEM;
+    return NULL;
+  }
+  packed->base = ptr;
+  packed->size = filestat.st_size;
+  packed->header = ptr;
+  header = packed->base + sizeof(ngram_storage_t);
+  packed->bitmap_bytes = get_le(header + 16, 8);
+  packed->block_count = get_le(header + 32, 8);
+  index_offset = get_le(header + 40, 8);
+  if(memcmp(header, NGRAM_PACK_MAGIC, 16) != 0
+     || get_le(header + 24, 4) != NGRAM_PACK_BLOCK_SIZE
+     || packed->header->SIZE != sizeof(ngram_storage_t) + packed->bitmap_bytes
+     || packed->block_count != (packed->bitmap_bytes + NGRAM_PACK_BLOCK_SIZE - 1) / NGRAM_PACK_BLOCK_SIZE
+     || index_offset > packed->size || packed->block_count > (packed->size - index_offset) / PACK_ENTRY_SIZE) goto invalid;
+  packed->index = packed->base + index_offset;
+  for(b = 0; b < packed->block_count; ++b) {
+    offset = get_le(packed->index + b * PACK_ENTRY_SIZE, 8);
+    length = get_le(packed->index + b * PACK_ENTRY_SIZE + 8, 4);
+    method = get_le(packed->index + b * PACK_ENTRY_SIZE + 12, 4);
+    len = packed->bitmap_bytes - b * NGRAM_PACK_BLOCK_SIZE;
+    if(len > NGRAM_PACK_BLOCK_SIZE) len = NGRAM_PACK_BLOCK_SIZE;
+    if(offset > index_offset || length > index_offset - offset || method > NGRAM_PACK_SPARSE
+       || (method == NGRAM_PACK_RAW && length != len) || (method == NGRAM_PACK_EMPTY && length != 0)) goto invalid;
+  }
+  memset(packed->cache_tag, 0xFF, sizeof(packed->cache_tag));
+  return packed;
+ invalid:
+  close_ngram_packed(packed);
+  errno = EINVAL;
+  return NULL;
+ error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return NULL;
+}
+
+
+/* The bitmap bytes of a block, NULL for empty blocks. */
+static const uint8_t *packed_block(ngram_packed_t *packed, uint64_t b) {
+  const uint8_t *entry = packed->index + b * PACK_ENTRY_SIZE;
+  uint64_t offset = get_le(entry, 8);
+  uint32_t length = get_le(entry + 8, 4);
+  uint64_t len = packed->bitmap_bytes - b * NGRAM_PACK_BLOCK_SIZE;
+  uint8_t *slot;
+
+  switch(get_le(entry + 12, 4)) {
+  case NGRAM_PACK_RAW:
+    return packed->base + offset;
+  case NGRAM_PACK_SPARSE:
+    if(!packed->cache && !(packed->cache = malloc(NGRAM_PACK_CACHE * NGRAM_PACK_BLOCK_SIZE))) return NULL;
+    slot = packed->cache + (b % NGRAM_PACK_CACHE) * NGRAM_PACK_BLOCK_SIZE;
+    if(packed->cache_tag[b % NGRAM_PACK_CACHE] != b) {
+      if(len > NGRAM_PACK_BLOCK_SIZE) len = NGRAM_PACK_BLOCK_SIZE;
+      if(decode_sparse(packed->base + offset, length, slot, len) != 0) return NULL;
+      packed->cache_tag[b % NGRAM_PACK_CACHE] = b;
+      ++packed->decoded;
+    }
+    return slot;
+  default:
+    return NULL;
+  }
+}
+
+
+int find_ngram_packed_index(ngram_packed_t *packed, uint64_t index) {
+  const uint8_t *block;
+  uint64_t pos = index >> 3;
+
+  ++packed->lookups;
+  if(pos >= packed->bitmap_bytes) return 0;
+  block = packed_block(packed, pos / NGRAM_PACK_BLOCK_SIZE);
+  if(!block) return 0;
+  return block[pos % NGRAM_PACK_BLOCK_SIZE] & (1 << (index & 7));
+}
+
+
+int find_ngram_packed(ngram_packed_t *packed, const uint8_t *grams) {
+  return find_ngram_packed_index(packed, ngram_index(packed->header, grams));
+}
+
+
+int ngram_unpack(ngram_packed_t *packed, const char *fname) {
+  const uint8_t *block;
+  uint64_t b, len;
+  int fd, err;
+
+  fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0) return -1;
+  if(ftruncate(fd, packed->header->SIZE) != 0) goto error;
+  if(pwrite_all(fd, packed->header, sizeof(ngram_storage_t), 0) != 0) goto error;
+  for(b = 0; b < packed->block_count; ++b) {
+    if(get_le(packed->index + b * PACK_ENTRY_SIZE + 12, 4) == NGRAM_PACK_EMPTY) continue;
+    len = packed->bitmap_bytes - b * NGRAM_PACK_BLOCK_SIZE;
+    if(len > NGRAM_PACK_BLOCK_SIZE) len = NGRAM_PACK_BLOCK_SIZE;
+    block = packed_block(packed, b);
+    if(!block) {
+      errno = EINVAL;
+      goto error;
+    }
+    if(pwrite_all(fd, block, len, sizeof(ngram_storage_t) + b * NGRAM_PACK_BLOCK_SIZE) != 0) goto error;
+  }
+  if(close(fd) != 0) return -1;
+  return adopt_ngram_storage(fname);
+ error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+
+void close_ngram_packed(ngram_packed_t *packed) {
+  munmap((void*)packed->base, packed->size);
+  free(packed->cache);
+  free(packed);
+}
@@ -0,0 +1,97 @@
+#ifndef __NGRAMPACK_2026_H__
+#define __NGRAMPACK_2026_H__
+#include <stddef.h>
+#include "ngram-storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NGRAM_PACK_MAGIC "emmagram-pack\x01\x00"
+/* Bytes of the bitmap per block (65536 n-grams). */
+#define NGRAM_PACK_BLOCK_SIZE 8192
+/* Decoded blocks kept by a packed storage (direct mapped). */
+#define NGRAM_PACK_CACHE 64
+
+enum Ngram_Pack_Method {
+  NGRAM_PACK_EMPTY = 0, //!< all zero, nothing stored
+  NGRAM_PACK_RAW, //!< the block as is
+  NGRAM_PACK_SPARSE //!< varint gaps between the set bits
+};
+
+/*! \brief Counts of a pack operation */
+typedef struct Ngram_Pack_Stats {
+  uint64_t blocks;
+  uint64_t empty_blocks;
+  uint64_t raw_blocks;
+  uint64_t sparse_blocks;
+  uint64_t bitmap_bytes; //!< size of the unpacked bitmap
+  uint64_t packed_bytes; //!< size of the archive
+} ngram_pack_stats_t;
+
+/*! \brief A packed storage opened for lookups
+ *
+ * The archive is mapped read-only. Raw blocks are read in place,
+ * sparse blocks are decoded on first access into a small cache.
+ */
+typedef struct Ngram_Packed {
+  const ngram_storage_t *header; //!< copy of the storage header (gram_max, n, generation...)
+  const uint8_t *base;
+  size_t size;
+  uint64_t bitmap_bytes;
+  uint64_t block_count;
+  const uint8_t *index; //!< block_count entries of offset, length and method
+  uint64_t cache_tag[NGRAM_PACK_CACHE];
+  uint8_t *cache; //!< NGRAM_PACK_CACHE decoded blocks
+  uint64_t lookups;
+  uint64_t decoded; //!< blocks decoded into the cache
+} ngram_packed_t;
+
+/*! \brief Write a storage as a block-compressed archive
+ *
+ * Layout: a copy of the storage header (sizeof(ngram_storage_t)
+ * bytes), the magic (16 bytes), the bitmap size (uint64), the block
+ * size (uint32), padding (uint32), the number of blocks and the offset
+ * of the block index (uint64, all little endian), then the block
+ * data and the index of 16 byte entries (uint64 offset, uint32 length,
+ * uint32 method). Holes of the storage file are packed as empty
+ * blocks without reading them.
+ *
+ * \param ngramstorage storage
+ * \param fname archive file (a regular file, the header is written last)
+ * \param stats receives the counts (may be NULL)
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int ngram_pack_write(const ngram_storage_t *ngramstorage, const char *fname, ngram_pack_stats_t *stats);
+
+/*! \brief Open an archive for read-only lookups
+ *
+ * \param fname archive file
+ * \return packed storage or NULL on error (errno is EINVAL for a bad archive)
+ */
+ngram_packed_t *open_ngram_packed(const char *fname);
+
+/*! \brief Test a bit of a packed storage by index (see ngram_index()) */
+int find_ngram_packed_index(ngram_packed_t *packed, uint64_t index);
+
+/*! \brief Test an n-gram in a packed storage (see find_ngram()) */
+int find_ngram_packed(ngram_packed_t *packed, const uint8_t *grams);
+
+/*! \brief Unpack an archive into a new sparse storage file
+ *
+ * Empty blocks stay holes. The identity of the new file is recorded
+ * as with adopt_ngram_storage(), so it can be opened right away.
+ *
+ * \param packed packed storage
+ * \param fname storage file to create
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int ngram_unpack(ngram_packed_t *packed, const char *fname);
+
+void close_ngram_packed(ngram_packed_t *packed);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
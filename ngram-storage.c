@@ -1,6 +1,10 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <math.h>
 #include <string.h>
@@ -8,6 +12,50 @@
 
 #define STORAGE_MAGIC "⚗ n-GRAM LOCAL STORAGE\x04"
 
+/* File descriptors of the mapped storages, used to find holes with
+ * SEEK_DATA/SEEK_HOLE. Opening and closing is not thread-safe. */
+static struct Open_Storage {
+  const ngram_storage_t *storage;
+  int fd;
+} *open_storages = NULL;
+static int open_storage_count = 0;
+
+static void register_storage(const ngram_storage_t *storage, int fd) {
+  struct Open_Storage *ptr;
+
+  fd = dup(fd);
+  if(fd < 0) return;
+  ptr = realloc(open_storages, (open_storage_count + 1) * sizeof(struct Open_Storage));
+  if(!ptr) {
+    close(fd);
+    return;
+  }
+  open_storages = ptr;
+  open_storages[open_storage_count].storage = storage;
+  open_storages[open_storage_count++].fd = fd;
+}
+
+static void unregister_storage(const ngram_storage_t *storage) {
+  int i;
+
+  for(i = 0; i < open_storage_count; ++i) {
+    if(open_storages[i].storage == storage) {
+      close(open_storages[i].fd);
+      open_storages[i] = open_storages[--open_storage_count];
+      return;
+    }
+  }
+}
+
+static int storage_fd(const ngram_storage_t *storage) {
+  int i;
+
+  for(i = 0; i < open_storage_count; ++i) {
+    if(open_storages[i].storage == storage) return open_storages[i].fd;
+  }
+  return -1;
+}
+
 uint64_t calc_max_index(int gram_max, int n) {
   int i;
   uint64_t maxindex = 1;
@@ -59,7 +107,7 @@ uint8_t *ngram_from_string(ngram_storage_t *ngramstorage, const char *hextex) {
 }
 
 
-ngram_storage_t *open_ngram_storage(const char *fname) {
+static ngram_storage_t *map_ngram_storage(const char *fname, int writable) {
   FILE *f;
   struct Ngram_Storage *ptr = NULL;
   uint64_t maxindex, size;
@@ -72,10 +120,10 @@ ngram_storage_t *open_ngram_storage(const char *fname) {
     perror("open_ngram_storage(fstat)");
     return NULL;
   }
-  f = fopen(fname, "r+");
+  f = fopen(fname, writable ? "r+" : "r");
   if(!f) return NULL; else {
     size = sizeof(ngram_storage_t);
-    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), 0);
+    ptr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fileno(f), 0);
     if(ptr == MAP_FAILED) {
       perror("mmap");
       ptr = NULL;
@@ -89,9 +137,9 @@ ngram_storage_t *open_ngram_storage(const char *fname) {
       maxindex = calc_max_index(gram_max, n);
       size = calc_size(gram_max, n);
       if(munmap(ptr, sizeof(ngram_storage_t)) != 0) perror("munmap");
-      ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), 0);
+      ptr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fileno(f), 0);
       assert(fprintf(stderr, "ptr = %p size = $%"PRIX64" ptr->SIZE = %"PRIX64"\n", ptr, size, ptr->SIZE));
-      if(!ptr) goto errend;
+      if(ptr == MAP_FAILED) { perror("mmap"); ptr = NULL; goto errend; }
       if(ptr->SIZE != size) { fprintf(stderr, "SIZE?\n"); errno = EINVAL; return NULL; }
       if(ptr->gram_max != gram_max) { fprintf(stderr, "gram_max?\n"); errno = EINVAL; return NULL; }
       if(ptr->n != n) { fprintf(stderr, "n?\n"); errno = EINVAL; return NULL; }
@@ -106,11 +154,20 @@ ngram_storage_t *open_ngram_storage(const char *fname) {
   }
  errend:
   err = errno;
+  if(ptr) register_storage(ptr, fileno(f));
   fclose(f);
   errno = err;
   return ptr;
 }
 
+ngram_storage_t *open_ngram_storage(const char *fname) {
+  return map_ngram_storage(fname, 1);
+}
+
+ngram_storage_t *open_ngram_storage_readonly(const char *fname) {
+  return map_ngram_storage(fname, 0);
+}
+
 ngram_storage_t *create_ngram_storage(const char *fname, int gram_max, int n) {
   FILE *f;
   struct Ngram_Storage *ptr;
@@ -139,16 +196,18 @@ ngram_storage_t *create_ngram_storage(const char *fname, int gram_max, int n) {
     ptr->n = n;
     ptr->maxindex = maxindex;
     ptr->combinations = powl(gram_max, n);
+    register_storage(ptr, fileno(f));
   }
   fclose(f);
   if(stat(fname, &ptr->fstat) != 0) {
     perror("fstat");
   }
-  msync(ptr, ptr->SIZE, MS_SYNC);
+  //Only the header was written, the bitmap is still a hole.
+  msync(ptr, sizeof(ngram_storage_t), MS_SYNC);
   return ptr;
 }
 
-void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
+uint64_t ngram_index(const ngram_storage_t *ngramstorage, const uint8_t *grams) {
   int i;
   uint64_t pos;
 
@@ -158,6 +217,12 @@ void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
     pos *= (ngramstorage->gram_max + 1);
     pos += grams[i];
   }
+  return pos;
+}
+
+void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
+  uint64_t pos = ngram_index(ngramstorage, grams);
+
   //assert(printf("%08lX %08lx %02x %x\n", (long)pos, (long)(pos >> 3), (int)(1 << (pos & 7)), (int)(pos & 7)));
   ngramstorage->bits[pos >> 3] |= 1 << (pos & 7);
   /* putchar('\t'); */
@@ -165,39 +230,149 @@ void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
   /* putchar('\n'); */
 }
 
+int test_and_set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
+  uint64_t pos = ngram_index(ngramstorage, grams);
+  uint8_t old;
+
+  old = ngramstorage->bits[pos >> 3];
+  ngramstorage->bits[pos >> 3] = old | (1 << (pos & 7));
+  return (old & (1 << (pos & 7))) == 0;
+}
+
 int find_ngram(ngram_storage_t *ngramstorage, uint8_t *grams) {
-  int i;
-  uint64_t pos;
+  uint64_t pos = ngram_index(ngramstorage, grams);
 
-  pos = *grams;
-  for(i = 1; i < ngramstorage->n; ++i) {
-    assert(grams[i] <= ngramstorage->gram_max);
-    pos *= (ngramstorage->gram_max + 1);
-    pos += grams[i];
-  }
   return ngramstorage->bits[pos >> 3] & (1 << (pos & 7));
 }
 
 
+int ngram_storage_next_data(const ngram_storage_t *ngramstorage, uint64_t offset, uint64_t *begin, uint64_t *end) {
+  const off_t base = sizeof(ngram_storage_t);
+  const uint64_t size = ngramstorage->SIZE - base;
+  int fd = storage_fd(ngramstorage);
+  off_t data, hole;
+
+  if(offset >= size) return 0;
+  *begin = offset;
+  *end = size;
+  if(fd < 0) return 1;
+  data = lseek(fd, base + offset, SEEK_DATA);
+  if(data < 0) return errno == ENXIO ? 0 : 1;
+  hole = lseek(fd, data, SEEK_HOLE);
+  *begin = data - base;
+  if(*begin >= size) return 0;
+  if(hole >= 0 && (uint64_t)(hole - base) < size) *end = hole - base;
+  return 1;
+}
+
 void close_ngram_storage(ngram_storage_t *ngramstorage) {
+  long page = sysconf(_SC_PAGESIZE);
+  uint64_t offset = 0, begin, end;
+  uintptr_t first, last;
+
   ngramstorage->counter--;
-  msync(ngramstorage, ngramstorage->SIZE, MS_SYNC);
+  msync(ngramstorage, sizeof(ngram_storage_t), MS_SYNC);
+  //Holes can not hold dirty pages, only the data ranges need syncing.
+  while(ngram_storage_next_data(ngramstorage, offset, &begin, &end)) {
+    first = (uintptr_t)(ngramstorage->bits + begin) & ~(uintptr_t)(page - 1);
+    last = (uintptr_t)(ngramstorage->bits + end);
+    msync((void*)first, last - first, MS_SYNC);
+    offset = end;
+  }
+  unregister_storage(ngramstorage);
   munmap(ngramstorage, ngramstorage->SIZE);
 }
 
+void close_ngram_storage_readonly(ngram_storage_t *ngramstorage) {
+  unregister_storage(ngramstorage);
+  munmap(ngramstorage, ngramstorage->SIZE);
+}
+
+/* Write all of buf at offset, returns 0 or -1. */
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+  ssize_t written;
+
+  while(len > 0) {
+    written = pwrite(fd, buf, len, offset);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    buf = (const char*)buf + written;
+    len -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+int copy_ngram_storage(const ngram_storage_t *ngramstorage, const char *fname) {
+  const size_t block = 1 << 16;
+  const uint8_t *data = (const uint8_t*)ngramstorage;
+  static const uint8_t zeros[1 << 16];
+  struct stat copystat;
+  uint64_t offset = 0, begin, end, pos, len;
+  int fd, err;
+
+  fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0) return -1;
+  if(ftruncate(fd, ngramstorage->SIZE) != 0) goto error;
+  if(pwrite_all(fd, data, sizeof(ngram_storage_t), 0) != 0) goto error;
+  data += sizeof(ngram_storage_t);
+  while(ngram_storage_next_data(ngramstorage, offset, &begin, &end)) {
+    for(pos = begin; pos < end; pos += len) {
+      len = end - pos < block ? end - pos : block;
+      if(memcmp(data + pos, zeros, len) != 0 && pwrite_all(fd, data + pos, len, sizeof(ngram_storage_t) + pos) != 0) goto error;
+    }
+    offset = end;
+  }
+  if(fstat(fd, &copystat) != 0) goto error;
+  if(pwrite_all(fd, &copystat, sizeof(copystat), offsetof(ngram_storage_t, fstat)) != 0) goto error;
+  if(fsync(fd) != 0) goto error;
+  return close(fd);
+ error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+int adopt_ngram_storage(const char *fname) {
+  char magic[sizeof(((ngram_storage_t*)0)->MAGIC)];
+  struct stat filestat;
+  int fd, err;
+
+  fd = open(fname, O_RDWR);
+  if(fd < 0) return -1;
+  if(pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || strcmp(magic, STORAGE_MAGIC) != 0) {
+    errno = EINVAL;
+    goto error;
+  }
+  if(fstat(fd, &filestat) != 0) goto error;
+  if(pwrite_all(fd, &filestat, sizeof(filestat), offsetof(ngram_storage_t, fstat)) != 0) goto error;
+  if(fsync(fd) != 0) goto error;
+  return close(fd);
+ error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
 double population_count(ngram_storage_t *ngramstorage) {
-  uint64_t i;
-  int v;
+  const uint64_t bytes = ngramstorage->maxindex / 8;
+  uint64_t offset = 0, begin, end, i, word;
   unsigned long count = 0;
 
-  for(i = 0; i < ngramstorage->maxindex / 8; ++i) {
-    int a, b, c;
-    v = ngramstorage->bits[i];
-    a = (v & 0x55) + ((v >> 1) & 0x55);
-    b = (a & 0x33) + ((a >> 2) & 0x33);
-    c = (b & 0x0f) + ((b >> 4) & 0x0f);
-    count += c;
+  //Holes are never touched, so they do not get mapped in.
+  while(offset < bytes && ngram_storage_next_data(ngramstorage, offset, &begin, &end)) {
+    if(end > bytes) end = bytes;
+    for(i = begin; i + 8 <= end; i += 8) {
+      memcpy(&word, ngramstorage->bits + i, sizeof(word));
+      count += __builtin_popcountll(word);
+    }
+    for(; i < end; ++i) count += __builtin_popcount(ngramstorage->bits[i]);
+    offset = end;
   }
-  return (double)count / i;
+  return (double)count / bytes;
 }
 
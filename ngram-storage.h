@@ -12,7 +12,7 @@ extern "C" {
 #define MAX_NGRAM_BUFFER 0x1000
 #define DEFAULT_STORAGE_FILENAME "N-GRAM_STORAGE"
 #define NGRAMMAJORVERSION 1
-#define NGRAMMINORVERSION 3
+#define NGRAMMINORVERSION 4
 
 typedef struct Ngram_Storage {
   union {
@@ -28,6 +28,7 @@ typedef struct Ngram_Storage {
       long double combinations;
       struct stat fstat;
       unsigned long counter;
+      uint64_t generation; //!< incremented by every snapshot (since 1.4)
     };
   };
   uint8_t ngram_buffer[MAX_NGRAM_BUFFER];
@@ -37,10 +38,54 @@ typedef struct Ngram_Storage {
 
 ngram_storage_t *open_ngram_storage(const char *fname);
 ngram_storage_t *create_ngram_storage(const char *fname, int gram_max, int n);
+/*! \brief map a storage without write access
+ *
+ * The storage can be shared by many readers. It must be closed with
+ * close_ngram_storage_readonly() and must not be modified.
+ *
+ * \param fname file name of the storage
+ * \return pointer to the storage or NULL on error
+ */
+ngram_storage_t *open_ngram_storage_readonly(const char *fname);
 
+/*! \brief bit index of an n-gram in the storage
+ *
+ * The n values are the digits of the index in base gram_max + 1.
+ */
+uint64_t ngram_index(const ngram_storage_t *ngramstorage, const uint8_t *grams);
 void set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
+/*! \brief set the bit of an n-gram and report whether it was new
+ *
+ * \param ngramstorage pointer to the storage data-structure
+ * \param grams pointer to n values
+ * \return 1 if the bit was not set before, 0 otherwise
+ */
+int test_and_set_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
 int find_ngram(ngram_storage_t *ngramstorage, uint8_t *grams);
 void close_ngram_storage(ngram_storage_t *ngramstorage);
+void close_ngram_storage_readonly(ngram_storage_t *ngramstorage);
+/*! \brief write a copy of a storage to a new file
+ *
+ * Zero blocks of the bitmap are skipped, so the copy is sparse. The
+ * recorded file identity is updated, the copy can be opened like the
+ * original.
+ *
+ * \param ngramstorage storage to copy
+ * \param fname name of the copy, overwritten
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int copy_ngram_storage(const ngram_storage_t *ngramstorage, const char *fname);
+/*! \brief record the identity of a copied or moved storage file
+ *
+ * open_ngram_storage() refuses files whose device, inode or size
+ * differ from the recorded ones. After a storage was copied to
+ * another place (e.g. a replica on another node) this records the new
+ * identity.
+ *
+ * \param fname storage file
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int adopt_ngram_storage(const char *fname);
 uint8_t *ngram_from_string(ngram_storage_t *ngramstorage, const char *hextex);
 /*! \brief read values from string and write into target array
  *
@@ -54,6 +99,19 @@ uint8_t *ngram_from_string(ngram_storage_t *ngramstorage, const char *hextex);
  */
 uint8_t *ngram_from_string_into(ngram_storage_t *ngramstorage, const char *hextex, uint8_t *target);
 double population_count(ngram_storage_t *ngramstorage);
+/*! \brief find the next allocated range of the bitmap
+ *
+ * Uses SEEK_DATA/SEEK_HOLE on the storage file, so whole-storage scans
+ * can skip holes. If the file system can not tell, the rest of the
+ * bitmap is reported as one range.
+ *
+ * \param ngramstorage storage
+ * \param offset byte offset in bits[] to start from
+ * \param begin receives the first byte of the range
+ * \param end receives the end of the range (exclusive)
+ * \return 1 if a range was found, 0 if only holes follow
+ */
+int ngram_storage_next_data(const ngram_storage_t *ngramstorage, uint64_t offset, uint64_t *begin, uint64_t *end);
 
 #ifdef __cplusplus
 };
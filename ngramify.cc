@@ -1,93 +1,303 @@
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "batchreader.hh"
+#include "parallel.hh"
+#include "stats.h"
 
 #define MAX_N_GRAM 1024
 
 using namespace std;
 
 
-void print_header(int n, const char *fname) {
-  cout << "#type: n-grams\n";
-  cout << "#n: " << n << endl;
+void print_header(std::string &out, int n, const char *fname) {
+  out += "#type: n-grams\n#n: ";
+  out += to_string(n);
+  out += '\n';
   if(fname != NULL) {
-    cout << "#fname: " << fname << endl;
+    out += "#fname: ";
+    out += fname;
+    out += '\n';
   }
-  cout << endl;
+  out += '\n';
 }
 
 
-int ngramify(int n, FILE *fin, bool verbose) {
-  int buf[MAX_N_GRAM];
+//! Output bytes per n-gram.
+static size_t line_size(int n, bool verbose) {
+  return verbose ? 4 * n + 4 : 3 * n + 1;
+}
+
+
+void ngramify(std::string &out, int n, const uint8_t *data, size_t len, bool verbose) {
+  static const char digits[] = "0123456789ABCDEF";
   int i;
-  unsigned int skip = 0;
   char ch;
 
-  assert(n < MAX_N_GRAM);
-  for(i = 0; i < n; ++i) buf[i] = fgetc(fin);
-  while(!feof(fin)) {
-    for(i = 0; i < n; ++i) printf(" %02X", buf[(i + skip) % n]);
+  out.reserve(out.size() + (len >= static_cast<size_t>(n) ? len - n + 1 : 0) * line_size(n, verbose));
+  for(size_t pos = 0; pos + n <= len; ++pos) {
+    for(i = 0; i < n; ++i) {
+      out += ' ';
+      out += digits[data[pos + i] >> 4];
+      out += digits[data[pos + i] & 0xF];
+    }
     if(verbose) {
-      printf("\t| ");
+      out += "\t| ";
       for(i = 0; i < n; ++i) {
-	ch = buf[(i + skip) % n];
+	ch = data[pos + i];
 	if(!isprint(ch)) ch = '.';
-	putchar(ch);
+	out += ch;
       }
     }
-    putchar('\n');
-    if((buf[skip++ % n] = fgetc(fin)) == -1) break;
+    out += '\n';
+  }
+}
+
+
+//! True for standard input and other files which are not regular (pipes, devices).
+static bool is_stream(const std::string &fname) {
+  struct stat st;
+
+  return fname == "-" || (stat(fname.c_str(), &st) == 0 && !S_ISREG(st.st_mode));
+}
+
+/*! \brief Convert a stream block by block
+ *
+ * Only the last n - 1 bytes are carried to the next block, so endless
+ * input is converted in constant memory.
+ *
+ * \param out pending output (the header), written with the first block
+ * \return false if the input could not be read
+ */
+static bool ngramify_stream(const std::string &fname, int n, bool verbose, std::string &out) {
+  const size_t block = 1 << 16;
+  std::vector<uint8_t> buffer(block + n - 1);
+  int fd = fname == "-" ? 0 : open(fname.c_str(), O_RDONLY);
+  size_t fill = 0, windows;
+  ssize_t got;
+  bool ok = true;
+
+  if(fd < 0) {
+    cerr << "Warning! Can not open file: " << fname << ": " << strerror(errno) << endl;
+    return false;
+  }
+  while((got = read(fd, buffer.data() + fill, block)) != 0) {
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      cerr << "Warning! Can not read file: " << fname << ": " << strerror(errno) << endl;
+      ok = false;
+      break;
+    }
+    fill += got;
+    windows = fill >= static_cast<size_t>(n) ? fill - n + 1 : 0;
+    ngramify(out, n, buffer.data(), fill, verbose);
+    stats_add(got, windows);
+    memmove(buffer.data(), buffer.data() + windows, fill - windows);
+    fill -= windows;
+    fwrite(out.data(), 1, out.size(), stdout);
+    out.clear();
+  }
+  fwrite(out.data(), 1, out.size(), stdout);
+  out.clear();
+  if(fd != 0) close(fd);
+  return ok;
+}
+
+
+/*! \brief Part of a file, the n-grams starting in [begin, end)
+ *
+ * The n-grams at the end need the n - 1 bytes following the chunk, so
+ * neighbouring chunks overlap by n - 1 bytes.
+ */
+struct Chunk {
+  FileView file;
+  size_t begin;
+  size_t end;
+  bool first; //!< first chunk of the file, gets the header
+};
+
+/*! \brief Split the files of a BatchReader into chunks
+ *
+ * Every file gives at least one chunk, even if it is too short for an
+ * n-gram or could not be read.
+ */
+class Chunker {
+  BatchReader::iterator file;
+  size_t n;
+  size_t chunk_size; //!< n-grams per chunk
+  Chunk chunk; //!< last chunk handed out
+public:
+  Chunker(BatchReader &reader, size_t n_, size_t chunk_size_) : file(reader.begin()), n(n_), chunk_size(chunk_size_) { chunk.end = 0; }
+  /*! \brief Get the next chunk
+   *
+   * \return false after the last chunk of the last file
+   */
+  bool next(Chunk &result) {
+    size_t windows = chunk.file.size() >= n ? chunk.file.size() - n + 1 : 0;
+
+    if(chunk.end < windows) {
+      chunk.begin = chunk.end;
+      chunk.first = false;
+    } else {
+      if(file == BatchReader::iterator()) return false;
+      chunk.file = *file;
+      ++file;
+      chunk.begin = 0;
+      chunk.first = true;
+      windows = chunk.file.size() >= n ? chunk.file.size() - n + 1 : 0;
+    }
+    chunk.end = min(chunk.begin + chunk_size, windows);
+    result = chunk;
+    return true;
   }
-  return 0;
+
+  /*! \brief Input iterator over the chunks */
+  class iterator {
+    Chunker *chunker;
+    Chunk chunk;
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Chunk value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Chunk *pointer;
+    typedef const Chunk &reference;
+
+    iterator() : chunker(NULL) { }
+    explicit iterator(Chunker *chunker_) : chunker(chunker_) { ++*this; }
+    const Chunk &operator*() const { return chunk; }
+    iterator &operator++() {
+      if(!chunker->next(chunk)) chunker = NULL;
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return chunker == other.chunker; }
+    bool operator!=(const iterator &other) const { return chunker != other.chunker; }
+  };
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+};
+
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n n-gram] [-v] [-j jobs] [-B chunk-KiB] [-C] [-@ listfile] [--stats[=json]] [<name>...]\n"
+	  "Files are split into chunks which are converted concurrently, the output is the same as for\n"
+	  "one file after the other. Each file gets its own header, -C writes a single header instead.\n"
+	  "-B sets the output per chunk in KiB (default 1024).\n"
+	  "Standard input (-) and other streams are converted block by block as they arrive.\n", name);
+  exit(EXIT_FAILURE);
 }
 
 
 int main(int argc, char **argv) {
   int n = -1;
-  const char *fname = NULL;
   bool verbose = false;
-  FILE *fin;
+  bool combined = false;
+  bool named = false;
+  bool list_stdin = false;
+  unsigned int jobs = 0;
+  size_t chunk_bytes = 1 << 20;
+  vector<string> fnames;
+  atomic<bool> failed(false);
   int opt;
   
-  while ((opt = getopt(argc, argv, "n:v")) != -1) {
-    switch (opt) {
-    case 'n':
-      n = atoi(optarg);
-      break;
-    case 'v':
-      verbose = true;
-      break;
-    default: /* '?' */
-      fprintf(stderr, "Usage: %s  [-n n-gram] [-v] [<name>]\n", argv[0]);
-      exit(EXIT_FAILURE);
+  if(stats_init(&argc, argv, "ngramify") != 0) exit(EXIT_FAILURE);
+  try {
+    while ((opt = getopt(argc, argv, "n:vj:B:C@:")) != -1) {
+      switch (opt) {
+      case 'n':
+	n = atoi(optarg);
+	break;
+      case 'v':
+	verbose = true;
+	break;
+      case 'j':
+	jobs = atoi(optarg);
+	break;
+      case 'B':
+	chunk_bytes = static_cast<size_t>(atol(optarg)) << 10;
+	break;
+      case 'C':
+	combined = true;
+	break;
+      case '@':
+	read_file_list(optarg, fnames);
+	named = true;
+	if(strcmp(optarg, "-") == 0) list_stdin = true;
+	break;
+      default: /* '?' */
+	usage(argv[0]);
+      }
     }
   }
-  if(optind < argc) fname = argv[optind++];
+  catch(const std::exception &excp) {
+    fprintf(stderr, "Error! %s\n", excp.what());
+    exit(EXIT_FAILURE);
+  }
+  if(chunk_bytes == 0) usage(argv[0]);
+  for(; optind < argc; ++optind) fnames.push_back(argv[optind]);
+  if(!fnames.empty()) named = true;
+  if(!named) fnames.push_back("-");
+  if(list_stdin && find(fnames.begin(), fnames.end(), "-") != fnames.end()) {
+    fprintf(stderr, "Error! Standard input can not be both the file list and an input.\n");
+    exit(EXIT_FAILURE);
+  }
   if(n < 1) {
     fprintf(stderr, "You need to provide a value for n.\n");
     exit(EXIT_FAILURE);
   } else if(n >= MAX_N_GRAM) {
     fprintf(stderr, "Maximum n-gram value is %d!\n", MAX_N_GRAM - 1);
   }
-  if(fname != NULL) {
-    fin = fopen(fname, "r");
-    if(!fin) {
-      perror("Error! Can not open file");
-      exit(EXIT_FAILURE);
-    }
-  } else {
-    fin = stdin;
+  //Chunks are sized by their output, which is kept for 2 * jobs chunks in flight.
+  const size_t chunk_size = max(static_cast<size_t>(1), chunk_bytes / line_size(n, verbose));
+  stats_phase("ngramify");
+  if(combined) {
+    string header;
+    print_header(header, n, NULL);
+    header.insert(header.size() - 1, "#files: " + to_string(fnames.size()) + "\n");
+    fwrite(header.data(), 1, header.size(), stdout);
   }
-  print_header(n, fname);
-  ngramify(n, fin, verbose);
-  if(fin != stdin) {
-    if(fclose(fin) == EOF) {
-      perror("Failure on closing file:");
+  //Regular files are split into chunks and converted concurrently,
+  //streams are converted on their own in between.
+  for(size_t i = 0, j; i < fnames.size(); i = j) {
+    if(is_stream(fnames[i])) {
+      string out;
+      if(!combined) print_header(out, n, named ? fnames[i].c_str() : NULL);
+      if(!ngramify_stream(fnames[i], n, verbose, out)) failed = true;
+      j = i + 1;
+      continue;
     }
+    for(j = i + 1; j < fnames.size() && !is_stream(fnames[j]); ++j);
+    BatchReader reader(fnames.begin() + i, fnames.begin() + j);
+    Chunker chunker(reader, n, chunk_size);
+    //Chunks are converted concurrently and written in the order of the files.
+    ordered_parallel_map(chunker.begin(), chunker.end(), jobs, [&](const Chunk &chunk) {
+	string out;
+	if(!chunk.file.ok()) {
+	  if(chunk.first) {
+	    cerr << "Warning! Can not open file: " << chunk.file.get_error() << endl;
+	    failed = true;
+	  }
+	  return out;
+	}
+	if(chunk.first && !combined) print_header(out, n, named ? chunk.file.name().c_str() : NULL);
+	if(chunk.end > chunk.begin) ngramify(out, n, chunk.file.data() + chunk.begin, chunk.end - chunk.begin + n - 1, verbose);
+	stats_add(chunk.first ? chunk.file.size() : 0, chunk.end - chunk.begin);
+	return out;
+      }, [](const string &out) {
+	fwrite(out.data(), 1, out.size(), stdout);
+      });
   }
-  return 0;
+  fflush(stdout);
+  return failed ? EXIT_FAILURE : 0;
 }
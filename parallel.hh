@@ -0,0 +1,115 @@
+#ifndef __PARALLEL_HH_2026__
+#define __PARALLEL_HH_2026__
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*! \brief Minimal fixed size thread pool
+ *
+ * Tasks are executed in submission order by the first free worker.
+ * The destructor finishes all queued tasks before joining.
+ */
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopping;
+
+  void work() {
+    while(true) {
+      std::function<void()> task;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	cond.wait(lock, [this] { return stopping || !tasks.empty(); });
+	if(tasks.empty()) return;
+	task = std::move(tasks.front());
+	tasks.pop_front();
+      }
+      task();
+    }
+  }
+public:
+  /*! \brief Constructor
+   *
+   * \param threads number of workers, 0 means one per hardware thread
+   */
+  explicit ThreadPool(unsigned int threads) : stopping(false) {
+    if(threads == 0) threads = default_threads();
+    for(unsigned int i = 0; i < threads; ++i) workers.emplace_back(&ThreadPool::work, this);
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cond.notify_all();
+    for(auto &worker : workers) worker.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /*! \brief Queue a task
+   *
+   * \return future for the result, exceptions are passed through it
+   */
+  template<class Fun>
+  std::future<decltype(std::declval<Fun&>()())> submit(Fun fun) {
+    typedef decltype(fun()) result_type;
+    auto task = std::make_shared<std::packaged_task<result_type()> >(std::move(fun));
+    std::future<result_type> result(task->get_future());
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace_back([task] { (*task)(); });
+    }
+    cond.notify_one();
+    return result;
+  }
+
+  size_t size() const { return workers.size(); }
+
+  static unsigned int default_threads() {
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+  }
+};
+
+
+/*! \brief Map a function over a range on a thread pool
+ *
+ * The results are handed to the sink in input order as soon as they
+ * (and all preceding ones) are finished. At most a few results per
+ * worker are kept in flight, so memory stays bounded regardless of
+ * the length of the range. An exception thrown by the function is
+ * rethrown when its result is due.
+ *
+ * \param first begin of input range
+ * \param last end of input range
+ * \param jobs number of worker threads, 0 means one per hardware thread
+ * \param fun function applied to each element
+ * \param sink called with each result in input order
+ */
+template<class InputIt, class Fun, class Sink>
+void ordered_parallel_map(InputIt first, InputIt last, unsigned int jobs, Fun fun, Sink sink) {
+  typedef decltype(fun(*first)) result_type;
+  ThreadPool pool(jobs);
+  std::deque<std::future<result_type> > pending;
+  const size_t window = 2 * pool.size();
+
+  for(; first != last; ++first) {
+    pending.push_back(pool.submit([&fun, item = *first] { return fun(item); }));
+    if(pending.size() >= window) {
+      sink(pending.front().get());
+      pending.pop_front();
+    }
+  }
+  for(; !pending.empty(); pending.pop_front()) sink(pending.front().get());
+}
+
+#endif
@@ -0,0 +1,308 @@
+#include "pipeline.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <exception>
+#include <stdexcept>
+
+using namespace std;
+
+
+bool parse_fold_range(const char *spec, uint8_t *table, int &next) {
+  int x, y;
+  bool single;
+
+  if(sscanf(spec, " %x - %x", &x, &y) == 2) {
+    single = false;
+  } else if(sscanf(spec, " %x ~ %x", &x, &y) == 2) {
+    single = true;
+  } else {
+    return false;
+  }
+  if(x < 0 || y > 255 || x > y) return false;
+  for(int j = x; j <= y && next < 256; ++j) {
+    table[j] = next;
+    if(!single) ++next;
+  }
+  if(single) ++next;
+  return true;
+}
+
+
+size_t read_block(int fd, Pipeline_block &block, size_t headroom, size_t size) {
+  size_t done = 0;
+  ssize_t got;
+
+  if(block.buffer.size() < headroom + size) block.buffer.resize(headroom + size);
+  while(done < size) {
+    got = read(fd, block.buffer.data() + headroom + done, size - done);
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      throw runtime_error(string("read: ") + strerror(errno));
+    }
+    if(got == 0) break;
+    done += got;
+  }
+  block.begin = headroom;
+  block.end = headroom + done;
+  block.windows = 0;
+  return done;
+}
+
+
+void fold_block(const uint8_t *table, Pipeline_block &block) {
+  uint8_t *data = block.buffer.data();
+
+  for(size_t i = block.begin; i < block.end; ++i) data[i] = table[data[i]];
+}
+
+
+void Window_state::window(Pipeline_block &block) {
+  size_t keep, size;
+
+  if(block.first) carry.clear();
+  keep = carry.size();
+  memcpy(block.buffer.data() + block.begin - keep, carry.data(), keep);
+  block.begin -= keep;
+  size = block.size();
+  block.windows = size >= n ? size - n + 1 : 0;
+  keep = min(size, static_cast<size_t>(n - 1));
+  carry.assign(block.data() + size - keep, block.data() + size);
+}
+
+
+void index_block(const ngram_storage_t *ngramstorage, unsigned int n, Pipeline_block &block) {
+  const uint8_t *data = block.data();
+  const uint64_t radix = ngramstorage->gram_max + 1;
+  const int gram_max = ngramstorage->gram_max;
+  uint64_t top = 1, index = 0;
+  size_t valid = 0; //!< first window without a value above gram_max
+  unsigned int i;
+
+  block.indices.resize(block.windows);
+  if(block.windows == 0) return;
+  for(i = 1; i < n; ++i) top *= radix;
+  for(i = 0; i < n; ++i) {
+    if(data[i] > gram_max) valid = i + 1;
+    index = index * radix + data[i];
+  }
+  block.indices[0] = valid == 0 ? index : INVALID_NGRAM_INDEX;
+  for(size_t pos = 1; pos < block.windows; ++pos) {
+    if(data[pos + n - 1] > gram_max) valid = pos + n;
+    index = (index - data[pos - 1] * top) * radix + data[pos + n - 1];
+    block.indices[pos] = pos >= valid ? index : INVALID_NGRAM_INDEX;
+  }
+}
+
+
+void Store_sink::consume(const Pipeline_block &block) {
+  uint8_t *bits = storage->bits;
+  const uint64_t *indices = block.indices.data();
+  uint64_t index;
+  uint8_t mask;
+
+  for(size_t i = 0; i < block.windows; ++i) {
+    if(i + 16 < block.windows && indices[i + 16] != INVALID_NGRAM_INDEX) __builtin_prefetch(bits + (indices[i + 16] >> 3), 1);
+    index = indices[i];
+    if(index == INVALID_NGRAM_INDEX) {
+      ++invalid;
+      continue;
+    }
+    mask = 1 << (index & 7);
+    newly_set += (bits[index >> 3] & mask) == 0;
+    bits[index >> 3] |= mask;
+    ++stored;
+  }
+}
+
+
+void Recall_sink::consume(const Pipeline_block &block) {
+  const uint8_t *bits = storage->bits;
+  const uint64_t *indices = block.indices.data();
+  uint64_t index, found = 0, probed = 0;
+
+  if(lookups.size() <= block.input) {
+    lookups.resize(block.input + 1);
+    hits.resize(block.input + 1);
+  }
+  for(size_t i = 0; i < block.windows; ++i) {
+    if(i + 16 < block.windows && indices[i + 16] != INVALID_NGRAM_INDEX) __builtin_prefetch(bits + (indices[i + 16] >> 3));
+    index = indices[i];
+    if(index == INVALID_NGRAM_INDEX) continue;
+    ++probed;
+    found += (bits[index >> 3] >> (index & 7)) & 1;
+  }
+  lookups[block.input] += probed;
+  hits[block.input] += found;
+}
+
+
+Histogram_sink::Histogram_sink(unsigned int n_) : n(n_), used(0) {
+  if(n <= 8) {
+    keys.resize(1 << 16);
+    counts.resize(1 << 16);
+  }
+}
+
+static inline size_t slot_of(uint64_t key, size_t mask) {
+  return (key * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+}
+
+void Histogram_sink::grow() {
+  vector<uint64_t> old_keys(keys.size() * 2), old_counts(counts.size() * 2);
+  size_t mask = old_keys.size() - 1, slot;
+
+  old_keys.swap(keys);
+  old_counts.swap(counts);
+  for(size_t i = 0; i < old_keys.size(); ++i) {
+    if(!old_counts[i]) continue;
+    for(slot = slot_of(old_keys[i], mask); counts[slot]; slot = (slot + 1) & mask);
+    keys[slot] = old_keys[i];
+    counts[slot] = old_counts[i];
+  }
+}
+
+void Histogram_sink::consume(const Pipeline_block &block) {
+  const uint8_t *data = block.data();
+  const uint64_t key_mask = n == 8 ? ~0ULL : (1ULL << (8 * n)) - 1;
+  uint64_t key = 0;
+  size_t mask, slot;
+
+  if(n > 8) {
+    for(size_t pos = 0; pos < block.windows; ++pos) histogram[Ngram_type(data + pos, data + pos + n)] += 1;
+    return;
+  }
+  for(unsigned int i = 0; i + 1 < n && i < block.size(); ++i) key = key << 8 | data[i];
+  mask = keys.size() - 1;
+  for(size_t pos = 0; pos < block.windows; ++pos) {
+    key = (key << 8 | data[pos + n - 1]) & key_mask;
+    for(slot = slot_of(key, mask); counts[slot] && keys[slot] != key; slot = (slot + 1) & mask);
+    if(!counts[slot]) {
+      keys[slot] = key;
+      if(2 * ++used > keys.size()) {
+	counts[slot] = 1;
+	grow();
+	mask = keys.size() - 1;
+	continue;
+      }
+    }
+    ++counts[slot];
+  }
+}
+
+
+void Ngram_text_sink::consume(const Pipeline_block &block) {
+  static const char digits[] = "0123456789ABCDEF";
+  const uint8_t *data = block.data();
+
+  for(size_t pos = 0; pos < block.windows; ++pos) {
+    for(unsigned int i = 0; i < n; ++i) {
+      buffer += ' ';
+      buffer += digits[data[pos + i] >> 4];
+      buffer += digits[data[pos + i] & 0xF];
+    }
+    buffer += '\n';
+    if(buffer.size() >= (1 << 16)) {
+      fwrite(buffer.data(), 1, buffer.size(), out);
+      buffer.clear();
+    }
+  }
+}
+
+void Ngram_text_sink::finish() {
+  fwrite(buffer.data(), 1, buffer.size(), out);
+  buffer.clear();
+  fflush(out);
+}
+
+
+Pipeline_stats run_pipeline(const vector<string> &inputs, const Pipeline_config &config, Pipeline_sink &sink) {
+  const size_t headroom = config.n - 1;
+  const bool indices = config.storage && sink.needs_indices();
+  Spsc_queue<Block_ptr> read_queue(config.queue_depth), fold_queue(config.queue_depth), window_queue(config.queue_depth);
+  Spsc_queue<Block_ptr> free_queue(4 * config.queue_depth);
+  Spsc_queue<Block_ptr> &window_input = config.fold_table ? fold_queue : read_queue;
+  exception_ptr reader_error, sink_error;
+  atomic<bool> aborted(false);
+  uint64_t bytes_read = 0;
+  Pipeline_stats stats = { 0 };
+  Block_ptr block;
+
+  thread reader([&] {
+      try {
+	for(size_t i = 0; i < inputs.size() && !aborted; ++i) {
+	  int fd = inputs[i] == "-" ? 0 : open(inputs[i].c_str(), O_RDONLY);
+	  bool first = true;
+
+	  if(fd < 0) throw runtime_error(inputs[i] + ": " + strerror(errno));
+	  while(!aborted) {
+	    Block_ptr next;
+	    if(!free_queue.try_pop(next)) next.reset(new Pipeline_block);
+	    next->input = i;
+	    next->first = first;
+	    size_t got = read_block(fd, *next, headroom, config.block_size);
+	    bytes_read += got;
+	    //Every input gets at least one block, so sinks see empty inputs.
+	    if(got == 0 && !first) break;
+	    first = false;
+	    read_queue.push(move(next));
+	    if(got == 0) break;
+	  }
+	  if(fd != 0) close(fd);
+	}
+      }
+      catch(...) {
+	reader_error = current_exception();
+      }
+      read_queue.close();
+    });
+  thread folder;
+  if(config.fold_table) {
+    folder = thread([&] {
+	Block_ptr next;
+	while(read_queue.pop(next)) {
+	  fold_block(config.fold_table, *next);
+	  fold_queue.push(move(next));
+	}
+	fold_queue.close();
+      });
+  }
+  thread windower([&] {
+      Window_state state(config.n);
+      Block_ptr next;
+      while(window_input.pop(next)) {
+	state.window(*next);
+	if(indices) index_block(config.storage, config.n, *next);
+	window_queue.push(move(next));
+      }
+      window_queue.close();
+    });
+  while(window_queue.pop(block)) {
+    //After an error the queue is drained, so no stage blocks forever.
+    if(!sink_error) {
+      try {
+	sink.consume(*block);
+      }
+      catch(...) {
+	sink_error = current_exception();
+	aborted = true;
+      }
+    }
+    stats.windows += block->windows;
+    ++stats.blocks;
+    free_queue.try_push(block);
+    block.reset();
+  }
+  reader.join();
+  if(folder.joinable()) folder.join();
+  windower.join();
+  if(sink_error) rethrow_exception(sink_error);
+  if(reader_error) rethrow_exception(reader_error);
+  sink.finish();
+  stats.bytes = bytes_read;
+  stats.full_waits = read_queue.get_full_waits() + fold_queue.get_full_waits() + window_queue.get_full_waits();
+  stats.empty_waits = read_queue.get_empty_waits() + fold_queue.get_empty_waits() + window_queue.get_empty_waits();
+  return stats;
+}
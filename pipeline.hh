@@ -0,0 +1,321 @@
+#ifndef __PIPELINE_HH_2026__
+#define __PIPELINE_HH_2026__
+#include <inttypes.h>
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "histogram-runs.hh"
+#include "ngram-storage.h"
+
+/*! \brief Bounded lock-free single producer single consumer queue
+ *
+ * A full queue makes the producer wait (backpressure), an empty one
+ * the consumer. Waiting spins for a short while and then blocks on a
+ * condition variable, which is only signalled if a side sleeps. After
+ * close() the consumer drains the remaining items.
+ */
+template<class T>
+class Spsc_queue {
+  std::vector<T> slots;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head; //!< next item to pop
+  alignas(64) std::atomic<size_t> tail; //!< next slot to push
+  std::atomic<bool> closed;
+  std::atomic<int> sleepers; //!< threads blocked in wait()
+  std::mutex mutex;
+  std::condition_variable cond;
+  uint64_t full_waits; //!< only touched by the producer
+  uint64_t empty_waits; //!< only touched by the consumer
+
+  //! Spin a little, then sleep until ready() holds.
+  template<class Ready>
+  void wait(unsigned int &spins, Ready ready) {
+    if(++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleepers.fetch_add(1);
+    cond.wait(lock, ready);
+    sleepers.fetch_sub(1);
+  }
+  //! Wake the other side if it sleeps.
+  void wake() {
+    //Orders the preceding head/tail/closed store before the load of sleepers.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_all();
+    }
+  }
+  bool full() const { return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) > mask; }
+  bool empty() const { return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire); }
+public:
+  /*! \brief Constructor
+   *
+   * \param capacity number of slots, rounded up to a power of two
+   */
+  explicit Spsc_queue(size_t capacity) : head(0), tail(0), closed(false), sleepers(0), full_waits(0), empty_waits(0) {
+    size_t size = 2;
+
+    while(size < capacity) size *= 2;
+    slots.resize(size);
+    mask = size - 1;
+  }
+  Spsc_queue(const Spsc_queue &) = delete;
+  Spsc_queue &operator=(const Spsc_queue &) = delete;
+
+  bool try_push(T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+
+    if(t - head.load(std::memory_order_acquire) > mask) return false;
+    slots[t & mask] = std::move(item);
+    tail.store(t + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+  void push(T item) {
+    unsigned int spins = 0;
+
+    if(try_push(item)) return;
+    ++full_waits;
+    while(!try_push(item)) wait(spins, [this] { return !full(); });
+  }
+  bool try_pop(T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+
+    if(h == tail.load(std::memory_order_acquire)) return false;
+    item = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+  /*! \brief Take the next item
+   *
+   * \return false if the queue is closed and empty
+   */
+  bool pop(T &item) {
+    unsigned int spins = 0;
+
+    if(try_pop(item)) return true;
+    ++empty_waits;
+    while(!try_pop(item)) {
+      if(closed.load(std::memory_order_acquire)) return try_pop(item);
+      wait(spins, [this] { return closed.load(std::memory_order_acquire) || !empty(); });
+    }
+    return true;
+  }
+  //! Called by the producer after the last push.
+  void close() {
+    closed.store(true, std::memory_order_release);
+    wake();
+  }
+  uint64_t get_full_waits() const { return full_waits; }
+  uint64_t get_empty_waits() const { return empty_waits; }
+};
+
+
+/*! \brief A buffer of input bytes travelling through the pipeline
+ *
+ * The reader fills the buffer behind headroom of n - 1 bytes. The
+ * window stage copies the last bytes of the previous block of the same
+ * input into the headroom, so the n-grams spanning both blocks are
+ * complete without copying the block.
+ */
+struct Pipeline_block {
+  std::vector<uint8_t> buffer;
+  size_t begin; //!< first byte, including carried bytes after windowing
+  size_t end;
+  size_t input; //!< number of the input file
+  bool first; //!< first block of the input
+  size_t windows; //!< n-grams starting in [begin, end), set by the window stage
+  std::vector<uint64_t> indices; //!< storage index per n-gram, set by index_block()
+
+  const uint8_t *data() const { return buffer.data() + begin; }
+  size_t size() const { return end - begin; }
+};
+
+typedef std::unique_ptr<Pipeline_block> Block_ptr;
+
+//! Index of n-grams with values above gram_max.
+static const uint64_t INVALID_NGRAM_INDEX = ~0ULL;
+
+/*! \brief Parse a fold range in the syntax of emmagrammer foltran
+ *
+ * "x-y" maps the values x to y onto consecutive new values, "x~y"
+ * maps all of them onto one new value.
+ *
+ * \param spec range of hex values
+ * \param table fold table to update
+ * \param next next new value, updated
+ * \return false on a syntax error or illegal value
+ */
+bool parse_fold_range(const char *spec, uint8_t *table, int &next);
+
+/*! \brief Reader stage: read the next block of an input
+ *
+ * \param fd input file
+ * \param block block to fill, its headroom and size are kept
+ * \param headroom bytes to leave in front (n - 1)
+ * \param size bytes to read at most
+ * \return bytes read, 0 at the end of the input
+ * \throw std::runtime_error on read errors
+ */
+size_t read_block(int fd, Pipeline_block &block, size_t headroom, size_t size);
+
+/*! \brief Fold stage: map the new bytes of a block through a table */
+void fold_block(const uint8_t *table, Pipeline_block &block);
+
+/*! \brief State of the window stage (bytes carried to the next block) */
+class Window_state {
+  unsigned int n;
+  std::vector<uint8_t> carry;
+public:
+  explicit Window_state(unsigned int n_) : n(n_) { }
+  /*! \brief Window stage: prepend the carried bytes and count the n-grams
+   *
+   * The carry is reset at the first block of every input, so n-grams
+   * never span two inputs.
+   */
+  void window(Pipeline_block &block);
+};
+
+/*! \brief Index stage: compute the storage index of every n-gram
+ *
+ * The index is rolled from window to window instead of recomputed.
+ * N-grams with a value above gram_max get INVALID_NGRAM_INDEX.
+ */
+void index_block(const ngram_storage_t *ngramstorage, unsigned int n, Pipeline_block &block);
+
+/*! \brief Last stage of a pipeline, runs on the calling thread */
+class Pipeline_sink {
+public:
+  virtual ~Pipeline_sink() { }
+  //! True if the sink wants Pipeline_block::indices.
+  virtual bool needs_indices() const { return false; }
+  virtual void consume(const Pipeline_block &block) = 0;
+  //! Called once after the last block.
+  virtual void finish() { }
+};
+
+/*! \brief Set the n-grams in a storage */
+class Store_sink : public Pipeline_sink {
+  ngram_storage_t *storage;
+public:
+  uint64_t stored;
+  uint64_t newly_set;
+  uint64_t invalid;
+
+  explicit Store_sink(ngram_storage_t *storage_) : storage(storage_), stored(0), newly_set(0), invalid(0) { }
+  bool needs_indices() const { return true; }
+  void consume(const Pipeline_block &block);
+};
+
+/*! \brief Count the n-grams found in a storage, per input */
+class Recall_sink : public Pipeline_sink {
+  const ngram_storage_t *storage;
+public:
+  std::vector<uint64_t> lookups;
+  std::vector<uint64_t> hits;
+
+  explicit Recall_sink(const ngram_storage_t *storage_) : storage(storage_) { }
+  bool needs_indices() const { return true; }
+  void consume(const Pipeline_block &block);
+};
+
+/*! \brief Count the n-grams in memory, written like histogramify does
+ *
+ * N-grams of up to 8 bytes are packed into an integer and counted in
+ * an open addressing hash table, longer ones in a Histogram_type.
+ */
+class Histogram_sink : public Pipeline_sink {
+  unsigned int n;
+  std::vector<uint64_t> keys; //!< n-grams packed big endian
+  std::vector<uint64_t> counts; //!< 0 marks a free slot
+  size_t used;
+  Histogram_type histogram; //!< n-grams above 8 bytes
+
+  void grow();
+public:
+  explicit Histogram_sink(unsigned int n_);
+  void consume(const Pipeline_block &block);
+  //! Number of distinct n-grams.
+  size_t size() const { return n <= 8 ? used : histogram.size(); }
+  /*! \brief Hand out the entries in ascending n-gram order */
+  template<class Fun>
+  void for_each(Fun fun) const;
+};
+
+/*! \brief Write the n-grams in the text format of ngramify */
+class Ngram_text_sink : public Pipeline_sink {
+  unsigned int n;
+  FILE *out;
+  std::string buffer;
+public:
+  Ngram_text_sink(unsigned int n_, FILE *out_) : n(n_), out(out_) { buffer.reserve(1 << 17); }
+  void consume(const Pipeline_block &block);
+  void finish();
+};
+
+/*! \brief Pipeline settings */
+struct Pipeline_config {
+  unsigned int n;
+  size_t block_size; //!< bytes read per block
+  size_t queue_depth; //!< blocks per queue
+  const uint8_t *fold_table; //!< NULL for no folding
+  const ngram_storage_t *storage; //!< for the index stage
+};
+
+/*! \brief Counts of a pipeline run */
+struct Pipeline_stats {
+  uint64_t bytes;
+  uint64_t windows;
+  uint64_t blocks;
+  uint64_t full_waits; //!< pushes that found a full queue
+  uint64_t empty_waits; //!< pops that found an empty queue
+};
+
+/*! \brief Run reader, fold, window and index stages on worker threads
+ *
+ * Blocks are passed through bounded queues and handed to the sink on
+ * the calling thread in input order. Used blocks go back to the reader
+ * through another queue.
+ *
+ * \param inputs file names, "-" is standard input
+ * \param config settings
+ * \param sink last stage
+ * \return counts
+ * \throw std::runtime_error if an input can not be read
+ */
+Pipeline_stats run_pipeline(const std::vector<std::string> &inputs, const Pipeline_config &config, Pipeline_sink &sink);
+
+
+template<class Fun>
+void Histogram_sink::for_each(Fun fun) const {
+  std::vector<std::pair<uint64_t, uint64_t> > sorted;
+  Ngram_type ngram(n);
+
+  if(n > 8) {
+    for(auto &entry : histogram) fun(entry.first, entry.second);
+    return;
+  }
+  sorted.reserve(used);
+  for(size_t i = 0; i < keys.size(); ++i) {
+    if(counts[i]) sorted.emplace_back(keys[i], counts[i]);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  for(auto &entry : sorted) {
+    for(unsigned int i = 0; i < n; ++i) ngram[i] = entry.first >> (8 * (n - 1 - i));
+    fun(ngram, entry.second);
+  }
+}
+
+#endif
@@ -7,16 +7,24 @@
 #include <sys/stat.h>
 #include <iostream>
 #include <algorithm>
+#include <numeric>
 #include <string>
 #include <set>
 #include <memory>
+#include <mutex>
 #include <fstream>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include <json/json.h>
-
-
-typedef std::vector<std::string> ChunkSet;
+#include "chunkset.hh"
+#include "chunkstore.hh"
+#include "parallel.hh"
+#include "minhash.hh"
+#include "suffixarray.hh"
+#include "anchors.hh"
+#include "approxmatch.hh"
+#include "batchreader.hh"
+#include "stats.h"
 
 
 struct CLIParams {
@@ -25,6 +33,20 @@ struct CLIParams {
   std::vector<const char *> filenames;
   std::string chunkstorage;
   std::string subtract_chunks;
+  bool probe; //!< stream later files through a hash table of the candidates
+  unsigned int jobs; //!< worker threads, 0 means one per hardware thread
+  bool binary_storage; //!< write the chunk storage in the binary format
+  std::string convert_storage; //!< storage to convert into the chunk storage
+  std::string locations; //!< report file for the chunk locations
+  bool locations_csv; //!< write the location report as CSV instead of JSON
+  double similarity; //!< MinHash similarity threshold, negative if not used
+  unsigned int minhash_size; //!< number of MinHash bins
+  unsigned int bands; //!< number of LSH bands
+  std::string signatures; //!< signature corpus file
+  unsigned int common_length; //!< minimum common substring length, 0 if not used
+  unsigned int min_files; //!< files sharing a common substring, 0 means all
+  unsigned int anchor_window; //!< winnowing window for anchored chunks, 0 if not used
+  int max_mismatches; //!< Hamming distance for approximate chunks, negative if not used
 };
 
 static CLIParams cli_parse(int argc, char **argv) {
@@ -34,14 +56,32 @@ static CLIParams cli_parse(int argc, char **argv) {
     { "n-gram-size", required_argument, 0, 'n' },
     { "chunk-storage", required_argument, 0, 'S' },
     { "subtract-chunks", required_argument, 0, 's' },
+    { "probe", no_argument, 0, 'p' },
+    { "jobs", required_argument, 0, 'j' },
+    { "binary-storage", no_argument, 0, 'B' },
+    { "convert-storage", required_argument, 0, 'C' },
+    { "locations", required_argument, 0, 'L' },
+    { "similarity", required_argument, 0, 'M' },
+    { "minhash-size", required_argument, 0, 'K' },
+    { "bands", required_argument, 0, 'b' },
+    { "signatures", required_argument, 0, 'G' },
+    { "common-substrings", required_argument, 0, 'c' },
+    { "min-files", required_argument, 0, 'k' },
+    { "anchored", required_argument, 0, 'A' },
+    { "max-mismatches", required_argument, 0, 'm' },
     { 0, 0, 0, 0 }
   };
   CLIParams cli_pars = {
     5
   };
+  cli_pars.jobs = 1;
+  cli_pars.similarity = -1;
+  cli_pars.minhash_size = 128;
+  cli_pars.bands = 32;
+  cli_pars.max_mismatches = -1;
 
   while(true) {
-    c = getopt_long(argc, argv, "n:S:s:", long_options, &cli_pars.optindex);
+    c = getopt_long(argc, argv, "n:S:s:pj:BC:L:M:K:b:G:c:k:A:m:", long_options, &cli_pars.optindex);
     if(c == -1) {
       break;
     }
@@ -55,10 +95,53 @@ static CLIParams cli_parse(int argc, char **argv) {
     case 's':
       cli_pars.subtract_chunks = optarg;
       break;
+    case 'p':
+      cli_pars.probe = true;
+      break;
+    case 'j':
+      cli_pars.jobs = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'B':
+      cli_pars.binary_storage = true;
+      break;
+    case 'C':
+      cli_pars.convert_storage = optarg;
+      break;
+    case 'L':
+      cli_pars.locations = optarg;
+      cli_pars.locations_csv = cli_pars.locations.size() > 4 && cli_pars.locations.compare(cli_pars.locations.size() - 4, 4, ".csv") == 0;
+      break;
+    case 'M':
+      cli_pars.similarity = boost::lexical_cast<double>(optarg);
+      break;
+    case 'K':
+      cli_pars.minhash_size = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'b':
+      cli_pars.bands = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'G':
+      cli_pars.signatures = optarg;
+      break;
+    case 'c':
+      cli_pars.common_length = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'k':
+      cli_pars.min_files = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'A':
+      cli_pars.anchor_window = boost::lexical_cast<unsigned int>(optarg);
+      break;
+    case 'm':
+      cli_pars.max_mismatches = boost::lexical_cast<int>(optarg);
+      if(cli_pars.max_mismatches < 0) throw std::invalid_argument("--max-mismatches must not be negative");
+      break;
     default:
       fprintf(stderr, "?? getopt returned character code $%02x ??\n", c);
     }
   }
+  if(cli_pars.minhash_size == 0) throw std::invalid_argument("--minhash-size must be positive");
+  if(cli_pars.similarity >= 0 && cli_pars.n == 0) throw std::invalid_argument("--similarity needs a positive --n-gram-size");
   cli_pars.optindex = optind;
   names_size = argc - cli_pars.optindex;
   if(names_size > 0) {
@@ -68,178 +151,89 @@ static CLIParams cli_parse(int argc, char **argv) {
   return cli_pars;
 }
 
-class Chunker {
-public:
-  class const_iterator {
-  public:
-    // Apparently we need all of the following types to be a correct
-    // forward Iterator. Too much boilerplate...
-    typedef const_iterator self_type;
-    typedef std::string value_type;
-    typedef std::string& reference;
-    typedef std::string const_reference;
-    typedef std::string* pointer;
-    typedef long difference_type;
-    typedef std::forward_iterator_tag iterator_category;
-    const_iterator(const Chunker &chunker_, unsigned long pos_) : chunker(chunker_), pos(pos_) { }
-    self_type operator++() { self_type i = *this; pos++; return i; }
-    self_type operator++(int junk) { pos++; return *this; }
-    // This is *not* a const reference as we use a local
-    // temporary. STL algorithms seem to be fine with it.
-    std::string operator*() const {
-      return chunker.data->substr(pos, chunker.n_gram);
-    }
-    //const pointer operator->() { return &(chunker.data->substr(pos, n_gram)); }
-    //bool operator==(const self_type& rhs) const { return pos == rhs.pos; }
-    bool operator!=(const self_type& rhs) const { return pos != rhs.pos; }
-  private:
-    std::string argl;
-    const Chunker &chunker;
-    unsigned long pos;
-  };
-
-private:
-  unsigned long pos;
-  std::shared_ptr<std::string> data;
-  unsigned int n_gram;
-public:
-  Chunker(const char *fname, unsigned int n) : pos(0), data(NULL), n_gram(n) {
-    //Using C-style input output as C++ really sucks on binary files!
-    FILE *fin;
-    struct stat buf;
-    std::string error;
-    size_t bread; //number of bytes read
-
-    data = std::shared_ptr<std::string>(new std::string);
-    if(stat(fname, &buf) == -1) {
-      error = std::strerror(errno);
-      throw std::runtime_error(error);
-    } else {
-      if(!S_ISREG(buf.st_mode)) {
-	std::ostringstream out;
-	out << '\'' << fname << "' is not a regular file";
-	throw std::runtime_error(out.str());
-      }
-    }
-    if(!(fin = fopen(fname, "rb"))) {
-      error = std::strerror(errno);
-      throw std::runtime_error(error);
-    }
-    data->resize(buf.st_size);
-    bread = fread(&(*data)[0], 1, buf.st_size, fin);
-    if(bread != static_cast<size_t>(buf.st_size)) {
-      throw std::runtime_error(str(boost::format("not all data (%06lx != %06lx) could be read") % bread % buf.st_size));
-    }
-    fclose(fin);
-  }
-  const_iterator begin() const { return const_iterator(*this, 0); }
-  const_iterator end() const {
-    // Chunker ret(*this);
-    // ret.pos = data->size() - n_gram + 1;
-    // return ret;
-    return const_iterator(*this, data->size() - n_gram + 1);
-  }
-  Chunker operator++() {
-    ++pos;
-    return *this;
-  }
-  // Chunker operator++(int) {
-  //   Chunker ret(*this);
-  //   ++pos;
-  //   return ret;
-  // }  
-  bool operator!=(const Chunker &x) const {
-    return pos < x.pos;
-  }
-    
-  std::string operator*() const {
-    return data->substr(pos, n_gram);
-  }
-};
-
-/*! \brief calculate all the chunks in a file
- *
- * This function will return a sorted list of unique chunks.
- * 
- * \param fname filename of file to open
- * \param n chunk length
- */
-ChunkSet calculate_chunks(const char *fname, int n) {
-  Chunker chunker(fname, n);
-  ChunkSet chunks(chunker.begin(), chunker.end());
-
-  std::sort(chunks.begin(), chunks.end());
-  auto last = std::unique(chunks.begin(), chunks.end());
-  chunks.erase(last, chunks.end());
-  return chunks;
-}
-
-
 /*! \brief Simple chunk-set reader class (functor)
  *
  * This class reads chunks from a json file. The set is checked for
  * the correct chunk length and normalised.
  */
+template<class Keys>
 class ChunkSetReader {
-  ChunkSet chunkset; //!< here the chunkset is stored
+  ChunkSet<Keys> chunkset; //!< here the chunkset is stored
 public:
   /*! \brief Constructor from stream
    *
-   * \param n chunk length
+   * \param keys key representation with the chunk length
    * \param input input stream
    */
-  ChunkSetReader(unsigned int n, std::istream &input) {
+  ChunkSetReader(const Keys &keys, std::istream &input) : chunkset(keys) {
     Json::Value root;
+    unsigned int n = keys.size();
     input >> root;
     if(root["N"].asUInt() != n) {
       throw std::logic_error("storage has different chunk size");
     }
     //Create set reference (for set stored json).
     const Json::Value &json_chunks(root["chunks"]);
-    chunkset.resize(json_chunks.size());
+    std::vector<std::string> strings(json_chunks.size());
     //Now copy the strings while interpreting escape characters.
-    std::transform(json_chunks.begin(), json_chunks.end(), chunkset.begin(), [](const Json::Value &x) { return x.asString(); });
-    //Normalisation procedure:
-    //Sort chunks in the chunkset
-    std::sort(chunkset.begin(), chunkset.end());
-    //Use standard algorithm to remove non-unique members
-    auto last = std::unique(chunkset.begin(), chunkset.end());
-    chunkset.erase(last, chunkset.end());
+    std::transform(json_chunks.begin(), json_chunks.end(), strings.begin(), [](const Json::Value &x) { return x.asString(); });
     //Sanity checks.
-    std::for_each(chunkset.begin(), chunkset.end(), [n] (const std::string &x) {
+    std::for_each(strings.begin(), strings.end(), [n] (const std::string &x) {
 	if(x.length() != n) {
 	  throw std::invalid_argument(str(boost::format("chunk '%s' has length != %u") % x % n));
 	}
       });
+    //Normalisation procedure: sort chunks and remove non-unique members.
+    chunkset = ChunkSet<Keys>::from_strings(keys, strings);
   }
   /*! \brief Get chunkset
    *
    * Get a reference to the internal chunkset
    */
-  ChunkSet &get_chunkset() { return chunkset; }
+  ChunkSet<Keys> &get_chunkset() { return chunkset; }
 };
 
 
+/*! \brief Load a chunk storage in either format
+ *
+ * Binary storages are mapped and used in place, JSON storages are
+ * parsed and normalised.
+ *
+ * \param keys key representation with the chunk size
+ * \param fname storage file name
+ * \param fun called with the sorted range of chunks
+ */
+template<class Keys, class Fun>
+void with_chunk_storage(const Keys &keys, const std::string &fname, Fun fun) {
+  if(is_binary_chunk_storage(fname)) {
+    ChunkStorage<Keys> storage(keys, fname);
+    fun(storage);
+  } else {
+    std::ifstream input(fname);
+    if(!input) throw std::runtime_error(fname + ": " + std::strerror(errno));
+    ChunkSetReader<Keys> reader(keys, input);
+    fun(reader.get_chunkset());
+  }
+}
+
+
 /*! \brief Get initial chunks from first filename and/or chunk storage.
  *
- * \param n chunk size 
+ * \param keys key representation with the chunk size
  * \param fname file to get chunks from
  * \param cs_storage chunk storage filename
  */
-ChunkSet get_initial_chunks(unsigned int n, const char *filename, const std::string &cs_name) {
+template<class Keys>
+ChunkSet<Keys> get_initial_chunks(const Keys &keys, const char *filename, const std::string &cs_name) {
   std::cout << "Calculating all chunks of the first file: " << filename << std::endl;
-  ChunkSet chunkset(calculate_chunks(filename, n));
+  ChunkSet<Keys> chunkset(calculate_chunks(filename, keys));
   if(!cs_name.empty()) {
     std::cout << "Loading chunks from storage: " << cs_name << std::endl;
     std::ifstream input(cs_name);
     if(input) {
-      ChunkSetReader set_two(n, input);
       //Do an intersection of the two sets.
-      ChunkSet intersection;
-      std::set_intersection(chunkset.begin(), chunkset.end(), set_two.get_chunkset().begin(), set_two.get_chunkset().end(), std::back_inserter(intersection));
-      std::cout << "\tUnique Chunks in Intersection: " << intersection.size() << std::endl;
-      //And now replace the chunk set with the intersection.
-      std::swap(intersection, chunkset);
+      with_chunk_storage(keys, cs_name, [&chunkset](const auto &set_two) { chunkset.intersect(set_two); });
+      std::cout << "\tUnique Chunks in Intersection: " << chunkset.size() << std::endl;
     } else {
       //If it fails then let it fail (for now).
       std::cerr << "\tCan not load from storage.\n";
@@ -249,88 +243,661 @@ ChunkSet get_initial_chunks(unsigned int n, const char *filename, const std::str
 }
 
 
-int main(int argc, char **argv) {
-  // Json::Value json;
-  // json["oooo"] = "asdfasdfs";
-  // std::cout << json << '\n';
-  // return 0;
-  CLIParams cli_params(cli_parse(argc, argv));
-  ChunkSet chunkset(get_initial_chunks(cli_params.n, cli_params.filenames.at(0), cli_params.chunkstorage));
-  std::cout << "Number of unique chunks found: " << chunkset.size() << std::endl;
-  std::for_each(++cli_params.filenames.begin(), cli_params.filenames.end(), [&chunkset, cli_params] (const char *fname) {
+/*! \brief Intersect the chunk set with a file by probing
+ *
+ * Instead of building the chunk set of the file, all windows of the
+ * mapped file are looked up in a hash table of the current chunks.
+ * Chunks which were not seen are dropped.
+ */
+template<class Keys>
+void probe_chunks(ChunkSet<Keys> &chunkset, const FileView &file) {
+  ChunkProbe<Keys> probe(chunkset);
+  std::vector<uint8_t> marks(chunkset.size());
+
+  probe.mark(file.data(), file.size(), marks);
+  chunkset.retain(marks);
+}
+
+
+/*! \brief Result of intersecting one file with the candidates */
+template<class Keys>
+struct FileChunks {
+  std::string error; //!< non-empty if the file failed
+  size_t unique; //!< number of unique chunks in the file, if known
+  ChunkSet<Keys> chunks; //!< candidates found in the file
+};
+
+
+/*! \brief Intersect the chunk set with the remaining files in parallel
+ *
+ * Workers extract (or probe) the chunks of the files concurrently and
+ * immediately intersect them with the latest candidate set, so that
+ * only small partial results are handed back. These are folded into
+ * the chunk set in input order, which gives the same result and
+ * per-file statistics as the sequential loop. Each fold publishes the
+ * shrunken set to the workers started afterwards.
+ */
+template<class Keys>
+void intersect_files_parallel(ChunkSet<Keys> &chunkset, const CLIParams &cli_params) {
+  const Keys &keys(chunkset.get_keys());
+  std::mutex mutex;
+  size_t index = 0;
+  auto snapshot = std::make_shared<const ChunkSet<Keys> >(chunkset);
+  BatchReader reader(++cli_params.filenames.begin(), cli_params.filenames.end());
+
+  ordered_parallel_map(reader.begin(), reader.end(), cli_params.jobs, [&](const FileView &file) {
+      std::shared_ptr<const ChunkSet<Keys> > candidates;
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	candidates = snapshot;
+      }
+      //Only the matched candidates are copied into the result.
+      FileChunks<Keys> result = { "", 0, ChunkSet<Keys>(keys) };
       try {
-	ChunkSet intersection;
-      
-	std::cout << "Calculating chunks for: " << fname << std::endl;
-	ChunkSet set_two(calculate_chunks(fname, cli_params.n));
-	std::cout << "\t Unique Chunks: " << set_two.size() << std::endl;
-	std::set_intersection(chunkset.begin(), chunkset.end(), set_two.begin(), set_two.end(), std::back_inserter(intersection));
-	std::cout << "\t Total intersection size: " << intersection.size() << std::endl;
-	std::swap(intersection, chunkset);
+	file.check();
+	if(cli_params.probe) {
+	  ChunkProbe<Keys> probe(*candidates);
+	  std::vector<uint8_t> marks(candidates->size());
+	  probe.mark(file.data(), file.size(), marks);
+	  result.chunks.assign_marked(*candidates, marks);
+	} else {
+	  ChunkSet<Keys> set_two(calculate_chunks(file, keys));
+	  result.unique = set_two.size();
+	  result.chunks.assign_intersection(*candidates, set_two);
+	}
       }
       catch(const std::exception &excp) {
-	std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+	result.error = excp.what();
       }
+      return result;
+    }, [&](const FileChunks<Keys> &result) {
+      const char *fname = cli_params.filenames.at(++index);
+      std::cout << (cli_params.probe ? "Probing chunks in: " : "Calculating chunks for: ") << fname << std::endl;
+      if(!result.error.empty()) {
+	std::cerr << "Exception: " << result.error << '.' << std::endl;
+	return;
+      }
+      if(!cli_params.probe) std::cout << "\t Unique Chunks: " << result.unique << std::endl;
+      chunkset.intersect(result.chunks);
+      std::cout << "\t Total intersection size: " << chunkset.size() << std::endl;
+      auto shrunk = std::make_shared<const ChunkSet<Keys> >(chunkset);
+      std::lock_guard<std::mutex> lock(mutex);
+      snapshot = shrunk;
     });
-  if(!cli_params.subtract_chunks.empty()) {
-    ChunkSet difference;
-    std::cout << boost::format("Subtracting chunks from set file '%s'.\n") % cli_params.subtract_chunks;
-    std::ifstream input(cli_params.subtract_chunks);
-    ChunkSetReader set_two(cli_params.n, input);
-    std::set_difference(chunkset.begin(), chunkset.end(), set_two.get_chunkset().begin(), set_two.get_chunkset().end(), std::back_inserter(difference));
-    std::swap(difference, chunkset);
-  }
+}
+
+
+/*! \brief Replace control and non-ASCII bytes by block symbols */
+static std::string sanitised_text(const std::string &x) {
+  std::string text;
+  std::for_each(x.begin(), x.end(), [&text] (char c) {
+      if(c == 0) {
+	text += "․";
+      } else if(c < ' ') {
+	text += "▒";
+      } else if(c >= 0x7f) {
+	text += "░";
+      } else {
+	text += c;
+      }
+    });
+  return text;
+}
+
+
+/*! \brief Print one chunk as hex and as (sanitised) text */
+static void print_chunk(const std::string &x) {
+  //wchar_t wc = L'␀';
+  std::cout << "⇾ ";
+  std::for_each(x.begin(), x.end(), [] (char c) {
+      std::cout << boost::format(" %02X") % (static_cast<int>(c) & 0xFF);
+    });
+  std::cout << "  | " << sanitised_text(x) << " |" << std::endl;
+}
+
+
+/*! \brief Print the chunks as hex and as (sanitised) text */
+template<class Keys>
+void print_chunks(const ChunkSet<Keys> &chunkset) {
   std::cout << "Chunks (total " << chunkset.size() << ") found in all files:\n";
   if(!chunkset.empty()) {
-    for(auto x : chunkset) {
-      //wchar_t wc = L'␀';
-      std::cout << "⇾ ";
-      std::for_each(x.begin(), x.end(), [] (char c) {
-	  std::cout << boost::format(" %02X") % (static_cast<int>(c) & 0xFF);
-	});
-      std::cout << "  | ";
-      std::for_each(x.begin(), x.end(), [] (char c) {
-	  if(c == 0) {
-	    std::cout << "․";
-	  } else if(c < ' ') {
-	    std::cout << "▒";
-	  } else if(c >= 0x7f) {
-	    std::cout << "░";
-	  } else {
-	    std::cout << c;
-	  }
-	});
-      std::cout << " |" << std::endl;
+    for(auto key : chunkset) {
+      print_chunk(chunkset.str(key));
     }
   } else {
     std::cout << "No chunks found!\n";
   }
+}
+
+
+/*! \brief Store the chunks as JSON */
+template<class Keys>
+void store_chunks(const ChunkSet<Keys> &chunkset, const std::string &fname) {
+  Json::Value root;
+  Json::Value all_chunks(Json::arrayValue);
+  for(auto key : chunkset) {
+    all_chunks.append(chunkset.str(key));
+  }
+  root["N"] = chunkset.get_keys().size();
+  root["chunks"] = all_chunks;
+  std::ofstream output(fname);
+  output << root << std::endl;
+}
+
+
+/*! \brief Store the chunks in the format chosen on the command line */
+template<class Keys>
+void save_chunks(const ChunkSet<Keys> &chunkset, const CLIParams &cli_params) {
+  if(cli_params.binary_storage) {
+    write_chunk_storage(chunkset, cli_params.chunkstorage);
+  } else {
+    store_chunks(chunkset, cli_params.chunkstorage);
+  }
+}
+
+
+/*! \brief Where the chunks occur in one file */
+struct FileLocations {
+  std::vector<std::pair<uint32_t,uint64_t> > hits; //!< (chunk index, offset) in offset order
+  std::vector<std::pair<uint64_t,uint64_t> > regions; //!< maximal (offset, length) covered by chunks
+};
+
+
+/*! \brief Find all occurrences of the chunks in every input file
+ *
+ * This is a separate verification pass over the mapped files after
+ * the chunk set is final, so the intersection itself is not slowed
+ * down. Adjacent or overlapping occurrences are merged into regions.
+ */
+template<class Keys>
+std::vector<FileLocations> locate_chunks(const ChunkSet<Keys> &chunkset, const CLIParams &cli_params) {
+  std::vector<FileLocations> locations;
+  ChunkProbe<Keys> probe(chunkset);
+  const Keys &keys(chunkset.get_keys());
+  BatchReader reader(cli_params.filenames.begin(), cli_params.filenames.end());
+
+  ordered_parallel_map(reader.begin(), reader.end(), cli_params.jobs, [&](const FileView &file) {
+      FileLocations result;
+      try {
+	file.check();
+	keys.for_each_hashed_window(file.data(), file.size(), [&](uint64_t hash, typename Keys::key_type key, size_t pos) {
+	    long idx = probe.find(hash, key);
+	    if(idx < 0) return;
+	    result.hits.emplace_back(idx, pos);
+	    if(!result.regions.empty() && pos <= result.regions.back().first + result.regions.back().second) {
+	      result.regions.back().second = pos + keys.size() - result.regions.back().first;
+	    } else {
+	      result.regions.emplace_back(pos, keys.size());
+	    }
+	  });
+      }
+      catch(const std::exception &excp) {
+	std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      }
+      return result;
+    }, [&locations](FileLocations result) {
+      locations.push_back(std::move(result));
+    });
+  return locations;
+}
+
+
+static std::string hex_string(const std::string &chunk) {
+  std::string hex;
+  for(char c : chunk) hex += str(boost::format("%02x") % (static_cast<int>(c) & 0xFF));
+  return hex;
+}
+
+static std::string csv_quote(const std::string &field) {
+  std::string quoted("\"");
+  for(char c : field) {
+    if(c == '"') quoted += '"';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+
+/*! \brief Write the location report as JSON or CSV
+ *
+ * JSON: for every chunk its offsets in each file, and for every file
+ * the merged regions. CSV: one row per occurrence ("chunk") and per
+ * region ("region").
+ */
+template<class Keys>
+void write_locations(const ChunkSet<Keys> &chunkset, const std::vector<FileLocations> &locations, const CLIParams &cli_params) {
+  std::ofstream output(cli_params.locations);
+  if(!output) throw std::runtime_error(cli_params.locations + ": " + std::strerror(errno));
+  if(cli_params.locations_csv) {
+    output << "type,file,offset,length,chunk\n";
+    for(size_t f = 0; f < locations.size(); ++f) {
+      std::string fname(csv_quote(cli_params.filenames[f]));
+      for(auto &hit : locations[f].hits) {
+	output << "chunk," << fname << ',' << hit.second << ',' << chunkset.get_keys().size() << ',' << hex_string(chunkset.str(chunkset.get_chunk(hit.first))) << '\n';
+      }
+      for(auto &region : locations[f].regions) {
+	output << "region," << fname << ',' << region.first << ',' << region.second << ",\n";
+      }
+    }
+    return;
+  }
+  Json::Value root;
+  Json::Value chunks(Json::arrayValue);
+  Json::Value files(Json::arrayValue);
+  for(size_t i = 0; i < chunkset.size(); ++i) {
+    Json::Value chunk;
+    chunk["chunk"] = hex_string(chunkset.str(chunkset.get_chunk(i)));
+    chunk["offsets"] = Json::Value(Json::arrayValue);
+    for(size_t f = 0; f < locations.size(); ++f) chunk["offsets"].append(Json::Value(Json::arrayValue));
+    chunks.append(chunk);
+  }
+  for(size_t f = 0; f < locations.size(); ++f) {
+    Json::Value file;
+    file["name"] = cli_params.filenames[f];
+    file["regions"] = Json::Value(Json::arrayValue);
+    for(auto &hit : locations[f].hits) {
+      chunks[static_cast<Json::ArrayIndex>(hit.first)]["offsets"][static_cast<Json::ArrayIndex>(f)].append(static_cast<Json::UInt64>(hit.second));
+    }
+    for(auto &region : locations[f].regions) {
+      Json::Value r;
+      r["offset"] = static_cast<Json::UInt64>(region.first);
+      r["length"] = static_cast<Json::UInt64>(region.second);
+      file["regions"].append(r);
+    }
+    files.append(file);
+  }
+  root["N"] = chunkset.get_keys().size();
+  root["chunks"] = chunks;
+  root["files"] = files;
+  output << root << std::endl;
+}
+
+
+/*! \brief Intersect the chunks of all files
+ *
+ * \param cli_params command line parameters
+ * \param keys key representation for the chunk size
+ */
+template<class Keys>
+int simichunks(const CLIParams &cli_params, const Keys &keys) {
+  stats_phase("first file");
+  ChunkSet<Keys> chunkset(get_initial_chunks(keys, cli_params.filenames.at(0), cli_params.chunkstorage));
+  std::cout << "Number of unique chunks found: " << chunkset.size() << std::endl;
+  stats_count("initial chunks", chunkset.size());
+  stats_phase("intersect");
+  if(cli_params.jobs != 1) {
+    intersect_files_parallel(chunkset, cli_params);
+  } else {
+    BatchReader reader(++cli_params.filenames.begin(), cli_params.filenames.end());
+    std::for_each(reader.begin(), reader.end(), [&chunkset, &keys, &cli_params] (const FileView &file) {
+	try {
+	  if(cli_params.probe) {
+	    std::cout << "Probing chunks in: " << file.name() << std::endl;
+	    probe_chunks(chunkset, file.check());
+	  } else {
+	    std::cout << "Calculating chunks for: " << file.name() << std::endl;
+	    ChunkSet<Keys> set_two(calculate_chunks(file.check(), keys));
+	    std::cout << "\t Unique Chunks: " << set_two.size() << std::endl;
+	    chunkset.intersect(set_two);
+	  }
+	  std::cout << "\t Total intersection size: " << chunkset.size() << std::endl;
+	}
+	catch(const std::exception &excp) {
+	  std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+	}
+      });
+  }
+  if(!cli_params.subtract_chunks.empty()) {
+    stats_phase("subtract");
+    std::cout << boost::format("Subtracting chunks from set file '%s'.\n") % cli_params.subtract_chunks;
+    with_chunk_storage(keys, cli_params.subtract_chunks, [&chunkset](const auto &set_two) { chunkset.subtract(set_two); });
+  }
+  stats_phase("print");
+  stats_count("common chunks", chunkset.size());
+  print_chunks(chunkset);
   if(!cli_params.chunkstorage.empty()) {
+    stats_phase("store");
     std::cout << "Storing chunks.\n";
-    Json::Value root;
-    Json::Value all_chunks(Json::arrayValue);
-    for(auto x : chunkset) {
-	all_chunks.append(x);
+    save_chunks(chunkset, cli_params);
+  }
+  if(!cli_params.locations.empty()) {
+    stats_phase("locate");
+    std::cout << boost::format("Writing chunk locations to '%s'.\n") % cli_params.locations;
+    write_locations(chunkset, locate_chunks(chunkset, cli_params), cli_params);
+  }
+  std::cout.flush();
+  return 0;
+}
+
+
+/*! \brief Convert a chunk storage between the JSON and binary formats */
+template<class Keys>
+int convert_storage(const CLIParams &cli_params, const Keys &keys) {
+  ChunkSet<Keys> chunkset(keys);
+  if(is_binary_chunk_storage(cli_params.convert_storage)) {
+    chunkset = ChunkStorage<Keys>(keys, cli_params.convert_storage).to_chunkset();
+  } else {
+    std::ifstream input(cli_params.convert_storage);
+    if(!input) throw std::runtime_error(cli_params.convert_storage + ": " + std::strerror(errno));
+    chunkset = ChunkSetReader<Keys>(keys, input).get_chunkset();
+  }
+  std::cout << boost::format("Converting %u chunks from '%s' to '%s'.\n") % chunkset.size() % cli_params.convert_storage % cli_params.chunkstorage;
+  save_chunks(chunkset, cli_params);
+  return 0;
+}
+
+
+/*! \brief All-pairs similarity with MinHash signatures and LSH
+ *
+ * Signatures of the files are computed in parallel. If a signature
+ * corpus is given, it is loaded first, only pairs involving the new
+ * files are reported and the extended corpus is written back.
+ */
+int similarity_matrix(const CLIParams &cli_params) {
+  SignatureStore store(cli_params.n, cli_params.minhash_size);
+  std::ifstream corpus(cli_params.signatures);
+  if(!cli_params.signatures.empty() && corpus) {
+    store = SignatureStore::load(cli_params.signatures);
+    if(store.get_n() != cli_params.n || store.get_k() != cli_params.minhash_size) {
+      throw std::logic_error("signature corpus has different n-gram or MinHash size");
     }
-    root["N"] = cli_params.n;
-    root["chunks"] = all_chunks;
-    std::ofstream output(cli_params.chunkstorage);
-    output << root << std::endl;
-    // {
-    //   std::ifstream in(cli_params.chunkstorage);
-    //   std::wofstream wout("/tmp/wout");
-    //   std::locale utf8_locale("en_US.UTF8");
-    //   wout.imbue(utf8_locale); 
-
-    //   char x;
-    //   if(!in) throw "ERROR";
-    //   while(in.get(x)) {
-    // 	wchar_t wch = L'☻';
-    // 	wch = static_cast<unsigned char>(x);
-    // 	wout << wch;
-    //   }
-    //   wout << std::endl;
-    // }
+    std::cout << boost::format("Loaded %u signatures from '%s'.\n") % store.size() % cli_params.signatures;
+  }
+  const size_t first_new = cli_params.filenames.empty() ? 0 : store.size();
+  size_t next = 0;
+  BatchReader reader(cli_params.filenames.begin(), cli_params.filenames.end());
+  ordered_parallel_map(reader.begin(), reader.end(), cli_params.jobs, [&cli_params](const FileView &file) {
+      try {
+	file.check();
+	return minhash_signature(file.data(), file.size(), cli_params.n, cli_params.minhash_size);
+      }
+      catch(const std::exception &excp) {
+	std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      }
+      return std::vector<uint32_t>();
+    }, [&store, &cli_params, &next](const std::vector<uint32_t> &signature) {
+      //Files which could not be read are reported above and left out.
+      if(!signature.empty()) store.add(cli_params.filenames.at(next), signature);
+      ++next;
+    });
+  std::cout << boost::format("Similar pairs (estimated Jaccard >= %g):\n") % cli_params.similarity;
+  size_t found = 0;
+  size_t candidates = find_similar_pairs(store, first_new, cli_params.bands, cli_params.similarity, [&store, &found](size_t i, size_t j, double similarity) {
+      std::cout << boost::format("%.4f\t%s\t%s\n") % similarity % store.name(i) % store.name(j);
+      ++found;
+    });
+  std::cout << boost::format("%u of %u candidate pairs are similar.\n") % found % candidates;
+  if(!cli_params.signatures.empty()) {
+    std::cout << boost::format("Storing %u signatures.\n") % store.size();
+    store.save(cli_params.signatures);
   }
   return 0;
 }
+
+
+/*! \brief Report maximal substrings shared by several files
+ *
+ * Unlike the fixed size chunks these have variable length: every
+ * substring of at least --common-substrings bytes that occurs in
+ * --min-files files (all by default) and can not be extended is
+ * reported, longest first, with one offset per file.
+ */
+int common_substrings_report(const CLIParams &cli_params) {
+  std::vector<std::unique_ptr<MappedFile> > files;
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> sizes;
+  for(auto fname : cli_params.filenames) {
+    files.emplace_back(new MappedFile(fname));
+    data.push_back(files.back()->data());
+    sizes.push_back(files.back()->size());
+  }
+  const unsigned int min_files = cli_params.min_files == 0 ? files.size() : cli_params.min_files;
+  if(min_files < 2 || min_files > files.size()) {
+    throw std::invalid_argument(str(boost::format("--min-files must be between 2 and %u") % files.size()));
+  }
+  std::vector<CommonSubstring> found;
+  common_substrings(data, sizes, cli_params.common_length, min_files, [&found](const CommonSubstring &common) {
+      found.push_back(common);
+    });
+  std::stable_sort(found.begin(), found.end(), [](const CommonSubstring &a, const CommonSubstring &b) {
+      return a.length > b.length || (a.length == b.length && a.files > b.files);
+    });
+  std::cout << boost::format("Common substrings (total %u, length >= %u) found in at least %u files:\n") % found.size() % cli_params.common_length % min_files;
+  for(auto &common : found) {
+    size_t f = std::find_if(common.offsets.begin(), common.offsets.end(), [](int64_t offset) { return offset >= 0; }) - common.offsets.begin();
+    std::cout << boost::format("Length %u in %u files:\n") % common.length % common.files;
+    print_chunk(std::string(reinterpret_cast<const char*>(data[f] + common.offsets[f]), common.length));
+    for(f = 0; f < files.size(); ++f) {
+      if(common.offsets[f] >= 0) std::cout << boost::format("\t%s @ %u\n") % cli_params.filenames[f] % common.offsets[f];
+    }
+  }
+  return 0;
+}
+
+
+/*! \brief Match the items of the first file in the other files
+ *
+ * fun(file) returns one result per item for a file view, the files
+ * are processed in parallel. Unreadable files are skipped. Each file
+ * is folded in as it arrives: items not found (see found) are dropped
+ * from survivors, and only the results of the surviving items are
+ * kept, so memory grows with the items and not items times files.
+ *
+ * \param survivors indices of the items found in all files so far, initially all
+ * \param results per matched file, results[f][r] belongs to item survivors[r]
+ */
+template<class Result, class Fun, class Found>
+void match_other_files(const CLIParams &cli_params, Fun fun, Found found, std::vector<const char *> &matched, std::vector<std::vector<Result> > &results, std::vector<size_t> &survivors) {
+  const size_t items = survivors.size();
+  size_t next = 1;
+  BatchReader reader(++cli_params.filenames.begin(), cli_params.filenames.end());
+  ordered_parallel_map(reader.begin(), reader.end(), cli_params.jobs, [&fun](const FileView &file) {
+      try {
+	return fun(file.check());
+      }
+      catch(const std::exception &excp) {
+	std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      }
+      return std::vector<Result>();
+    }, [&](std::vector<Result> &&file_results) {
+      const char *fname = cli_params.filenames.at(next++);
+      if(file_results.size() != items) return;
+      std::cout << "Matched chunks in: " << fname << std::endl;
+      //Compact the survivors and the kept results in place.
+      results.emplace_back();
+      size_t out = 0;
+      for(size_t r = 0; r < survivors.size(); ++r) {
+	if(!found(file_results[survivors[r]])) continue;
+	if(out != r) {
+	  for(size_t f = 0; f + 1 < results.size(); ++f) results[f][out] = std::move(results[f][r]);
+	}
+	results.back().push_back(std::move(file_results[survivors[r]]));
+	survivors[out++] = survivors[r];
+      }
+      survivors.resize(out);
+      for(auto &kept : results) {
+	kept.resize(out);
+	kept.shrink_to_fit();
+      }
+      std::cout << "\t Chunks in all files: " << survivors.size() << std::endl;
+      matched.push_back(fname);
+    });
+}
+
+
+/*! \brief Find long chunks through winnowed anchors
+ *
+ * Instead of every n-gram only the winnowing anchors (hash and offset)
+ * of the files are kept, so memory grows with the number of anchors
+ * and not with file size times n. Anchors of the first file are
+ * looked up in the other files (in parallel) and verified byte-wise
+ * against the mapped data; chunks present in all files are reported.
+ */
+int anchored_chunks(const CLIParams &cli_params) {
+  const unsigned int n = cli_params.n;
+  const unsigned int window = cli_params.anchor_window;
+  MappedFile first(cli_params.filenames.at(0));
+  std::vector<Anchor> anchors(winnow_anchors(first.data(), first.size(), n, window));
+  unique_anchors(anchors, first.data(), n);
+  std::cout << "Number of unique anchors found: " << anchors.size() << std::endl;
+  std::vector<std::vector<int64_t> > offsets;
+  std::vector<const char *> matched;
+  std::vector<size_t> survivors(anchors.size());
+  std::iota(survivors.begin(), survivors.end(), 0);
+  match_other_files(cli_params, [&](const FileView &file) {
+      return match_anchors(anchors, first.data(), file.data(), file.size(), n, window);
+    }, [](int64_t offset) { return offset >= 0; }, matched, offsets, survivors);
+  //Rows of the surviving anchors in the order of their offsets.
+  std::vector<size_t> chunks(survivors.size());
+  std::iota(chunks.begin(), chunks.end(), 0);
+  std::sort(chunks.begin(), chunks.end(), [&](size_t a, size_t b) { return anchors[survivors[a]].offset < anchors[survivors[b]].offset; });
+  std::cout << boost::format("Anchored chunks (total %u, n = %u) found in all files:\n") % chunks.size() % n;
+  std::cout << "Offsets in " << cli_params.filenames[0];
+  for(auto fname : matched) std::cout << ' ' << fname;
+  std::cout << std::endl;
+  for(auto r : chunks) {
+    const size_t preview = std::min(n, 32U);
+    const size_t i = survivors[r];
+    std::cout << "⇾  " << anchors[i].offset;
+    for(auto &file_offsets : offsets) std::cout << ' ' << file_offsets[r];
+    std::cout << "  | " << sanitised_text(std::string(reinterpret_cast<const char*>(first.data() + anchors[i].offset), preview)) << (preview < n ? "…" : "") << " |" << std::endl;
+  }
+  if(chunks.empty()) std::cout << "No chunks found!\n";
+  return 0;
+}
+
+
+/*! \brief Find chunks which occur with at most k mismatches in all files
+ *
+ * The unique chunks of the first file are put into a block index
+ * (pigeonhole on k + 1 blocks), every other file is scanned for
+ * candidates which are verified by their Hamming distance. The
+ * differing positions are reported per file.
+ */
+int approximate_chunks(const CLIParams &cli_params) {
+  const unsigned int n = cli_params.n;
+  const unsigned int k = cli_params.max_mismatches;
+  if(k > n) throw std::invalid_argument(str(boost::format("--max-mismatches must be between 0 and %u") % n));
+  MappedFile first(cli_params.filenames.at(0));
+  BlockIndex index(first.data(), first.size(), n, k);
+  std::cout << boost::format("Number of unique chunks found: %u (block length %u)\n") % index.size() % index.get_block_len();
+  std::vector<std::vector<ApproxMatch> > matches;
+  std::vector<const char *> matched;
+  std::vector<size_t> survivors(index.size());
+  std::iota(survivors.begin(), survivors.end(), 0);
+  match_other_files(cli_params, [&index](const FileView &file) {
+      return index.match(file.data(), file.size());
+    }, [](const ApproxMatch &match) { return match.offset >= 0; }, matched, matches, survivors);
+  std::cout << boost::format("Chunks (total %u, at most %u mismatches) found in all files:\n") % survivors.size() % k;
+  for(size_t r = 0; r < survivors.size(); ++r) {
+    const size_t i = survivors[r];
+    print_chunk(std::string(reinterpret_cast<const char*>(index.chunk(i)), n));
+    std::cout << boost::format("\t%s @ %u\n") % cli_params.filenames[0] % index.chunk_offset(i);
+    for(size_t f = 0; f < matched.size(); ++f) {
+      const ApproxMatch &match(matches[f][r]);
+      std::cout << boost::format("\t%s @ %u") % matched[f] % match.offset;
+      if(match.distance > 0) {
+	std::cout << boost::format(", %u mismatches at") % match.distance;
+	for(auto pos : match.mismatches) std::cout << ' ' << pos;
+      }
+      std::cout << std::endl;
+    }
+  }
+  return 0;
+}
+
+
+/*! \brief Dispatch on the chunk size to the best key representation
+ *
+ * Chunks up to 16 bytes are packed into integers, longer ones
+ * reference the mapped data.
+ */
+template<class Fun>
+int with_keys(unsigned int n, Fun fun) {
+  if(n <= 8) {
+    return fun(PackedKeys<uint64_t>(n));
+  } else if(n <= 16) {
+    return fun(PackedKeys<unsigned __int128>(n));
+  }
+  return fun(ReferenceKeys(n));
+}
+
+
+int main(int argc, char **argv) {
+  if(stats_init(&argc, argv, "simichunks") != 0) return 1;
+  CLIParams cli_params;
+  try {
+    cli_params = cli_parse(argc, argv);
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+    return 1;
+  }
+  if(!cli_params.convert_storage.empty() && !cli_params.chunkstorage.empty()) {
+    try {
+      stats_phase("convert");
+      return with_keys(chunk_storage_n(cli_params.convert_storage), [&cli_params](const auto &keys) { return convert_storage(cli_params, keys); });
+    }
+    catch(const std::exception &excp) {
+      std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      return 1;
+    }
+  }
+  if(cli_params.similarity >= 0) {
+    try {
+      stats_phase("similarity");
+      return similarity_matrix(cli_params);
+    }
+    catch(const std::exception &excp) {
+      std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      return 1;
+    }
+  }
+  if(cli_params.common_length > 0 && !cli_params.filenames.empty()) {
+    try {
+      stats_phase("common substrings");
+      return common_substrings_report(cli_params);
+    }
+    catch(const std::exception &excp) {
+      std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      return 1;
+    }
+  }
+  if(cli_params.anchor_window > 0 && !cli_params.filenames.empty() && cli_params.n > 0) {
+    try {
+      stats_phase("anchored");
+      return anchored_chunks(cli_params);
+    }
+    catch(const std::exception &excp) {
+      std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      return 1;
+    }
+  }
+  if(cli_params.max_mismatches >= 0 && !cli_params.filenames.empty() && cli_params.n > 0) {
+    try {
+      stats_phase("approximate");
+      return approximate_chunks(cli_params);
+    }
+    catch(const std::exception &excp) {
+      std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+      return 1;
+    }
+  }
+  if(cli_params.filenames.empty() || cli_params.n == 0) {
+    std::cerr << "Usage: simichunks [--n-gram-size n] [--chunk-storage file] [--subtract-chunks file] [--probe] [--jobs n] [--binary-storage] [--locations report.json|.csv] <files...>\n"
+	      << "       simichunks --convert-storage file --chunk-storage file [--binary-storage]\n"
+	      << "       simichunks --similarity threshold [--minhash-size k] [--bands b] [--signatures file] [--jobs n] <files...>\n"
+	      << "       simichunks --common-substrings min-length [--min-files k] <files...>\n"
+	      << "       simichunks --anchored window [--n-gram-size n] [--jobs n] <files...>\n"
+	      << "       simichunks --max-mismatches k [--n-gram-size n] [--jobs n] <files...>\n"
+	      << "Every mode accepts --stats or --stats=json to report timings and counters on stderr.\n";
+    return 1;
+  }
+  try {
+    return with_keys(cli_params.n, [&cli_params](const auto &keys) { return simichunks(cli_params, keys); });
+  }
+  catch(const std::exception &excp) {
+    std::cerr << "Exception: " << excp.what() << '.' << std::endl;
+  }
+  return 1;
+}
@@ -1,42 +1,164 @@
 #include "histogram.h"
+#include "batchreader.hh"
+#include "parallel.hh"
+#include "stats.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <cstring>
 #include <iostream>
 #include <string>
-#include <fstream>
 #include <stdio.h>
 #include <vector>
+#include <boost/lexical_cast.hpp>
 
 using namespace std;
 
-string read_stream(istream &in) {
-  string s;
-  char ch;
+enum class Row_format { TEXT, FLOAT32, FLOAT64, COUNTS };
 
-  while(in.get(ch)) s += ch;
-  return s;
+struct CLIParams {
+  unsigned int threads;
+  bool threads_given;
+  Row_format format;
+  bool format_given;
+  vector<string> filenames;
+  bool file_list; //!< names were given with -@
+};
+
+static void put_le(char *dst, uint64_t val, int bytes) {
+  for(int i = 0; i < bytes; ++i) dst[i] = (val >> (8 * i)) & 0xFF;
+}
+
+/*! \brief Histogram one file and format it as one matrix row
+ *
+ * Unreadable files produce a row of zeros (and a warning) so that rows
+ * stay aligned with the file list.
+ */
+static string histogram_row(const FileView &file, Row_format format) {
+  vector<double> hist(256);
+  uint64_t counts[256] = { 0 };
+  char buf[32];
+  string row;
+
+  if(!file.ok()) {
+    cerr << "Warning! " << file.get_error() << endl;
+  } else if(format == Row_format::COUNTS) {
+    byte_histogram_counts(file.data(), file.size(), counts);
+  } else {
+    simple_histogram(const_cast<unsigned char*>(file.data()), file.size(), &hist[0]);
+  }
+  if(file.ok()) stats_add(file.size(), 1);
+  switch(format) {
+  case Row_format::TEXT:
+    row = file.name();
+    for(int i = 0; i < 256; ++i) row.append(buf, snprintf(buf, sizeof(buf), " %20.16E", hist[i]));
+    row += '\n';
+    break;
+  case Row_format::FLOAT32:
+    row.resize(256 * 4);
+    for(int i = 0; i < 256; ++i) {
+      float f = hist[i];
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      put_le(&row[i * 4], bits, 4);
+    }
+    break;
+  case Row_format::FLOAT64:
+    row.resize(256 * 8);
+    for(int i = 0; i < 256; ++i) {
+      uint64_t bits;
+      memcpy(&bits, &hist[i], sizeof(bits));
+      put_le(&row[i * 8], bits, 8);
+    }
+    break;
+  case Row_format::COUNTS:
+    row.resize(256 * 8);
+    for(int i = 0; i < 256; ++i) put_le(&row[i * 8], counts[i], 8);
+    break;
+  }
+  return row;
 }
 
-string read_file(const char *fname) {
-  ifstream ifs(fname);
-  return read_stream(ifs);
+static CLIParams cli_parse(int argc, char **argv) {
+  CLIParams params = { 1, false, Row_format::TEXT, false };
+  int opt;
+
+  while((opt = getopt(argc, argv, "j:f:@:")) != -1) {
+    switch(opt) {
+    case 'j':
+      try {
+	params.threads = boost::lexical_cast<unsigned int>(optarg);
+      }
+      catch(const boost::bad_lexical_cast &) {
+	throw invalid_argument(string("bad thread count ") + optarg);
+      }
+      params.threads_given = true;
+      break;
+    case 'f':
+      params.format_given = true;
+      if(strcmp(optarg, "text") == 0) params.format = Row_format::TEXT;
+      else if(strcmp(optarg, "f32") == 0) params.format = Row_format::FLOAT32;
+      else if(strcmp(optarg, "f64") == 0) params.format = Row_format::FLOAT64;
+      else if(strcmp(optarg, "counts") == 0) params.format = Row_format::COUNTS;
+      else throw invalid_argument(string("unknown format ") + optarg);
+      break;
+    case '@':
+      read_file_list(optarg, params.filenames);
+      params.file_list = true;
+      break;
+    default: /* '?' */
+      throw invalid_argument("bad option");
+    }
+  }
+  params.filenames.insert(params.filenames.end(), argv + optind, argv + argc);
+  return params;
 }
 
 int main(int argc, char **argv) {
+  CLIParams params;
   int i;
-  
-  if(argc != 2) {
-    cerr << "usage: simple-histogram <file>\n";
+
+  if(stats_init(&argc, argv, "simple-histogram") != 0) return 1;
+  try {
+    params = cli_parse(argc, argv);
+  }
+  catch(const std::exception &excp) {
+    cerr << "Error: " << excp.what() << '\n';
+    params.filenames.clear();
+    params.file_list = false;
+  }
+  if(params.filenames.empty() && !params.file_list) {
+    cerr << "usage: simple-histogram [-j threads] [--stats[=json]] <file>\n"
+	 << "       simple-histogram [-j jobs] [-f text|f32|f64|counts] [-@ listfile] [--stats[=json]] <files...>\n";
     return 1;
   }
   try {
-    string data(read_file(argv[1]));
-    vector<double> hist(256);
-    double max = simple_histogram(reinterpret_cast<unsigned char*>(&data[0]), data.size(), &hist[0]);
-    cerr << "max = " << max << endl;
-    for(i = 0; i < 256; ++i) {
-      printf(" %20.16E", hist[i]);
-      //cerr << i << ' ' << hist[i] << endl;
+    if(params.filenames.size() == 1 && !params.file_list && !params.format_given) {
+      stats_phase("read");
+      FileView data(read_file(params.filenames[0]));
+      data.check();
+      stats_phase("histogram");
+      vector<double> hist(256);
+      double max = simple_histogram_parallel(const_cast<unsigned char*>(data.data()), data.size(), &hist[0], params.threads);
+      stats_add(data.size(), 1);
+      cerr << "max = " << max << endl;
+      for(i = 0; i < 256; ++i) {
+	printf(" %20.16E", hist[i]);
+	//cerr << i << ' ' << hist[i] << endl;
+      }
+      cout << endl;
+      fflush(stdout);
+    } else {
+      //One row per file, files are histogrammed concurrently.
+      unsigned int jobs = params.threads_given ? params.threads : 0;
+      stats_phase("histogram");
+      BatchReader reader(params.filenames);
+      ordered_parallel_map(reader.begin(), reader.end(), jobs, [&params](const FileView &file) {
+	  return histogram_row(file, params.format);
+	}, [](const string &row) {
+	  fwrite(row.data(), 1, row.size(), stdout);
+	});
+      fflush(stdout);
     }
-    cout << endl;
   }
   catch(const std::exception &excp) {
     cerr << "Error! Exception: " << excp.what() << endl;
@@ -0,0 +1,244 @@
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define STATS_MAX_PHASES 32
+#define STATS_MAX_COUNTERS 32
+
+typedef struct Stats_Usage {
+  double wall;
+  double cpu; //!< all threads of the process
+  double user;
+  double sys;
+  long majflt;
+  long minflt;
+  long inblock;
+  long oublock;
+  long nvcsw;
+  long nivcsw;
+} stats_usage_t;
+
+typedef struct Stats_Phase {
+  const char *name;
+  stats_usage_t usage;
+  uint64_t bytes;
+  uint64_t records;
+} stats_phase_t;
+
+typedef struct Stats_Counter {
+  const char *name;
+  uint64_t value;
+} stats_counter_t;
+
+enum Stats_Format stats_format = STATS_OFF;
+
+static const char *stats_tool = "";
+static stats_usage_t stats_start;
+static stats_usage_t phase_start;
+static stats_phase_t phases[STATS_MAX_PHASES];
+static int phase_count = 0;
+static int phase_current = -1;
+static stats_counter_t counters[STATS_MAX_COUNTERS];
+static int counter_count = 0;
+static uint64_t total_bytes = 0;
+static uint64_t total_records = 0;
+static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static double timeval_seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static void sample(stats_usage_t *usage) {
+  struct timespec ts;
+  struct rusage ru;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  usage->wall = ts.tv_sec + ts.tv_nsec * 1e-9;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  usage->cpu = ts.tv_sec + ts.tv_nsec * 1e-9;
+  getrusage(RUSAGE_SELF, &ru);
+  usage->user = timeval_seconds(&ru.ru_utime);
+  usage->sys = timeval_seconds(&ru.ru_stime);
+  usage->majflt = ru.ru_majflt;
+  usage->minflt = ru.ru_minflt;
+  usage->inblock = ru.ru_inblock;
+  usage->oublock = ru.ru_oublock;
+  usage->nvcsw = ru.ru_nvcsw;
+  usage->nivcsw = ru.ru_nivcsw;
+}
+
+/* Add the usage since from up to now to total. */
+static void accumulate(stats_usage_t *total, const stats_usage_t *from, const stats_usage_t *now) {
+  total->wall += now->wall - from->wall;
+  total->cpu += now->cpu - from->cpu;
+  total->user += now->user - from->user;
+  total->sys += now->sys - from->sys;
+  total->majflt += now->majflt - from->majflt;
+  total->minflt += now->minflt - from->minflt;
+  total->inblock += now->inblock - from->inblock;
+  total->oublock += now->oublock - from->oublock;
+  total->nvcsw += now->nvcsw - from->nvcsw;
+  total->nivcsw += now->nivcsw - from->nivcsw;
+}
+
+/* Rough verdict what limited a phase:
+ * - "faults": mostly waiting while pages were read in (major faults)
+ * - "io": mostly waiting otherwise (reads, pipes, locks)
+ * - "kernel": the CPU time is mostly system time (minor faults, copying)
+ * - "cpu": the CPU time is mostly user time
+ */
+static const char *bound(const stats_usage_t *usage) {
+  if(usage->cpu < 0.5 * usage->wall) return usage->majflt > 0 ? "faults" : "io";
+  if(usage->sys >= usage->user) return "kernel";
+  return "cpu";
+}
+
+static double per_second(uint64_t value, double seconds) {
+  return seconds > 0 ? value / seconds : 0;
+}
+
+
+int stats_init(int *argc, char **argv, const char *tool) {
+  int i, j;
+
+  for(i = 1; i < *argc && strcmp(argv[i], "--") != 0; ) {
+    if(strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0) {
+      stats_format = STATS_TEXT;
+    } else if(strcmp(argv[i], "--stats=json") == 0) {
+      stats_format = STATS_JSON;
+    } else if(strncmp(argv[i], "--stats=", 8) == 0) {
+      fprintf(stderr, "Unknown statistics format '%s'.\n", argv[i] + 8);
+      return -1;
+    } else {
+      ++i;
+      continue;
+    }
+    for(j = i; j < *argc; ++j) argv[j] = argv[j + 1];
+    --*argc;
+  }
+  if(stats_format != STATS_OFF) {
+    stats_tool = tool;
+    sample(&stats_start);
+    atexit(stats_report);
+  }
+  return 0;
+}
+
+
+void stats_phase_end(void) {
+  stats_usage_t now;
+
+  if(stats_format == STATS_OFF || phase_current < 0) return;
+  sample(&now);
+  accumulate(&phases[phase_current].usage, &phase_start, &now);
+  phase_current = -1;
+}
+
+
+void stats_phase(const char *name) {
+  int i;
+
+  if(stats_format == STATS_OFF) return;
+  stats_phase_end();
+  for(i = 0; i < phase_count && strcmp(phases[i].name, name) != 0; ++i);
+  if(i == phase_count) {
+    if(phase_count == STATS_MAX_PHASES) return;
+    phases[phase_count++].name = name;
+  }
+  phase_current = i;
+  sample(&phase_start);
+}
+
+
+void stats_add(uint64_t bytes, uint64_t records) {
+  int current = phase_current;
+
+  if(stats_format == STATS_OFF) return;
+  __atomic_fetch_add(&total_bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total_records, records, __ATOMIC_RELAXED);
+  if(current >= 0) {
+    __atomic_fetch_add(&phases[current].bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&phases[current].records, records, __ATOMIC_RELAXED);
+  }
+}
+
+
+void stats_count(const char *name, uint64_t delta) {
+  int i;
+
+  if(stats_format == STATS_OFF) return;
+  pthread_mutex_lock(&counter_lock);
+  for(i = 0; i < counter_count && strcmp(counters[i].name, name) != 0; ++i);
+  if(i < STATS_MAX_COUNTERS) {
+    if(i == counter_count) {
+      counters[counter_count].name = name;
+      counters[counter_count++].value = 0;
+    }
+    counters[i].value += delta;
+  }
+  pthread_mutex_unlock(&counter_lock);
+}
+
+
+static void print_text_usage(const char *name, const stats_usage_t *usage, uint64_t bytes, uint64_t records) {
+  fprintf(stderr, "stats: %-16s %10.6f %10.6f %10.6f %10.6f %8ld %9ld %14" PRIu64 " %10.2f %12" PRIu64 " %12.0f  %s\n",
+	  name, usage->wall, usage->cpu, usage->user, usage->sys, usage->majflt, usage->minflt,
+	  bytes, per_second(bytes, usage->wall) / 1e6, records, per_second(records, usage->wall), bound(usage));
+}
+
+static void print_json_usage(const stats_usage_t *usage, uint64_t bytes, uint64_t records) {
+  fprintf(stderr, "\"wall\":%.6f,\"cpu\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+	  "\"major_faults\":%ld,\"minor_faults\":%ld,\"block_in\":%ld,\"block_out\":%ld,"
+	  "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,"
+	  "\"bytes\":%" PRIu64 ",\"records\":%" PRIu64 ",\"bytes_per_second\":%.1f,\"records_per_second\":%.1f,\"bound\":\"%s\"",
+	  usage->wall, usage->cpu, usage->user, usage->sys, usage->majflt, usage->minflt,
+	  usage->inblock, usage->oublock, usage->nvcsw, usage->nivcsw,
+	  bytes, records, per_second(bytes, usage->wall), per_second(records, usage->wall), bound(usage));
+}
+
+void stats_report(void) {
+  stats_usage_t now, total;
+  struct rusage ru;
+  int i;
+
+  if(stats_format == STATS_OFF) return;
+  stats_phase_end();
+  sample(&now);
+  memset(&total, 0, sizeof(total));
+  accumulate(&total, &stats_start, &now);
+  getrusage(RUSAGE_SELF, &ru);
+  pthread_mutex_lock(&counter_lock);
+  if(stats_format == STATS_JSON) {
+    fprintf(stderr, "{\"tool\":\"%s\",\"phases\":[", stats_tool);
+    for(i = 0; i < phase_count; ++i) {
+      fprintf(stderr, "%s{\"name\":\"%s\",", i ? "," : "", phases[i].name);
+      print_json_usage(&phases[i].usage, phases[i].bytes, phases[i].records);
+      fputc('}', stderr);
+    }
+    fprintf(stderr, "],\"total\":{");
+    print_json_usage(&total, total_bytes, total_records);
+    fprintf(stderr, ",\"peak_rss_kib\":%ld},\"counters\":{", ru.ru_maxrss);
+    for(i = 0; i < counter_count; ++i) {
+      fprintf(stderr, "%s\"%s\":%" PRIu64, i ? "," : "", counters[i].name, counters[i].value);
+    }
+    fprintf(stderr, "}}\n");
+  } else {
+    fprintf(stderr, "stats: %-16s %10s %10s %10s %10s %8s %9s %14s %10s %12s %12s  %s\n",
+	    stats_tool, "wall[s]", "cpu[s]", "user[s]", "sys[s]", "majflt", "minflt",
+	    "bytes", "MB/s", "records", "records/s", "bound");
+    for(i = 0; i < phase_count; ++i) print_text_usage(phases[i].name, &phases[i].usage, phases[i].bytes, phases[i].records);
+    print_text_usage("total", &total, total_bytes, total_records);
+    fprintf(stderr, "stats: peak RSS %ld KiB, block I/O %ld in %ld out, context switches %ld voluntary %ld involuntary\n",
+	    ru.ru_maxrss, total.inblock, total.oublock, total.nvcsw, total.nivcsw);
+    for(i = 0; i < counter_count; ++i) {
+      fprintf(stderr, "stats: %-24s %" PRIu64 "\n", counters[i].name, counters[i].value);
+    }
+  }
+  pthread_mutex_unlock(&counter_lock);
+  fflush(stderr);
+}
@@ -0,0 +1,71 @@
+#ifndef __STATS_H_2026__
+#define __STATS_H_2026__
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*! \brief Report formats of the run time statistics */
+  enum Stats_Format {
+    STATS_OFF = 0,
+    STATS_TEXT,
+    STATS_JSON
+  };
+
+  //! Current report format, STATS_OFF unless --stats was given.
+  extern enum Stats_Format stats_format;
+
+  /*! \brief Enable the statistics if requested on the command line.
+   *
+   * Looks for "--stats", "--stats=text" and "--stats=json" in front of
+   * a "--" argument and removes them from argv, so the remaining
+   * options can be parsed as before. If found, the report is written
+   * to stderr when the program exits.
+   *
+   * \param argc pointer to the argument count, updated
+   * \param argv argument vector, updated
+   * \param tool name of the tool used in the report
+   * \return 0 on success, -1 for an unknown format
+   */
+  int stats_init(int *argc, char **argv, const char *tool);
+
+  /*! \brief Start a new phase, ending the current one.
+   *
+   * Wall clock, CPU time and resource usage are accounted to the
+   * current phase. Starting a phase with a name used before adds to
+   * its totals. Call only from the main thread.
+   *
+   * \param name phase name, must stay valid (string literal)
+   */
+  void stats_phase(const char *name);
+
+  /*! \brief End the current phase without starting a new one. */
+  void stats_phase_end(void);
+
+  /*! \brief Add processed bytes and records to the current phase.
+   *
+   * May be called from any thread.
+   */
+  void stats_add(uint64_t bytes, uint64_t records);
+
+  /*! \brief Add to a named counter (e.g. lookups or hits).
+   *
+   * May be called from any thread. Hot loops should count locally and
+   * add once at the end.
+   *
+   * \param name counter name, must stay valid (string literal)
+   * \param delta value to add
+   */
+  void stats_count(const char *name, uint64_t delta);
+
+  /*! \brief Write the report to stderr.
+   *
+   * Called automatically at exit if the statistics are enabled.
+   */
+  void stats_report(void);
+
+#ifdef __cplusplus
+};
+#endif
+#endif
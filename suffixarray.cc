@@ -0,0 +1,254 @@
+#include "suffixarray.hh"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+void get_buckets(const int32_t *text, int32_t n, int32_t alphabet, std::vector<int32_t> &bkt, bool end) {
+  int32_t sum = 0;
+
+  std::fill(bkt.begin(), bkt.end(), 0);
+  for(int32_t i = 0; i < n; ++i) bkt[text[i]]++;
+  for(int32_t c = 0; c < alphabet; ++c) {
+    sum += bkt[c];
+    bkt[c] = end ? sum : sum - bkt[c];
+  }
+}
+
+void induce(const int32_t *text, int32_t *sa, int32_t n, int32_t alphabet, const std::vector<uint8_t> &stype, std::vector<int32_t> &bkt) {
+  get_buckets(text, n, alphabet, bkt, false);
+  for(int32_t i = 0; i < n; ++i) {
+    int32_t j = sa[i] - 1;
+    if(sa[i] > 0 && !stype[j]) sa[bkt[text[j]]++] = j;
+  }
+  get_buckets(text, n, alphabet, bkt, true);
+  for(int32_t i = n - 1; i >= 0; --i) {
+    int32_t j = sa[i] - 1;
+    if(sa[i] > 0 && stype[j]) sa[--bkt[text[j]]] = j;
+  }
+}
+
+void sais(const int32_t *text, int32_t *sa, int32_t n, int32_t alphabet) {
+  std::vector<uint8_t> stype(n);
+  std::vector<int32_t> bkt(alphabet);
+  auto is_lms = [&stype](int32_t i) { return i > 0 && stype[i] && !stype[i - 1]; };
+
+  stype[n - 1] = 1;
+  for(int32_t i = n - 2; i >= 0; --i) {
+    stype[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && stype[i + 1]);
+  }
+  //Stage 1: sort the LMS substrings by induction.
+  get_buckets(text, n, alphabet, bkt, true);
+  std::fill(sa, sa + n, -1);
+  for(int32_t i = 1; i < n; ++i) {
+    if(is_lms(i)) sa[--bkt[text[i]]] = i;
+  }
+  induce(text, sa, n, alphabet, stype, bkt);
+  int32_t n1 = 0;
+  for(int32_t i = 0; i < n; ++i) {
+    if(is_lms(sa[i])) sa[n1++] = sa[i];
+  }
+  //Name the LMS substrings.
+  std::fill(sa + n1, sa + n, -1);
+  int32_t name = 0, prev = -1;
+  for(int32_t i = 0; i < n1; ++i) {
+    int32_t pos = sa[i];
+    bool diff = false;
+    for(int32_t d = 0; ; ++d) {
+      if(prev == -1 || text[pos + d] != text[prev + d] || stype[pos + d] != stype[prev + d]) {
+	diff = true;
+	break;
+      } else if(d > 0 && (is_lms(pos + d) || is_lms(prev + d))) {
+	break;
+      }
+    }
+    if(diff) {
+      ++name;
+      prev = pos;
+    }
+    sa[n1 + pos / 2] = name - 1;
+  }
+  for(int32_t i = n - 1, j = n - 1; i >= n1; --i) {
+    if(sa[i] >= 0) sa[j--] = sa[i];
+  }
+  //Stage 2: sort the reduced problem, recursing if names are not unique.
+  int32_t *s1 = sa + n - n1;
+  if(name < n1) {
+    sais(s1, sa, n1, name);
+  } else {
+    for(int32_t i = 0; i < n1; ++i) sa[s1[i]] = i;
+  }
+  //Stage 3: induce the final order from the sorted LMS suffixes.
+  get_buckets(text, n, alphabet, bkt, true);
+  for(int32_t i = 1, j = 0; i < n; ++i) {
+    if(is_lms(i)) s1[j++] = i;
+  }
+  for(int32_t i = 0; i < n1; ++i) sa[i] = s1[sa[i]];
+  std::fill(sa + n1, sa + n, -1);
+  for(int32_t i = n1 - 1; i >= 0; --i) {
+    int32_t j = sa[i];
+    sa[i] = -1;
+    sa[--bkt[text[j]]] = j;
+  }
+  induce(text, sa, n, alphabet, stype, bkt);
+}
+
+}
+
+
+void suffix_array(const int32_t *text, int32_t n, int32_t alphabet, int32_t *sa) {
+  if(n == 1) {
+    sa[0] = 0;
+  } else if(n > 1) {
+    sais(text, sa, n, alphabet);
+  }
+}
+
+
+void lcp_array(const int32_t *text, const int32_t *sa, int32_t n, int32_t *lcp) {
+  std::vector<int32_t> rank(n);
+  int32_t h = 0;
+
+  for(int32_t i = 0; i < n; ++i) rank[sa[i]] = i;
+  for(int32_t i = 0; i < n; ++i) {
+    if(rank[i] > 0) {
+      int32_t j = sa[rank[i] - 1];
+      while(i + h < n && j + h < n && text[i + h] == text[j + h]) ++h;
+      lcp[rank[i]] = h;
+      if(h > 0) --h;
+    } else {
+      lcp[0] = 0;
+      h = 0;
+    }
+  }
+}
+
+
+namespace {
+
+struct Interval {
+  int32_t lcp;
+  int32_t lb;
+  bool satisfied_child; //!< a longer extension already qualifies
+};
+
+void merge_files(uint64_t *files, const uint64_t *other, size_t words) {
+  for(size_t w = 0; w < words; ++w) files[w] |= other[w];
+}
+
+uint32_t count_files(const uint64_t *files, size_t words) {
+  uint32_t count = 0;
+  for(size_t w = 0; w < words; ++w) count += __builtin_popcountll(files[w]);
+  return count;
+}
+
+}
+
+
+void common_substrings(const std::vector<const uint8_t*> &files, const std::vector<size_t> &sizes, uint32_t min_length, uint32_t min_files, const std::function<void(const CommonSubstring &)> &sink) {
+  const int32_t nfiles = files.size();
+  std::vector<int64_t> starts;
+  int64_t total = 1;
+
+  if(min_files < 2) throw std::invalid_argument("substrings must be shared by at least two files");
+  for(auto size : sizes) {
+    starts.push_back(total - 1);
+    total += size + 1;
+  }
+  if(total - 1 > INT32_MAX - 257 - nfiles) {
+    throw std::length_error("input too large for the suffix array");
+  }
+  //Symbols: 0 sentinel, 1..nfiles unique separators, then the bytes.
+  const int32_t n = total - 1;
+  const int32_t alphabet = nfiles + 257;
+  std::vector<int32_t> text(n);
+  for(int32_t f = 0, pos = 0; f < nfiles; ++f) {
+    for(size_t i = 0; i < sizes[f]; ++i, ++pos) {
+      text[pos] = nfiles + 1 + files[f][i];
+    }
+    text[pos++] = f + 1;
+  }
+  //The last separator becomes the sentinel.
+  text[n - 1] = 0;
+  std::vector<int32_t> sa(n);
+  suffix_array(text.data(), n, alphabet, sa.data());
+  std::vector<int32_t> lcp(n);
+  lcp_array(text.data(), sa.data(), n, lcp.data());
+  text.clear();
+  text.shrink_to_fit();
+
+  /* Candidates have no qualifying child, so they do not nest and
+   * checking them costs O(n) in total. A candidate is reported unless
+   * one preceding byte extends it to the left in min_files files.
+   */
+  //File of a text position, the few file starts stay in the cache.
+  auto doc = [&starts](int32_t pos) {
+    return static_cast<int32_t>(std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin()) - 1;
+  };
+  const size_t words = (nfiles + 63) / 64;
+  std::vector<std::pair<int, int32_t> > left;
+  auto report = [&](const Interval &interval, int32_t rb, const uint64_t *file_set) {
+    left.clear();
+    for(int32_t i = interval.lb; i <= rb; ++i) {
+      int32_t f = doc(sa[i]);
+      if(sa[i] > starts[f]) left.emplace_back(files[f][sa[i] - starts[f] - 1], f);
+    }
+    std::sort(left.begin(), left.end());
+    left.erase(std::unique(left.begin(), left.end()), left.end());
+    for(size_t i = 0, j = 0; i < left.size(); i = j) {
+      while(j < left.size() && left[j].first == left[i].first) ++j;
+      if(j - i >= min_files) return;
+    }
+    CommonSubstring common;
+    common.length = interval.lcp;
+    common.files = count_files(file_set, words);
+    common.offsets.assign(nfiles, -1);
+    for(int32_t i = interval.lb; i <= rb; ++i) {
+      int32_t f = doc(sa[i]);
+      if(common.offsets[f] < 0 || sa[i] - starts[f] < common.offsets[f]) common.offsets[f] = sa[i] - starts[f];
+    }
+    sink(common);
+  };
+  //The file sets of the open intervals are kept in one flat array.
+  std::vector<Interval> stack;
+  std::vector<uint64_t> stack_files(words);
+  std::vector<uint64_t> pending(words);
+  bool pending_satisfied;
+  stack.push_back(Interval { 0, 0, false });
+  for(int32_t i = 1; i <= n; ++i) {
+    //Leaf i - 1, separators do not count as occurrences.
+    int32_t pos = sa[i - 1];
+    pending_satisfied = false;
+    std::fill(pending.begin(), pending.end(), 0);
+    int32_t f = doc(pos);
+    if(pos - starts[f] < static_cast<int64_t>(sizes[f])) pending[f / 64] |= 1ULL << (f % 64);
+    int32_t cur = i < n ? lcp[i] : 0;
+    int32_t lb = i - 1;
+    while(cur < stack.back().lcp) {
+      Interval last(stack.back());
+      uint64_t *last_files = &stack_files[(stack.size() - 1) * words];
+      merge_files(last_files, pending.data(), words);
+      last.satisfied_child = last.satisfied_child || pending_satisfied;
+      bool satisfied = last.lcp >= static_cast<int32_t>(min_length) && count_files(last_files, words) >= min_files;
+      if(satisfied && !last.satisfied_child) report(last, i - 1, last_files);
+      pending_satisfied = satisfied || last.satisfied_child;
+      std::copy(last_files, last_files + words, pending.begin());
+      stack.pop_back();
+      lb = last.lb;
+      if(cur <= stack.back().lcp) {
+	merge_files(&stack_files[(stack.size() - 1) * words], pending.data(), words);
+	stack.back().satisfied_child = stack.back().satisfied_child || pending_satisfied;
+	pending_satisfied = false;
+	std::fill(pending.begin(), pending.end(), 0);
+      }
+    }
+    if(cur > stack.back().lcp) {
+      stack.push_back(Interval { cur, lb, pending_satisfied });
+      stack_files.resize(stack.size() * words);
+      std::copy(pending.begin(), pending.end(), stack_files.end() - words);
+    } else {
+      merge_files(&stack_files[(stack.size() - 1) * words], pending.data(), words);
+      stack.back().satisfied_child = stack.back().satisfied_child || pending_satisfied;
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef __SUFFIXARRAY_HH_2026__
+#define __SUFFIXARRAY_HH_2026__
+#include <inttypes.h>
+#include <functional>
+#include <vector>
+
+/*! \brief Build a suffix array with SA-IS in linear time
+ *
+ * The text must end with a unique sentinel 0, all other symbols are
+ * in [1..alphabet).
+ *
+ * \param text the text
+ * \param n length of the text including the sentinel
+ * \param alphabet number of different symbols
+ * \param sa receives the n suffix positions in lexicographic order
+ */
+void suffix_array(const int32_t *text, int32_t n, int32_t alphabet, int32_t *sa);
+
+/*! \brief Longest common prefix array (Kasai et al.)
+ *
+ * lcp[i] is the length of the common prefix of the suffixes sa[i - 1]
+ * and sa[i], lcp[0] is 0.
+ */
+void lcp_array(const int32_t *text, const int32_t *sa, int32_t n, int32_t *lcp);
+
+/*! \brief A maximal substring shared by several files */
+struct CommonSubstring {
+  uint32_t length;
+  uint32_t files; //!< number of files containing it
+  std::vector<int64_t> offsets; //!< one occurrence per file, -1 if absent
+};
+
+/*! \brief Find maximal substrings shared by several files
+ *
+ * A generalised suffix array with LCP array is built over all files
+ * (each terminated by a unique separator) and its LCP intervals are
+ * traversed bottom up. An interval is reported if its substring is at
+ * least min_length long, occurs in at least min_files files and can
+ * not be extended by a byte to the left or right while still
+ * occurring in min_files files.
+ *
+ * \param files data of the files
+ * \param sizes sizes of the files
+ * \param min_length minimum substring length
+ * \param min_files minimum number of files, at least 2
+ * \param sink called for every reported substring
+ */
+void common_substrings(const std::vector<const uint8_t*> &files, const std::vector<size_t> &sizes, uint32_t min_length, uint32_t min_files, const std::function<void(const CommonSubstring &)> &sink);
+
+#endif